@@ -0,0 +1,1865 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+#include "hmac_sha256.h"
+#include "merkle.h"
+#include "sha256.h"
+#include "sha256_cache.h"
+#include "sha256_cdc.h"
+#include "sha256_file.h"
+#include "sha256_jobs.h"
+#include "sha256_search.h"
+#include "sha256_tree.h"
+#if SHA256_INSTRUMENTATION
+#include "sha256_instrumentation.h"
+#endif
+
+#ifndef SHA256_INSTRUMENTATION
+#define SHA256_INSTRUMENTATION 0
+#endif
+
+/* sha256_constexpr_check.cpp: the constexpr C++ rounds against the runtime kernels */
+bool sha256_constexpr_agrees();
+/* sha256.c: its precomputed schedule of the 64-byte padding block against one derived from CONSTANTS */
+bool sha256_padding_schedule_agrees();
+
+#define KiB (1024ull)
+#define MiB (1024ull * KiB)
+#define GiB (1024ull * MiB)
+
+/* Larger inputs do not fit any cache level, so only the cold run is meaningful */
+#define HOT_LIMIT (64 * MiB)
+/* Split-update runs stop here, byte-by-byte updates much earlier */
+#define SPLIT_LIMIT (16 * MiB)
+#define SPLIT_BYTE_LIMIT (64 * KiB)
+/* Copy runs start where the final block stops dominating and need a second buffer of the input's size */
+#define COPY_MINIMUM (4 * KiB)
+#define COPY_LIMIT (256 * MiB)
+#define MAX_ITERATIONS 100000
+#define BATCH_MESSAGES 256
+/* Content-defined chunking runs, fed in updates of CDC_UPDATE bytes */
+#define CDC_UPDATE (4 * MiB)
+#define CDC_MAX_CHUNKS (COPY_LIMIT / 64)
+
+/* Nonces per search run; a target nobody reaches keeps every run the full length */
+#define SEARCH_NONCES (4 * 1024 * 1024)
+
+static const unsigned long long SIZES[] = {
+    0, 1, 16, 32, 55, 56, 64, 80, 100, 256, 1 * KiB, 4 * KiB, 16 * KiB, 64 * KiB, 256 * KiB,
+    1 * MiB, 4 * MiB, 16 * MiB, 64 * MiB, 256 * MiB, 1 * GiB,
+};
+
+static const size_t SPLIT_CHUNKS[] = {1, 13, 64, 4096};
+
+static const size_t BATCH_SIZES[] = {32, 64, 256, 1 * KiB, 4 * KiB, 16 * KiB};
+
+struct options
+{
+    bool json;
+    bool quick;
+    const char *backend;
+    unsigned long long max_size;
+};
+
+enum mode
+{
+    MODE_STREAM,
+    MODE_SPLIT,
+    MODE_ONESHOT,
+    MODE_MANY,
+    /* sha256_update_copy, and the plain memcpy it is measured against */
+    MODE_COPY,
+    MODE_MEMCPY,
+    /* The batch messages submitted one by one to a job manager */
+    MODE_JOBS,
+};
+
+static const char *const MODE_NAMES[] = {"stream", "split", "oneshot", "many", "copy", "memcpy", "jobs"};
+
+struct bench_case
+{
+    const char *backend;
+    enum mode mode;
+    bool cold;
+    size_t size;
+    size_t chunk;
+};
+
+/* Keeps the compiler from dropping digests nobody reads */
+static volatile unsigned char sink;
+
+static unsigned char *buffer;
+static size_t buffer_size;
+/* Page-aligned like a write buffer, so large copies take the streaming path */
+static unsigned char *copy_buffer;
+static const unsigned char *batch_messages[BATCH_MESSAGES];
+static unsigned char batch_digests[BATCH_MESSAGES][32];
+static struct sha256_job batch_jobs[BATCH_MESSAGES];
+
+static unsigned long long timer_overhead;
+static double tsc_hz;
+static bool first_result = true;
+
+static unsigned long long timestamp()
+{
+    _mm_lfence();
+    return __rdtsc();
+}
+
+static double seconds()
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static void calibrate_timer()
+{
+    unsigned long long best = ~0ull;
+
+    for (int i = 0; i < 1000; i++)
+    {
+        unsigned long long start = timestamp();
+        unsigned long long cycles = timestamp() - start;
+        if (cycles < best)
+        {
+            best = cycles;
+        }
+    }
+    timer_overhead = best;
+
+    /* rdtsc ticks at a fixed reference rate, so cycles/byte below are reference cycles */
+    double wall_start = seconds();
+    unsigned long long start = timestamp();
+    while (seconds() - wall_start < 0.1)
+    {
+    }
+    tsc_hz = (timestamp() - start) / (seconds() - wall_start);
+}
+
+static void flush_cache(const unsigned char *data, size_t length)
+{
+    for (size_t i = 0; i < length; i += 64)
+    {
+        _mm_clflush(data + i);
+    }
+    _mm_mfence();
+}
+
+static void hash_stream(const unsigned char *data, size_t length, unsigned char digest[32])
+{
+    struct SHA256 context;
+    sha256_init(&context);
+    sha256_update(&context, data, length);
+    sha256_complete(digest, &context);
+}
+
+static void hash_split(const unsigned char *data, size_t length, size_t chunk, unsigned char digest[32])
+{
+    struct SHA256 context;
+    sha256_init(&context);
+    for (size_t done = 0; done < length; done += chunk)
+    {
+        sha256_update(&context, data + done, length - done < chunk ? length - done : chunk);
+    }
+    sha256_complete(digest, &context);
+}
+
+static void hash_copy(const unsigned char *data, size_t length, size_t chunk, unsigned char *destination, unsigned char digest[32])
+{
+    struct SHA256 context;
+    sha256_init(&context);
+    for (size_t done = 0; done < length; done += chunk)
+    {
+        sha256_update_copy(&context, destination + done, data + done, length - done < chunk ? length - done : chunk);
+    }
+    sha256_complete(digest, &context);
+}
+
+static void hash_jobs(const unsigned char *const *messages, size_t length, size_t count, unsigned char (*digests)[32])
+{
+    struct sha256_jobs *jobs;
+    struct sha256_job *job;
+
+    if (!sha256_jobs_create(&jobs, NULL))
+    {
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        sha256_init(&batch_jobs[i].context);
+        batch_jobs[i].data = messages[i];
+        batch_jobs[i].length = length;
+        batch_jobs[i].more = false;
+        sha256_jobs_submit(jobs, &batch_jobs[i]);
+    }
+    sha256_jobs_flush(jobs);
+    while ((job = sha256_jobs_completed(jobs)) != NULL)
+    {
+        memcpy(digests[job - batch_jobs], job->digest, 32);
+    }
+    sha256_jobs_destroy(jobs);
+}
+
+/* Fragments cycle through a few odd lengths, with empty ones in between */
+static void hash_gather(const unsigned char *data, size_t length, unsigned char digest[32])
+{
+    static const size_t FRAGMENTS[] = {5, 0, 59, 64, 1, 130, 0, 63};
+    struct iovec iov[64];
+    struct SHA256 context;
+    size_t done = 0;
+    int count = 0;
+
+    sha256_init(&context);
+    for (size_t i = 0; done < length; i++)
+    {
+        size_t fragment = FRAGMENTS[i % (sizeof(FRAGMENTS) / sizeof(FRAGMENTS[0]))];
+        iov[count].iov_base = (void *)(data + done);
+        iov[count].iov_len = length - done < fragment ? length - done : fragment;
+        done += iov[count].iov_len;
+
+        if (++count == 64)
+        {
+            sha256_updatev(&context, iov, count);
+            count = 0;
+        }
+    }
+    sha256_updatev(&context, iov, count);
+    sha256_complete(digest, &context);
+}
+
+static void run_case(const struct bench_case *c)
+{
+    unsigned char digest[32] = {0};
+
+    switch (c->mode)
+    {
+    case MODE_STREAM:
+        hash_stream(buffer, c->size, digest);
+        break;
+    case MODE_SPLIT:
+        hash_split(buffer, c->size, c->chunk, digest);
+        break;
+    case MODE_ONESHOT:
+        if (c->size == 32)
+        {
+            sha256_32(digest, buffer);
+        }
+        else if (c->size == 64)
+        {
+            sha256_64(digest, buffer);
+        }
+        else
+        {
+            sha256_80(digest, buffer);
+        }
+        break;
+    case MODE_MANY:
+        sha256_hash_many(batch_messages, c->size, BATCH_MESSAGES, batch_digests);
+        digest[0] = batch_digests[BATCH_MESSAGES - 1][0];
+        break;
+    case MODE_JOBS:
+        hash_jobs(batch_messages, c->size, BATCH_MESSAGES, batch_digests);
+        digest[0] = batch_digests[BATCH_MESSAGES - 1][0];
+        break;
+    case MODE_COPY:
+        hash_copy(buffer, c->size, c->size, copy_buffer, digest);
+        break;
+    case MODE_MEMCPY:
+        memcpy(copy_buffer, buffer, c->size);
+        digest[0] = copy_buffer[c->size / 2];
+        break;
+    }
+    sink = digest[0];
+}
+
+static int compare_cycles(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const struct options *options, const struct bench_case *c, unsigned long long bytes,
+                   const unsigned long long *samples, size_t iterations)
+{
+    unsigned long long total = 0;
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        total += samples[i];
+    }
+
+    double cycles_per_byte = bytes ? (double)total / (bytes * iterations) : 0;
+    double gbps = total ? bytes * iterations / (total / tsc_hz) / 1e9 : 0;
+    unsigned long long p50 = samples[iterations * 50 / 100];
+    unsigned long long p90 = samples[iterations * 90 / 100];
+    unsigned long long p99 = samples[iterations * 99 / 100];
+
+    if (options->json)
+    {
+        printf("%s\n    {\"backend\": \"%s\", \"mode\": \"%s\", \"chunk\": %zu, \"cache\": \"%s\", \"size\": %zu, "
+               "\"bytes\": %llu, \"iterations\": %zu, \"gbps\": %.3f, \"cycles_per_byte\": %.3f, "
+               "\"latency_cycles\": {\"min\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu}}",
+               first_result ? "" : ",", c->backend, MODE_NAMES[c->mode], c->chunk, c->cold ? "cold" : "hot", c->size,
+               bytes, iterations, gbps, cycles_per_byte, samples[0], p50, p90, p99, samples[iterations - 1]);
+    }
+    else
+    {
+        char mode[32];
+        if (c->mode == MODE_SPLIT)
+        {
+            snprintf(mode, sizeof(mode), "split/%zu", c->chunk);
+        }
+        else
+        {
+            snprintf(mode, sizeof(mode), "%s", MODE_NAMES[c->mode]);
+        }
+        printf("%-9s %-11s %-5s %11zu %7zu %8.3f %8.2f %11llu %11llu %11llu\n", c->backend, mode, c->cold ? "cold" : "hot",
+               c->size, iterations, gbps, cycles_per_byte, p50, p90, p99);
+    }
+    first_result = false;
+    fflush(stdout);
+}
+
+static void measure(const struct options *options, const struct bench_case *c)
+{
+    unsigned long long bytes = (c->mode == MODE_MANY || c->mode == MODE_JOBS) ? (unsigned long long)c->size * BATCH_MESSAGES : c->size;
+    unsigned long long budget = options->quick ? 16 * MiB : 256 * MiB;
+    unsigned long long per_iteration = bytes < 64 ? 64 : bytes;
+    size_t iterations = budget / per_iteration;
+
+    if (iterations < 3)
+    {
+        iterations = 3;
+    }
+    if (iterations > MAX_ITERATIONS)
+    {
+        iterations = MAX_ITERATIONS;
+    }
+    if (c->cold && iterations > 1000)
+    {
+        iterations = 1000;
+    }
+
+    unsigned long long *samples = malloc(iterations * sizeof(*samples));
+    if (samples == NULL)
+    {
+        fprintf(stderr, "sha256_bench: out of memory\n");
+        exit(1);
+    }
+
+    size_t touched = (c->mode == MODE_MANY || c->mode == MODE_JOBS) ? c->size * BATCH_MESSAGES : c->size;
+
+    /* One untimed pass resolves dispatch and, for hot runs, pulls the input into cache */
+    run_case(c);
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        if (c->cold)
+        {
+            flush_cache(buffer, touched);
+        }
+
+        unsigned long long start = timestamp();
+        run_case(c);
+        unsigned long long cycles = timestamp() - start;
+        samples[i] = cycles > timer_overhead ? cycles - timer_overhead : 0;
+    }
+
+    qsort(samples, iterations, sizeof(*samples), compare_cycles);
+    report(options, c, bytes, samples, iterations);
+    free(samples);
+}
+
+static bool selected(const struct options *options, const char *name)
+{
+    return options->backend == NULL || strcmp(options->backend, name) == 0;
+}
+
+static void bench_backend(const struct options *options, const char *name)
+{
+    struct bench_case c = {name, MODE_STREAM, false, 0, 0};
+
+    sha256_set_backend(name);
+
+    for (size_t i = 0; i < sizeof(SIZES) / sizeof(SIZES[0]) && SIZES[i] <= options->max_size; i++)
+    {
+        c.size = SIZES[i];
+
+        for (int cold = c.size > HOT_LIMIT; cold <= (c.size > 0); cold++)
+        {
+            c.cold = cold;
+
+            c.mode = MODE_STREAM;
+            c.chunk = 0;
+            measure(options, &c);
+
+            if (c.size == 32 || c.size == 64 || c.size == 80)
+            {
+                c.mode = MODE_ONESHOT;
+                measure(options, &c);
+            }
+
+            if (c.size >= COPY_MINIMUM && c.size <= COPY_LIMIT)
+            {
+                c.mode = MODE_COPY;
+                measure(options, &c);
+                c.mode = MODE_MEMCPY;
+                measure(options, &c);
+            }
+
+            c.mode = MODE_SPLIT;
+            for (size_t j = 0; j < sizeof(SPLIT_CHUNKS) / sizeof(SPLIT_CHUNKS[0]); j++)
+            {
+                c.chunk = SPLIT_CHUNKS[j];
+                if (c.chunk < c.size && c.size <= SPLIT_LIMIT && (c.chunk > 1 || c.size <= SPLIT_BYTE_LIMIT))
+                {
+                    measure(options, &c);
+                }
+            }
+        }
+    }
+}
+
+static void bench_batch_backend(const struct options *options, const char *name)
+{
+    struct bench_case c = {name, MODE_MANY, false, 0, 0};
+
+    sha256_set_batch_backend(name);
+
+    for (size_t i = 0; i < sizeof(BATCH_SIZES) / sizeof(BATCH_SIZES[0]) && BATCH_SIZES[i] <= options->max_size; i++)
+    {
+        c.size = BATCH_SIZES[i];
+        for (size_t j = 0; j < BATCH_MESSAGES; j++)
+        {
+            batch_messages[j] = buffer + j * c.size;
+        }
+
+        for (int cold = 0; cold <= 1; cold++)
+        {
+            c.cold = cold;
+            c.mode = MODE_MANY;
+            measure(options, &c);
+            c.mode = MODE_JOBS;
+            measure(options, &c);
+        }
+    }
+}
+
+static unsigned long long emitted_chunks;
+
+static void count_chunks(const struct sha256_chunk *chunks, size_t count, void *argument)
+{
+    (void)argument;
+    emitted_chunks += count;
+    sink = chunks[count - 1].digest[0];
+}
+
+/* Boundaries for the whole input first, then sha256_update per chunk: chunking without sha256_cdc */
+static unsigned long long chunk_two_pass(struct sha256_cdc *cdc, const unsigned char *data, size_t length, size_t *lengths)
+{
+    unsigned long long count = 0;
+    unsigned char digest[32];
+
+    for (size_t offset = 0; offset < length; offset += lengths[count++])
+    {
+        lengths[count] = sha256_cdc_cut(cdc, data + offset, length - offset);
+    }
+    for (size_t i = 0, offset = 0; i < count; offset += lengths[i++])
+    {
+        hash_stream(data + offset, lengths[i], digest);
+        sink = digest[0];
+    }
+    return count;
+}
+
+static void bench_chunking(const struct options *options, size_t length)
+{
+    struct sha256_cdc_options cdc_options = {0, 0, 0, count_chunks, NULL};
+    struct sha256_cdc *cdc;
+    size_t *lengths = malloc(CDC_MAX_CHUNKS * sizeof(*lengths));
+    double single = 0, two = 0;
+    unsigned long long chunks = 0;
+
+    if (lengths == NULL || !sha256_cdc_create(&cdc, &cdc_options))
+    {
+        free(lengths);
+        return;
+    }
+    for (int run = 0; run < (options->quick ? 1 : 3); run++)
+    {
+        double start = seconds();
+        emitted_chunks = 0;
+        for (size_t offset = 0; offset < length; offset += CDC_UPDATE)
+        {
+            sha256_cdc_update(cdc, copy_buffer + offset, length - offset < CDC_UPDATE ? length - offset : CDC_UPDATE);
+        }
+        sha256_cdc_finish(cdc);
+        double middle = seconds();
+        chunks = chunk_two_pass(cdc, copy_buffer, length, lengths);
+        double end = seconds();
+
+        single = single == 0 || middle - start < single ? middle - start : single;
+        two = two == 0 || end - middle < two ? end - middle : two;
+    }
+    sha256_cdc_destroy(cdc);
+    free(lengths);
+
+    if (options->json)
+    {
+        printf("%s\n    {\"size\": %zu, \"chunks\": %llu, \"single_pass_gbps\": %.3f, \"two_pass_gbps\": %.3f}",
+               first_result ? "" : ",", length, chunks, length / single / 1e9, length / two / 1e9);
+    }
+    else
+    {
+        printf("%11zu %9llu %12.3f %12.3f\n", length, chunks, length / single / 1e9, length / two / 1e9);
+    }
+    if (emitted_chunks != chunks)
+    {
+        fprintf(stderr, "sha256_bench: sha256_cdc emits %llu chunks where the two-pass cut finds %llu\n", emitted_chunks, chunks);
+    }
+    first_result = false;
+    fflush(stdout);
+}
+
+static void bench_search_backend(const struct options *options, const char *name, unsigned int threads)
+{
+    struct sha256_search_options search_options = {threads, name};
+    struct sha256_search_job job;
+    struct sha256_search_result result;
+
+    /* An 80-byte header: the first block goes into the midstate, the nonce sits in the last 4 of 16 tail bytes */
+    memset(&job, 0, sizeof(job));
+    sha256_midstate(job.midstate, buffer);
+    job.prefix_length = 64;
+    job.tail = buffer + 64;
+    job.tail_length = 16;
+    job.nonce_offset = 12;
+    job.nonce_size = 4;
+
+    sha256_search(&job, 0, options->quick ? SEARCH_NONCES / 8 : SEARCH_NONCES, &search_options, &result);
+    if (options->json)
+    {
+        printf("%s\n    {\"backend\": \"%s\", \"threads\": %u, \"hashes\": %llu, \"seconds\": %.6f, "
+               "\"hashes_per_second\": %.0f, \"hashes_per_second_per_core\": %.0f}",
+               first_result ? "" : ",", result.backend, result.threads, result.hashes, result.seconds,
+               result.hashes_per_second, result.hashes_per_second_per_core);
+    }
+    else
+    {
+        printf("%-9s %7u %12llu %10.2f %14.2f\n", result.backend, result.threads, result.hashes, result.hashes_per_second / 1e6,
+               result.hashes_per_second_per_core / 1e6);
+    }
+    first_result = false;
+    fflush(stdout);
+}
+
+/* Known answers, the parts are fed as separate updates */
+struct known_answer
+{
+    const char *parts[4];
+    const char *digest;
+};
+
+static const struct known_answer KNOWN_ANSWERS[] = {
+    {{"hello", " ", "world", "1111111111111111111111111111111111111111111111111111122222222222222222222222222222222222222222222222222222222222222223333333333333333333333333333333333333333333333333333333333333333"},
+     "e0c00eec1438d3d91cdf61901416fabb43e5e0c72b23a72ebb9165848ac31a47"},
+    {{""}, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+    {{"abc"}, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+    {{"ale,etopakistan?ale,etopakistan?ale,etopakistan?ale,etopakistan?"}, "0b8b1f0a231239a67468d9169bef9ef09a26d3197d3ba0b4116d9afbedf83d3c"},
+    {{"00000", "11111111111111111111111111111111111111111111111111111222222222222222222222222222222222222222222222222222222222222222233333333333333333333333333333333333333333333333333333333333333333"},
+     "64ff1d020a5775f544240a6d63469818c40de3a2e5eaa6335afccdd2b9c06154"},
+    {{"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"}, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+};
+
+#define SWEEP_LENGTH 1024
+
+static void to_hex(char hex[65], const unsigned char digest[32])
+{
+    for (int i = 0; i < 32; i++)
+    {
+        snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+    }
+}
+
+static bool check(const char *backend, const char *what, size_t length, const unsigned char actual[32], const unsigned char expected[32])
+{
+    if (memcmp(actual, expected, 32) == 0)
+    {
+        return true;
+    }
+
+    char hex[65];
+    to_hex(hex, actual);
+    fprintf(stderr, "sha256_bench: %s: %s of %zu bytes gives %s\n", backend, what, length, hex);
+    return false;
+}
+
+static bool known_answer_test(const char *backend)
+{
+    static unsigned char reference[SWEEP_LENGTH + 1][32];
+    static const size_t SWEEP_CHUNKS[] = {1, 7, 63, 64, 65};
+    unsigned char digest[32];
+    unsigned char expected[32];
+    bool passed = true;
+
+    for (size_t i = 0; i < sizeof(KNOWN_ANSWERS) / sizeof(KNOWN_ANSWERS[0]); i++)
+    {
+        struct SHA256 context;
+        size_t length = 0;
+        sha256_init(&context);
+        for (int j = 0; j < 4 && KNOWN_ANSWERS[i].parts[j] != NULL; j++)
+        {
+            sha256_update(&context, (const unsigned char *)KNOWN_ANSWERS[i].parts[j], strlen(KNOWN_ANSWERS[i].parts[j]));
+            length += strlen(KNOWN_ANSWERS[i].parts[j]);
+        }
+        sha256_complete(digest, &context);
+
+        for (int j = 0; j < 32; j++)
+        {
+            sscanf(KNOWN_ANSWERS[i].digest + 2 * j, "%2hhx", &expected[j]);
+        }
+        passed &= check(backend, "known answer", length, digest, expected);
+    }
+
+    /* The first backend checked against the vectors becomes the reference for every length */
+    static bool have_reference = false;
+    if (!have_reference)
+    {
+        for (size_t length = 0; length <= SWEEP_LENGTH; length++)
+        {
+            hash_stream(buffer, length, reference[length]);
+        }
+        have_reference = passed;
+    }
+
+    for (size_t length = 0; length <= SWEEP_LENGTH; length++)
+    {
+        hash_stream(buffer, length, digest);
+        passed &= check(backend, "update", length, digest, reference[length]);
+
+        for (size_t j = 0; j < sizeof(SWEEP_CHUNKS) / sizeof(SWEEP_CHUNKS[0]); j++)
+        {
+            hash_split(buffer, length, SWEEP_CHUNKS[j], digest);
+            passed &= check(backend, "split update", length, digest, reference[length]);
+        }
+
+        hash_gather(buffer, length, digest);
+        passed &= check(backend, "sha256_updatev", length, digest, reference[length]);
+
+        for (size_t j = 0; j < sizeof(SWEEP_CHUNKS) / sizeof(SWEEP_CHUNKS[0]); j++)
+        {
+            memset(copy_buffer, 0, length + 1);
+            hash_copy(buffer, length, SWEEP_CHUNKS[j], copy_buffer + 1, digest);
+            passed &= check(backend, "sha256_update_copy", length, digest, reference[length]);
+            if (memcmp(copy_buffer + 1, buffer, length) != 0 || copy_buffer[0] != 0)
+            {
+                fprintf(stderr, "sha256_bench: %s: sha256_update_copy of %zu bytes copies wrongly\n", backend, length);
+                passed = false;
+            }
+        }
+    }
+
+    /* Large enough to take the streaming path, and once more with the destination off alignment */
+    for (size_t offset = 0; offset <= 1; offset++)
+    {
+        size_t length = 2 * MiB + 5;
+        hash_stream(buffer, length, expected);
+        hash_copy(buffer, length, length, copy_buffer + offset, digest);
+        passed &= check(backend, "sha256_update_copy", length, digest, expected);
+        if (memcmp(copy_buffer + offset, buffer, length) != 0)
+        {
+            fprintf(stderr, "sha256_bench: %s: sha256_update_copy of %zu bytes copies wrongly\n", backend, length);
+            passed = false;
+        }
+    }
+
+    /* Checkpoints resume to the same digest, and a flipped bit anywhere is refused */
+    for (size_t length = 0; length <= SWEEP_LENGTH; length += 37)
+    {
+        unsigned char state[SHA256_EXPORT_SIZE];
+        struct SHA256 context;
+        sha256_init(&context);
+        sha256_update(&context, buffer, length / 2);
+        sha256_export(state, &context);
+        memset(&context, 0xff, sizeof(context));
+        if (!sha256_import(&context, state))
+        {
+            fprintf(stderr, "sha256_bench: %s: sha256_import refuses its own export at %zu bytes\n", backend, length / 2);
+            passed = false;
+            continue;
+        }
+        sha256_update(&context, buffer + length / 2, length - length / 2);
+        sha256_complete(digest, &context);
+        passed &= check(backend, "sha256_import", length, digest, reference[length]);
+
+        for (size_t bit = 0; bit < 8 * sizeof(state); bit += 13)
+        {
+            state[bit / 8] ^= 1 << bit % 8;
+            if (sha256_import(&context, state))
+            {
+                fprintf(stderr, "sha256_bench: %s: sha256_import accepts a checkpoint with bit %zu flipped\n", backend, bit);
+                passed = false;
+            }
+            state[bit / 8] ^= 1 << bit % 8;
+        }
+    }
+
+    if (!sha256_constexpr_agrees())
+    {
+        fprintf(stderr, "sha256_bench: %s: constexpr digests from sha256.hpp differ from the runtime ones\n", backend);
+        passed = false;
+    }
+
+    if (!sha256_padding_schedule_agrees())
+    {
+        fprintf(stderr, "sha256_bench: %s: the padding schedule of sha256_64 does not follow from CONSTANTS\n", backend);
+        passed = false;
+    }
+
+    unsigned int midstate[8];
+    sha256_32(digest, buffer);
+    passed &= check(backend, "sha256_32", 32, digest, reference[32]);
+    sha256_64(digest, buffer);
+    passed &= check(backend, "sha256_64", 64, digest, reference[64]);
+    sha256_80(digest, buffer);
+    passed &= check(backend, "sha256_80", 80, digest, reference[80]);
+    sha256_midstate(midstate, buffer);
+    sha256_80_midstate(digest, midstate, buffer + 64);
+    passed &= check(backend, "sha256_80_midstate", 80, digest, reference[80]);
+
+    hash_stream(reference[80], 32, expected);
+    sha256d_80(digest, buffer);
+    passed &= check(backend, "sha256d_80", 80, digest, expected);
+    sha256d_80_midstate(digest, midstate, buffer + 64);
+    passed &= check(backend, "sha256d_80_midstate", 80, digest, expected);
+
+    return passed;
+}
+
+static struct sha256_chunk kat_chunks[1024];
+static size_t kat_chunk_count;
+
+static void collect_chunks(const struct sha256_chunk *chunks, size_t count, void *argument)
+{
+    (void)argument;
+    for (size_t i = 0; i < count && kat_chunk_count < 1024; i++)
+    {
+        kat_chunks[kat_chunk_count++] = chunks[i];
+    }
+}
+
+/* sha256_cdc against its own boundary search and the streaming API, whatever the update sizes */
+static bool chunking_known_answer_test(const char *backend)
+{
+    static const size_t UPDATES[] = {1, 100, 4096, 64 * KiB};
+    static unsigned char data[64 * KiB];
+    struct sha256_cdc_options options = {64, 256, 1024, collect_chunks, NULL};
+    struct sha256_cdc *cdc;
+    unsigned char expected[32];
+    bool passed = true;
+
+    /* Noise with a run of zeros long enough that only max_size ends its chunks */
+    unsigned long long noise = 1;
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        noise ^= noise << 13;
+        noise ^= noise >> 7;
+        noise ^= noise << 17;
+        data[i] = i >= 20000 && i < 24000 ? 0 : (unsigned char)(noise >> 32);
+    }
+
+    if (!sha256_cdc_create(&cdc, &options))
+    {
+        fprintf(stderr, "sha256_bench: %s: sha256_cdc_create fails\n", backend);
+        return false;
+    }
+    for (size_t u = 0; u < sizeof(UPDATES) / sizeof(UPDATES[0]); u++)
+    {
+        kat_chunk_count = 0;
+        for (size_t offset = 0; offset < sizeof(data); offset += UPDATES[u])
+        {
+            sha256_cdc_update(cdc, data + offset, sizeof(data) - offset < UPDATES[u] ? sizeof(data) - offset : UPDATES[u]);
+        }
+        sha256_cdc_finish(cdc);
+
+        size_t offset = 0, i = 0;
+        for (; offset < sizeof(data) && i < kat_chunk_count; i++)
+        {
+            size_t length = sha256_cdc_cut(cdc, data + offset, sizeof(data) - offset);
+            if (kat_chunks[i].offset != offset || kat_chunks[i].length != length || length > 1024 ||
+                (length < 64 && offset + length < sizeof(data)))
+            {
+                break;
+            }
+            hash_stream(data + offset, length, expected);
+            passed &= check(backend, "sha256_cdc chunk", length, kat_chunks[i].digest, expected);
+            offset += length;
+        }
+        if (offset != sizeof(data) || i != kat_chunk_count)
+        {
+            fprintf(stderr, "sha256_bench: %s: sha256_cdc in updates of %zu bytes goes wrong at chunk %zu\n", backend, UPDATES[u], i);
+            passed = false;
+        }
+    }
+    sha256_cdc_destroy(cdc);
+
+    /* No options are the default sizes, the same as all of them 0 */
+    struct sha256_cdc *defaults, *zeros;
+    struct sha256_cdc_options zero_options = {0, 0, 0, NULL, NULL};
+    if (!sha256_cdc_create(&defaults, NULL) || !sha256_cdc_create(&zeros, &zero_options))
+    {
+        fprintf(stderr, "sha256_bench: %s: sha256_cdc_create fails with the default sizes\n", backend);
+        return false;
+    }
+    size_t length = sha256_cdc_cut(defaults, data, sizeof(data));
+    if (length != sha256_cdc_cut(zeros, data, sizeof(data)) || length < 2 * KiB || length > 64 * KiB)
+    {
+        fprintf(stderr, "sha256_bench: %s: sha256_cdc without options cuts %zu bytes\n", backend, length);
+        passed = false;
+    }
+    sha256_cdc_destroy(zeros);
+    sha256_cdc_destroy(defaults);
+    return passed;
+}
+
+/* Key, message and MAC in hex: RFC 4231 cases 1 to 7, case 5 truncated to 128 bits as there */
+static const char *const HMAC_ANSWERS[][3] = {
+    {"0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b", "4869205468657265", "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7"},
+    {"4a656665", "7768617420646f2079612077616e7420666f72206e6f7468696e673f", "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"},
+    {"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+     "dddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddddd",
+     "773ea91e36800e46854db8ebd09181a72959098b3ef8c122d9635514ced565fe"},
+    {"0102030405060708090a0b0c0d0e0f10111213141516171819",
+     "cdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcdcd",
+     "82558a389a443c0ea4cc819899f2083a85f0faa3e578f8077a2e3ff46729665b"},
+    {"0c0c0c0c0c0c0c0c0c0c0c0c0c0c0c0c0c0c0c0c", "546573742057697468205472756e636174696f6e", "a3b6167473100ee06e0c796c2955552b"},
+    {"KEY131",
+     "54657374205573696e67204c6172676572205468616e20426c6f636b2d53697a65204b6579202d2048617368204b6579204669727374",
+     "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54"},
+    {"KEY131",
+     "5468697320697320612074657374207573696e672061206c6172676572207468616e20626c6f636b2d73697a65206b657920616e642061206c61"
+     "72676572207468616e20626c6f636b2d73697a6520646174612e20546865206b6579206e6565647320746f20626520686173686564206265666f"
+     "7265206265696e6720757365642062792074686520484d414320616c676f726974686d2e",
+     "9b09ffa71b942fcb27635fbcd5b0e944bfdc63644f0713938a7f51535c3a35e2"},
+};
+
+/* Password, salt, iterations, output length and output: the common PBKDF2-HMAC-SHA256 vectors and
+ * RFC 7914's two-block one. The last row is long enough to fill the lanes of every batch kernel and
+ * leave a remainder, so its output is checked through its SHA-256. */
+static const struct
+{
+    const char *password;
+    const char *salt;
+    unsigned long iterations;
+    size_t length;
+    const char *output;
+} PBKDF2_ANSWERS[] = {
+    {"password", "salt", 1, 32, "120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b"},
+    {"password", "salt", 2, 32, "ae4d0c95af6b46d32d0adff928f06dd02a303f8ef3c251dfd6e2d85a95474c43"},
+    {"password", "salt", 4096, 32, "c5e478d59288c841aa530db6845c4c8d962893a001ce4e11a4963873aa98134a"},
+    {"passwordPASSWORDpassword", "saltSALTsaltSALTsaltSALTsaltSALTsalt", 4096, 40,
+     "348c89dbcbd32b2f32d814b8116e84cf2b17347ebc1800181c4e2a1fb8dd53e1c635518c7dac47e9"},
+    {"passwd", "salt", 1, 64,
+     "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783"},
+    {"password", "salt", 3, 600, "cdeb4c43bf7a5966b0e98bfc65ca8720e9594d72dc02d655a33e12017dc86f27"},
+};
+
+/* RFC 5869 cases 1 to 3: salt, input key material, info, PRK and OKM; case 3 has neither salt nor info */
+static const char *const HKDF_ANSWERS[][5] = {
+    {"000102030405060708090a0b0c", "0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b", "f0f1f2f3f4f5f6f7f8f9",
+     "077709362c2e32df0ddc3f0dc47bba6390b6c73bb50f9c3122ec844ad7c2b3e5",
+     "3cb25f25faacd57a90434f64d0362f2a2d2d0a90cf1a5a4c5db02d56ecc4c5bf34007208d5b887185865"},
+    {"606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9fa0a1a2a3a4a5a6a7a8a9aaabacadaeaf",
+     "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f404142434445464748494a4b4c4d4e4f",
+     "b0b1b2b3b4b5b6b7b8b9babbbcbdbebfc0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedfe0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff",
+     "06a6b88c5853361a06104c9ceb35b45cef760014904671014a193f40c15fc244",
+     "b11e398dc80327a1c8e7f78c596a49344f012eda2d4efad8a050cc4c19afa97c59045a99cac7827271cb41c65e590e09da3275600c2f09b8367793a9aca3db71cc30c58179ec3e87c14c01d5c1f3434f1d87"},
+    {"", "0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b", "", "19ef24a32c717b167f33a91d6f648bdf96596776afdb6377ac434c1c293ccb04",
+     "8da4e775a563c18f715f802a063c5a31b8a11f5c5ee1879ec3454e5f3c738d2d9d201395faa4b61a96c8"},
+};
+
+/* KEY131 stands for the 131 bytes of 0xaa that RFC 4231 uses to force hashing the key */
+static size_t from_hex(unsigned char *bytes, const char *hex)
+{
+    if (strcmp(hex, "KEY131") == 0)
+    {
+        memset(bytes, 0xaa, 131);
+        return 131;
+    }
+    size_t length = strlen(hex) / 2;
+    for (size_t i = 0; i < length; i++)
+    {
+        sscanf(hex + 2 * i, "%2hhx", &bytes[i]);
+    }
+    return length;
+}
+
+static bool check_hex(const char *backend, const char *what, size_t row, const unsigned char *actual, const char *expected)
+{
+    unsigned char bytes[256];
+    size_t length = from_hex(bytes, expected);
+
+    if (memcmp(actual, bytes, length) == 0)
+    {
+        return true;
+    }
+    fprintf(stderr, "sha256_bench: %s: %s of known answer %zu differs\n", backend, what, row);
+    return false;
+}
+
+/* HMAC, PBKDF2 and HKDF against their RFC vectors; PBKDF2 spreads output blocks over the lanes of the
+ * batch kernel under test */
+static bool mac_known_answer_test(const char *backend)
+{
+    unsigned char key_bytes[256], message[256], info[256];
+    unsigned char output[600];
+    struct HMAC_SHA256_KEY key;
+    bool passed = true;
+
+    for (size_t i = 0; i < sizeof(HMAC_ANSWERS) / sizeof(HMAC_ANSWERS[0]); i++)
+    {
+        size_t key_length = from_hex(key_bytes, HMAC_ANSWERS[i][0]);
+        size_t length = from_hex(message, HMAC_ANSWERS[i][1]);
+        struct HMAC_SHA256 context;
+
+        hmac_sha256_key_init(&key, key_bytes, key_length);
+        hmac_sha256(output, &key, message, length);
+        passed &= check_hex(backend, "hmac_sha256", i, output, HMAC_ANSWERS[i][2]);
+
+        /* The same MAC a byte, then the rest */
+        hmac_sha256_init(&context, &key);
+        hmac_sha256_update(&context, message, 1);
+        hmac_sha256_update(&context, message + 1, length - 1);
+        hmac_sha256_complete(output, &context);
+        passed &= check_hex(backend, "hmac_sha256_update", i, output, HMAC_ANSWERS[i][2]);
+        hmac_sha256_key_clear(&key);
+    }
+
+    for (size_t i = 0; i < sizeof(PBKDF2_ANSWERS) / sizeof(PBKDF2_ANSWERS[0]); i++)
+    {
+        pbkdf2_hmac_sha256(output, PBKDF2_ANSWERS[i].length, (const unsigned char *)PBKDF2_ANSWERS[i].password, strlen(PBKDF2_ANSWERS[i].password),
+                           (const unsigned char *)PBKDF2_ANSWERS[i].salt, strlen(PBKDF2_ANSWERS[i].salt), PBKDF2_ANSWERS[i].iterations);
+        if (PBKDF2_ANSWERS[i].length > 64)
+        {
+            hash_stream(output, PBKDF2_ANSWERS[i].length, output);
+        }
+        passed &= check_hex(backend, "pbkdf2_hmac_sha256", i, output, PBKDF2_ANSWERS[i].output);
+    }
+
+    for (size_t i = 0; i < sizeof(HKDF_ANSWERS) / sizeof(HKDF_ANSWERS[0]); i++)
+    {
+        size_t salt_length = from_hex(key_bytes, HKDF_ANSWERS[i][0]);
+        size_t ikm_length = from_hex(message, HKDF_ANSWERS[i][1]);
+        size_t info_length = from_hex(info, HKDF_ANSWERS[i][2]);
+        size_t length = strlen(HKDF_ANSWERS[i][4]) / 2;
+        const unsigned char *salt = salt_length != 0 ? key_bytes : NULL;
+        const unsigned char *info_bytes = info_length != 0 ? info : NULL;
+        unsigned char prk[32];
+
+        hkdf_sha256_extract(prk, salt, salt_length, message, ikm_length);
+        passed &= check_hex(backend, "hkdf_sha256_extract", i, prk, HKDF_ANSWERS[i][3]);
+        if (!hkdf_sha256_expand(output, length, prk, info_bytes, info_length))
+        {
+            output[0] ^= 1;
+        }
+        passed &= check_hex(backend, "hkdf_sha256_expand", i, output, HKDF_ANSWERS[i][4]);
+        memset(output, 0, length);
+        if (!hkdf_sha256(output, length, salt, salt_length, message, ikm_length, info_bytes, info_length))
+        {
+            output[0] ^= 1;
+        }
+        passed &= check_hex(backend, "hkdf_sha256", i, output, HKDF_ANSWERS[i][4]);
+        if (hkdf_sha256_expand(output, 255 * 32 + 1, prk, info_bytes, info_length))
+        {
+            fprintf(stderr, "sha256_bench: %s: hkdf_sha256_expand accepts more than 255 blocks\n", backend);
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+/* Roots over the first 1, 2, 3, 5 and 7 leaves of buffer, from a reference that promotes odd nodes */
+static const struct
+{
+    size_t leaves;
+    const char *root;
+} MERKLE_ANSWERS[] = {
+    {1, "078a0d901396199c1fa225a82bae31b437ba3dc043c649cc4fd255d85bde61e4"},
+    {2, "b337ba9b0c69c391364e985fdcb23a889887e59800832c92fbfa22b8a3c40304"},
+    {3, "723fbfcf031f4d8ece28b679e736d2addc5b43b64d1021e3b0bad850fb18577b"},
+    {5, "d12b2dc04685e9ab72c63f5405dea3a30f9ba9d5c57bf016749ed1ea338a4470"},
+    {7, "4621013fcb137ec8c72f433822ede8e60d02639435f5bb6efe730b480785dd2e"},
+};
+
+/* Wide enough that the pool hashes the lowest levels */
+#define MERKLE_PARALLEL_LEAVES 20000
+
+/* Known roots, the frontier against the built tree, every proof of the smaller trees with and without a
+ * flipped sibling, and the threaded build against the single-threaded one */
+static bool merkle_known_answer_test(const char *backend)
+{
+    const unsigned char (*leaves)[32] = (const unsigned char (*)[32])buffer;
+    unsigned char proof[MERKLE_MAX_DEPTH][32];
+    unsigned char root[32];
+    struct merkle_tree tree, threaded;
+    struct merkle_frontier frontier;
+    bool passed = true;
+
+    for (size_t i = 0; i < sizeof(MERKLE_ANSWERS) / sizeof(MERKLE_ANSWERS[0]); i++)
+    {
+        if (!merkle_tree_build(&tree, leaves, MERKLE_ANSWERS[i].leaves, 1))
+        {
+            fprintf(stderr, "sha256_bench: %s: merkle_tree_build fails\n", backend);
+            return false;
+        }
+        passed &= check_hex(backend, "merkle_tree_root", i, merkle_tree_root(&tree), MERKLE_ANSWERS[i].root);
+        merkle_tree_free(&tree);
+    }
+
+    merkle_frontier_init(&frontier);
+    for (size_t count = 1; count <= 300; count++)
+    {
+        merkle_frontier_append(&frontier, leaves[count - 1]);
+        if (!merkle_tree_build(&tree, leaves, count, 1))
+        {
+            fprintf(stderr, "sha256_bench: %s: merkle_tree_build fails\n", backend);
+            return false;
+        }
+        merkle_frontier_root(root, &frontier);
+        passed &= check(backend, "merkle_frontier_root", count, root, merkle_tree_root(&tree));
+
+        for (size_t index = 0; index < count && (count <= 40 || count == 300); index++)
+        {
+            size_t length = merkle_tree_proof(&tree, index, proof);
+            bool valid = merkle_proof_verify(merkle_tree_root(&tree), leaves[index], index, count, (const unsigned char (*)[32])proof, length);
+            bool forged = false;
+            for (size_t j = 0; j < length; j++)
+            {
+                proof[j][j % 32] ^= 1;
+                forged |= merkle_proof_verify(merkle_tree_root(&tree), leaves[index], index, count, (const unsigned char (*)[32])proof, length);
+                proof[j][j % 32] ^= 1;
+            }
+            if (!valid || forged)
+            {
+                fprintf(stderr, "sha256_bench: %s: the proof of leaf %zu of %zu %s\n", backend, index, count, valid ? "verifies with a flipped sibling" : "does not verify");
+                passed = false;
+            }
+        }
+        if (merkle_tree_proof(&tree, count, proof) != 0)
+        {
+            fprintf(stderr, "sha256_bench: %s: merkle_tree_proof gives a proof for leaf %zu of %zu\n", backend, count, count);
+            passed = false;
+        }
+        merkle_tree_free(&tree);
+    }
+
+    if (!merkle_tree_build(&tree, leaves, MERKLE_PARALLEL_LEAVES, 1) || !merkle_tree_build(&threaded, leaves, MERKLE_PARALLEL_LEAVES, 4))
+    {
+        fprintf(stderr, "sha256_bench: %s: merkle_tree_build fails\n", backend);
+        return false;
+    }
+    if (memcmp(tree.nodes, threaded.nodes, tree.level_offset[tree.level_count] * 32) != 0)
+    {
+        fprintf(stderr, "sha256_bench: %s: merkle_tree_build on 4 threads differs from 1 thread\n", backend);
+        passed = false;
+    }
+    merkle_tree_free(&threaded);
+    merkle_tree_free(&tree);
+    return passed;
+}
+
+static bool batch_known_answer_test(const char *backend)
+{
+    static const size_t LENGTHS[] = {0, 1, 55, 56, 64, 119, 300};
+    const unsigned char *messages[37];
+    unsigned char digests[37][32];
+    unsigned char expected[32];
+    bool passed = true;
+
+    for (size_t i = 0; i < sizeof(LENGTHS) / sizeof(LENGTHS[0]); i++)
+    {
+        for (size_t count = 1; count <= 37; count += 6)
+        {
+            for (size_t j = 0; j < count; j++)
+            {
+                messages[j] = buffer + j * 301;
+            }
+            sha256_hash_many(messages, LENGTHS[i], count, digests);
+
+            for (size_t j = 0; j < count; j++)
+            {
+                hash_stream(messages[j], LENGTHS[i], expected);
+                passed &= check(backend, "sha256_hash_many", LENGTHS[i], digests[j], expected);
+            }
+        }
+    }
+
+    sha256_64_many(digests, (const unsigned char (*)[64])buffer, 37);
+    for (size_t j = 0; j < 37; j++)
+    {
+        hash_stream(buffer + j * 64, 64, expected);
+        passed &= check(backend, "sha256_64_many", 64, digests[j], expected);
+    }
+
+    /* Lengths from 0 to a few blocks in an irregular order, so lanes finish and refill at different times */
+    size_t lengths[37];
+    for (size_t count = 1; count <= 37; count += 4)
+    {
+        for (size_t j = 0; j < count; j++)
+        {
+            lengths[j] = (j * 97 + count * 13) % 300;
+            messages[j] = buffer + j * 301;
+        }
+        sha256_hash_many_lengths(messages, lengths, count, digests);
+
+        for (size_t j = 0; j < count; j++)
+        {
+            hash_stream(messages[j], lengths[j], expected);
+            passed &= check(backend, "sha256_hash_many_lengths", lengths[j], digests[j], expected);
+        }
+    }
+
+    /* The same lengths through a job manager, every third message continuing a context that already
+     * holds a few bytes and every fifth split in two jobs */
+    struct sha256_jobs_options job_options = {NULL, NULL, 0, backend};
+    struct sha256_job jobs_list[37];
+    struct sha256_jobs *jobs;
+    struct sha256_job *job;
+    if (!sha256_jobs_create(&jobs, &job_options))
+    {
+        fprintf(stderr, "sha256_bench: %s: sha256_jobs_create fails\n", backend);
+        return false;
+    }
+    for (size_t j = 0; j < 37; j++)
+    {
+        size_t prefix = j % 3 == 0 ? j % 70 : 0;
+        lengths[j] = (j * 97 + 13) % 300;
+        sha256_init(&jobs_list[j].context);
+        sha256_update(&jobs_list[j].context, buffer + j * 301, prefix);
+        jobs_list[j].data = buffer + j * 301 + prefix;
+        jobs_list[j].length = j % 5 == 0 ? lengths[j] / 2 : lengths[j];
+        jobs_list[j].more = j % 5 == 0;
+        lengths[j] += prefix;
+        sha256_jobs_submit(jobs, &jobs_list[j]);
+    }
+    sha256_jobs_flush(jobs);
+    while ((job = sha256_jobs_completed(jobs)) != NULL)
+    {
+        size_t j = (size_t)(job - jobs_list);
+        if (job->more)
+        {
+            job->data += job->length;
+            job->length = buffer + j * 301 + lengths[j] - job->data;
+            job->more = false;
+            sha256_jobs_submit(jobs, job);
+            sha256_jobs_flush(jobs);
+            continue;
+        }
+        hash_stream(buffer + j * 301, lengths[j], expected);
+        passed &= check(backend, "sha256_jobs", lengths[j], job->digest, expected);
+    }
+    if (sha256_jobs_in_flight(jobs) != 0)
+    {
+        fprintf(stderr, "sha256_bench: %s: sha256_jobs loses jobs\n", backend);
+        passed = false;
+    }
+    sha256_jobs_destroy(jobs);
+
+    passed &= chunking_known_answer_test(backend);
+    passed &= mac_known_answer_test(backend);
+    passed &= merkle_known_answer_test(backend);
+    return passed;
+}
+
+/* The lowest solution of every search kernel against trying each nonce through the streaming API */
+static bool search_known_answer_test(const char *backend)
+{
+    static const struct
+    {
+        size_t tail_length;
+        size_t nonce_offset;
+        size_t nonce_size;
+        unsigned long long first_nonce;
+    } JOBS[] = {
+        {16, 12, 4, 0},         /* the 80-byte header */
+        {12, 0, 8, 1000},       /* nonce in the first schedule word */
+        {55, 47, 8, 5},         /* longest tail, nonce in the last words */
+        {40, 13, 8, 250},       /* unaligned, spanning three words */
+        {20, 2, 4, 0xfffff0},   /* carries across bytes and lanes */
+        {8, 0, 8, 0xfffffffffff0ULL},
+    };
+    bool passed = true;
+
+    for (size_t i = 0; i < sizeof(JOBS) / sizeof(JOBS[0]); i++)
+    {
+        struct sha256_search_job job;
+        unsigned char message[64 + 55];
+        unsigned char digest[32];
+        unsigned long long expected = 0;
+        bool found = false;
+
+        memset(&job, 0, sizeof(job));
+        sha256_midstate(job.midstate, buffer);
+        job.prefix_length = 64;
+        job.tail = buffer + 64;
+        job.tail_length = JOBS[i].tail_length;
+        job.nonce_offset = JOBS[i].nonce_offset;
+        job.nonce_size = JOBS[i].nonce_size;
+        job.target[1] = 0x10;
+
+        memcpy(message, buffer, 64 + job.tail_length);
+        for (unsigned long long nonce = JOBS[i].first_nonce; !found && nonce < JOBS[i].first_nonce + 50000; nonce++)
+        {
+            for (size_t k = 0; k < job.nonce_size; k++)
+            {
+                message[64 + job.nonce_offset + k] = (unsigned char)(nonce >> (8 * k));
+            }
+            hash_stream(message, 64 + job.tail_length, digest);
+            found = memcmp(digest, job.target, 32) < 0;
+            expected = nonce;
+        }
+
+        for (unsigned int threads = 1; threads <= 3; threads += 2)
+        {
+            struct sha256_search_options options = {threads, backend};
+            struct sha256_search_result result;
+
+            if (!sha256_search(&job, JOBS[i].first_nonce, 50000, &options, &result) || result.found != found ||
+                (found && (result.nonce != expected || !check(backend, "sha256_search", 64 + job.tail_length, result.digest, digest))))
+            {
+                fprintf(stderr, "sha256_bench: %s: sha256_search of job %zu misses nonce %llu\n", backend, i, expected);
+                passed = false;
+            }
+        }
+    }
+    return passed;
+}
+
+#if SHA256_INSTRUMENTATION
+/* The counters of an instrumented build against what one known sequence of calls must add: a buffered
+ * update, one that spans a block boundary and ends mid-block, and a completion into a second block */
+static bool instrumentation_test()
+{
+    struct sha256_instrumentation before, after;
+    unsigned long long blocks = 0;
+    unsigned char digest[32];
+    struct SHA256 context;
+
+    sha256_instrumentation_snapshot(&before);
+    sha256_init(&context);
+    sha256_update(&context, buffer, 10);
+    sha256_update(&context, buffer + 10, 1000 * 64 + 50);
+    sha256_complete(digest, &context);
+    sha256_instrumentation_snapshot(&after);
+
+    for (size_t i = 0; i < SHA256_INSTRUMENTED_BACKENDS; i++)
+    {
+        blocks += after.blocks[i] - before.blocks[i];
+    }
+    /* 64060 bytes are 1000 blocks and 60 left over, which need a second final block for the length */
+    if (!after.enabled || after.update_calls - before.update_calls != 2 || after.update_bytes - before.update_bytes != 1000 * 64 + 60 ||
+        after.buffered_updates - before.buffered_updates != 1 || after.complete_calls - before.complete_calls != 1 ||
+        after.complete_two_blocks - before.complete_two_blocks != 1 || blocks != 1002)
+    {
+        fprintf(stderr, "sha256_bench: instrumentation counts %llu updates of %llu bytes and %llu blocks for 2 updates of %d bytes and 1002 blocks\n",
+                after.update_calls - before.update_calls, after.update_bytes - before.update_bytes, blocks, 1000 * 64 + 60);
+        return false;
+    }
+    return true;
+}
+#endif
+
+/* Checks that touch the filesystem work in a directory of their own under TMPDIR */
+static char scratch[1024];
+
+static bool make_scratch()
+{
+    const char *directory = getenv("TMPDIR");
+
+    snprintf(scratch, sizeof(scratch), "%s/sha256_bench.XXXXXX", directory != NULL && directory[0] != '\0' ? directory : "/tmp");
+    if (mkdtemp(scratch) == NULL)
+    {
+        fprintf(stderr, "sha256_bench: cannot create a scratch directory in %s: %s\n", directory != NULL ? directory : "/tmp", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static void scratch_path(char path[2048], const char *name)
+{
+    snprintf(path, 2048, "%s/%s", scratch, name);
+}
+
+/* A key as sha256_cache_key makes it, for a file last written long enough ago to be trusted */
+static void cache_test_key(struct sha256_cache_key *key, unsigned long long inode, unsigned long long size, long long mtime)
+{
+    struct stat status;
+
+    memset(&status, 0, sizeof(status));
+    status.st_dev = 42;
+    status.st_ino = inode;
+    status.st_size = size;
+    status.st_mtim.tv_sec = mtime;
+    status.st_ctim.tv_sec = mtime + 1;
+    sha256_cache_key(key, &status);
+}
+
+/* Inserts, hits, replacement, keys that stop matching when the file changes, entries that survive
+ * compaction and reopening, and a header whose size wraps around */
+static bool cache_known_answer_test()
+{
+    struct sha256_cache *cache;
+    struct sha256_cache_key key, changed;
+    unsigned char digest[32], expected[32];
+    char path[2048];
+    bool passed = true;
+
+    scratch_path(path, "cache");
+    if (!sha256_cache_open(&cache, path))
+    {
+        fprintf(stderr, "sha256_bench: sha256_cache_open fails: %s\n", strerror(errno));
+        return false;
+    }
+
+    cache_test_key(&key, 1, 1000, 1000000000);
+    hash_stream(buffer, 1000, expected);
+    if (sha256_cache_lookup(cache, &key, digest) || sha256_cache_insert(cache, &key, expected) != SHA256_CACHE_MISS ||
+        !sha256_cache_lookup(cache, &key, digest) || memcmp(digest, expected, 32) != 0 ||
+        sha256_cache_insert(cache, &key, expected) != SHA256_CACHE_HIT)
+    {
+        fprintf(stderr, "sha256_bench: sha256_cache does not return what was inserted\n");
+        passed = false;
+    }
+
+    hash_stream(buffer, 999, expected);
+    if (sha256_cache_insert(cache, &key, expected) != SHA256_CACHE_STALE || !sha256_cache_lookup(cache, &key, digest) ||
+        memcmp(digest, expected, 32) != 0)
+    {
+        fprintf(stderr, "sha256_bench: sha256_cache does not replace a stale digest\n");
+        passed = false;
+    }
+
+    cache_test_key(&changed, 1, 1001, 1000000000);
+    bool size_hit = sha256_cache_lookup(cache, &changed, digest);
+    cache_test_key(&changed, 1, 1000, 1000000002);
+    bool mtime_hit = sha256_cache_lookup(cache, &changed, digest);
+    cache_test_key(&changed, 1, 1000, time(NULL));
+    if (size_hit || mtime_hit || sha256_cache_insert(cache, &changed, expected) != SHA256_CACHE_OFF || errno != EAGAIN)
+    {
+        fprintf(stderr, "sha256_bench: sha256_cache keeps a key of a file that changed, or trusts fresh timestamps\n");
+        passed = false;
+    }
+
+    /* Two versions of every inode, then compaction keeps the newer one of each; past the first table
+     * in size so the compacted one grows */
+    for (unsigned long long inode = 2; inode < 2 + 40000; inode++)
+    {
+        cache_test_key(&key, inode, inode, 1000000000);
+        sha256_cache_insert(cache, &key, buffer + inode % 4096);
+        cache_test_key(&key, inode, inode, 1000000010);
+        if (sha256_cache_insert(cache, &key, buffer + inode % 4096 + 1) != SHA256_CACHE_MISS)
+        {
+            fprintf(stderr, "sha256_bench: sha256_cache_insert fails at entry %llu\n", inode);
+            passed = false;
+            break;
+        }
+    }
+    if (!sha256_cache_compact(cache))
+    {
+        fprintf(stderr, "sha256_bench: sha256_cache_compact fails: %s\n", strerror(errno));
+        passed = false;
+    }
+    for (int reopened = 0; reopened <= 1; reopened++)
+    {
+        for (unsigned long long inode = 2; inode < 2 + 40000; inode++)
+        {
+            cache_test_key(&key, inode, inode, 1000000000);
+            cache_test_key(&changed, inode, inode, 1000000010);
+            if (sha256_cache_lookup(cache, &key, digest) || !sha256_cache_lookup(cache, &changed, digest) ||
+                memcmp(digest, buffer + inode % 4096 + 1, 32) != 0)
+            {
+                fprintf(stderr, "sha256_bench: sha256_cache loses entry %llu in compaction\n", inode);
+                passed = false;
+                break;
+            }
+        }
+        sha256_cache_close(cache);
+        if (reopened == 0 && !sha256_cache_open(&cache, path))
+        {
+            fprintf(stderr, "sha256_bench: sha256_cache_open fails on a compacted cache: %s\n", strerror(errno));
+            passed = false;
+            break;
+        }
+    }
+    unlink(path);
+
+    /* 2^61 slots of 88 bytes wrap to nothing, so the header alone would claim the right size */
+    struct
+    {
+        char magic[4];
+        unsigned int version;
+        unsigned long long capacity;
+        unsigned char rest[48];
+    } header = {{'S', '2', 'D', 'C'}, 1, 1ULL << 61, {0}};
+    FILE *file = fopen(path, "wb");
+    if (file != NULL)
+    {
+        fwrite(&header, sizeof(header), 1, file);
+        fclose(file);
+    }
+    if (sha256_cache_open(&cache, path))
+    {
+        fprintf(stderr, "sha256_bench: sha256_cache_open accepts a capacity of 2^61 slots\n");
+        sha256_cache_close(cache);
+        passed = false;
+    }
+    unlink(path);
+    return passed;
+}
+
+static void truncate_file(const struct SHA256 *context, void *argument)
+{
+    (void)context;
+    if (truncate(argument, 3 * 8192) != 0)
+    {
+        fprintf(stderr, "sha256_bench: cannot truncate %s: %s\n", (const char *)argument, strerror(errno));
+    }
+}
+
+/* sha256_file in every mode, with the default buffers and with ones small enough that the reader thread
+ * runs, against sha256_update over the same bytes; sizes straddle blocks, pages and buffers */
+static bool file_known_answer_test()
+{
+    static const size_t LENGTHS[] = {0, 1, 63, 64, 65, 4095, 4096, 4097, 8191, 8192, 8193, 3 * 8192 + 100, 10 * 8192, 1 * MiB + 17};
+    static const size_t BUFFERS[][2] = {{0, 0}, {8192, 2}, {8192, 3}};
+    static const char *const MODES[] = {"buffered", "direct", "mmap"};
+    unsigned char digest[32], expected[32];
+    char path[2048];
+    bool passed = true;
+
+    scratch_path(path, "file");
+    for (size_t i = 0; i < sizeof(LENGTHS) / sizeof(LENGTHS[0]); i++)
+    {
+        FILE *file = fopen(path, "wb");
+        if (file == NULL || fwrite(buffer, 1, LENGTHS[i], file) != LENGTHS[i] || fclose(file) != 0)
+        {
+            fprintf(stderr, "sha256_bench: cannot write %s: %s\n", path, strerror(errno));
+            return false;
+        }
+        hash_stream(buffer, LENGTHS[i], expected);
+
+        for (int mode = SHA256_FILE_BUFFERED; mode <= SHA256_FILE_MMAP; mode++)
+        {
+            for (size_t j = 0; j < sizeof(BUFFERS) / sizeof(BUFFERS[0]); j++)
+            {
+                struct sha256_file_options options = {(enum sha256_file_mode)mode, BUFFERS[j][0], (unsigned int)BUFFERS[j][1], false, 0, NULL, NULL};
+                struct sha256_file_stats stats;
+                struct SHA256 context;
+                size_t resume = LENGTHS[i] / 2 + 1;
+
+                if (!sha256_file(digest, path, &options, &stats) || memcmp(digest, expected, 32) != 0 || stats.bytes != LENGTHS[i])
+                {
+                    fprintf(stderr, "sha256_bench: sha256_file in %s mode with %zu-byte buffers differs at %zu bytes\n", MODES[mode], BUFFERS[j][0], LENGTHS[i]);
+                    passed = false;
+                }
+
+                /* Resuming mid-page, where O_DIRECT has to give way */
+                sha256_init(&context);
+                sha256_update(&context, buffer, resume <= LENGTHS[i] ? resume : 0);
+                if (!sha256_file_resume(digest, path, &context, &options, NULL) || memcmp(digest, expected, 32) != 0)
+                {
+                    fprintf(stderr, "sha256_bench: sha256_file_resume in %s mode with %zu-byte buffers differs at %zu bytes\n", MODES[mode], BUFFERS[j][0], LENGTHS[i]);
+                    passed = false;
+                }
+            }
+        }
+    }
+
+    /* A mapped file that shrinks after the first chunk is hashed to its new end instead of faulting */
+    struct sha256_file_options options = {SHA256_FILE_MMAP, 8192, 0, false, 8192, truncate_file, path};
+    hash_stream(buffer, 3 * 8192, expected);
+    if (!sha256_file(digest, path, &options, NULL) || memcmp(digest, expected, 32) != 0)
+    {
+        fprintf(stderr, "sha256_bench: sha256_file in mmap mode does not stop where the file was truncated\n");
+        passed = false;
+    }
+
+    /* Resuming past the end of the now shorter file would finish a digest of bytes it no longer holds */
+    struct SHA256 context;
+    sha256_init(&context);
+    sha256_update(&context, buffer, 10 * 8192);
+    if (sha256_file_resume(digest, path, &context, NULL, NULL) || errno != EINVAL)
+    {
+        fprintf(stderr, "sha256_bench: sha256_file_resume accepts a file shorter than the context\n");
+        passed = false;
+    }
+    unlink(path);
+    return passed;
+}
+
+/* Files of the tree check, relative to its root, and the offset in buffer their contents start at.
+ * Sizes run from empty over the batching limit to several read buffers, and deeper/ holds enough small
+ * files for several batches. */
+#define TREE_SMALL_FILES 150
+
+struct tree_file
+{
+    char name[64];
+    size_t length;
+    size_t offset;
+};
+
+static int compare_tree_files(const void *a, const void *b)
+{
+    return strcmp(((const struct tree_file *)a)->name, ((const struct tree_file *)b)->name);
+}
+
+static int remove_path(const char *path, const struct stat *status, int type, struct FTW *ftw)
+{
+    (void)status;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+static bool check_tree(const char *root, const struct tree_file *files, size_t count, const struct sha256_tree_options *options,
+                       enum sha256_cache_status expected_cache, const char *what)
+{
+    struct sha256_tree_entry *entries;
+    size_t entry_count;
+    unsigned char expected[32];
+    char path[4096];
+    bool passed = true;
+
+    if (!sha256_tree(&root, 1, options, &entries, &entry_count))
+    {
+        fprintf(stderr, "sha256_bench: sha256_tree fails: %s\n", strerror(errno));
+        return false;
+    }
+    if (entry_count != count)
+    {
+        fprintf(stderr, "sha256_bench: sha256_tree %s finds %zu files of %zu\n", what, entry_count, count);
+        passed = false;
+    }
+    for (size_t i = 0; i < entry_count && i < count; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%.63s", root, files[i].name);
+        hash_stream(buffer + files[i].offset, files[i].length, expected);
+        if (strcmp(entries[i].path, path) != 0 || entries[i].error != 0 || entries[i].size != files[i].length ||
+            memcmp(entries[i].digest, expected, 32) != 0 || entries[i].cache != expected_cache)
+        {
+            fprintf(stderr, "sha256_bench: sha256_tree %s gives %s (error %d, cache %d) where %s was expected\n", what, entries[i].path,
+                    entries[i].error, (int)entries[i].cache, path);
+            passed = false;
+            break;
+        }
+    }
+    sha256_tree_free(entries, entry_count);
+    return passed;
+}
+
+/* sha256_tree on 4 workers over a scratch tree, sorted and against sha256_update; then through a cache
+ * once the files are old enough to be recorded: all misses, all hits, and all verified */
+static bool tree_known_answer_test()
+{
+    static const size_t LARGE[] = {0, 1, 100, 64 * KiB, 64 * KiB + 1, 3 * MiB + 5};
+    static struct tree_file files[TREE_SMALL_FILES + 8];
+    struct sha256_tree_options options = {4, 0, {SHA256_FILE_BUFFERED, 0, 0, false, 0, NULL, NULL}, NULL, 0};
+    char root[2048], path[4096];
+    size_t count = 0, offset = 0;
+    bool passed = true;
+
+    scratch_path(root, "tree");
+    snprintf(path, sizeof(path), "%s/sub", root);
+    mkdir(root, 0755);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/sub/deeper", root);
+    mkdir(path, 0755);
+
+    for (size_t i = 0; i < sizeof(LARGE) / sizeof(LARGE[0]); i++)
+    {
+        snprintf(files[count].name, sizeof(files[count].name), i < 3 ? "top%zu" : "sub/file%zu", i);
+        files[count].length = LARGE[i];
+        files[count++].offset = offset++;
+    }
+    for (size_t i = 0; i < TREE_SMALL_FILES; i++)
+    {
+        snprintf(files[count].name, sizeof(files[count].name), "sub/deeper/small%03zu", i);
+        files[count].length = i * 37 % 3000;
+        files[count++].offset = offset++;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%.63s", root, files[i].name);
+        FILE *file = fopen(path, "wb");
+        if (file == NULL || fwrite(buffer + files[i].offset, 1, files[i].length, file) != files[i].length || fclose(file) != 0)
+        {
+            fprintf(stderr, "sha256_bench: cannot write %s: %s\n", path, strerror(errno));
+            nftw(root, remove_path, 16, FTW_DEPTH | FTW_PHYS);
+            return false;
+        }
+    }
+
+    /* A link to a file is hashed under its own name, one to a directory is not followed */
+    snprintf(path, sizeof(path), "%s/link", root);
+    passed &= symlink("top1", path) == 0;
+    snprintf(files[count].name, sizeof(files[count].name), "link");
+    files[count].length = files[1].length;
+    files[count++].offset = files[1].offset;
+    snprintf(path, sizeof(path), "%s/sub/loop", root);
+    passed &= symlink("..", path) == 0;
+    qsort(files, count, sizeof(files[0]), compare_tree_files);
+    time_t written = time(NULL);
+
+    passed &= check_tree(root, files, count, &options, SHA256_CACHE_OFF, "without a cache");
+
+    /* The cache refuses timestamps from the last 2 seconds */
+    struct sha256_cache *cache;
+    scratch_path(path, "tree.cache");
+    while (time(NULL) < written + 3)
+    {
+        sleep(1);
+    }
+    if (!sha256_cache_open(&cache, path))
+    {
+        fprintf(stderr, "sha256_bench: sha256_cache_open fails: %s\n", strerror(errno));
+        passed = false;
+    }
+    else
+    {
+        options.cache = cache;
+        passed &= check_tree(root, files, count, &options, SHA256_CACHE_MISS, "on a cold cache");
+        passed &= check_tree(root, files, count, &options, SHA256_CACHE_HIT, "on a warm cache");
+        options.verify_one_in = 1;
+        passed &= check_tree(root, files, count, &options, SHA256_CACHE_VERIFIED, "verifying every hit");
+        sha256_cache_close(cache);
+        unlink(path);
+    }
+
+    nftw(root, remove_path, 16, FTW_DEPTH | FTW_PHYS);
+    return passed;
+}
+
+static unsigned long long parse_size(const char *text)
+{
+    char *end;
+    unsigned long long size = strtoull(text, &end, 10);
+
+    switch (*end)
+    {
+    case 'k':
+    case 'K':
+        return size * KiB;
+    case 'm':
+    case 'M':
+        return size * MiB;
+    case 'g':
+    case 'G':
+        return size * GiB;
+    default:
+        return size;
+    }
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: sha256_bench [--json] [--quick] [--backend NAME] [--max-size BYTES[K|M|G]]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    struct options options = {false, false, NULL, 1 * GiB};
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--json") == 0)
+        {
+            options.json = true;
+        }
+        else if (strcmp(argv[i], "--quick") == 0)
+        {
+            options.quick = true;
+            options.max_size = 1 * MiB;
+        }
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+        {
+            options.backend = argv[++i];
+        }
+        else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc)
+        {
+            options.max_size = parse_size(argv[++i]);
+        }
+        else
+        {
+            usage();
+        }
+    }
+
+    buffer_size = options.max_size;
+    if (buffer_size < BATCH_MESSAGES * BATCH_SIZES[sizeof(BATCH_SIZES) / sizeof(BATCH_SIZES[0]) - 1])
+    {
+        buffer_size = BATCH_MESSAGES * BATCH_SIZES[sizeof(BATCH_SIZES) / sizeof(BATCH_SIZES[0]) - 1];
+    }
+    size_t copy_size = ((buffer_size < COPY_LIMIT ? buffer_size : COPY_LIMIT) + 4095) / 4096 * 4096;
+    buffer = malloc(buffer_size);
+    copy_buffer = aligned_alloc(4096, copy_size);
+    if (buffer == NULL || copy_buffer == NULL)
+    {
+        fprintf(stderr, "sha256_bench: cannot allocate %zu bytes\n", buffer_size);
+        return 1;
+    }
+    for (size_t i = 0; i < buffer_size; i++)
+    {
+        buffer[i] = (unsigned char)(i * 131 + 7);
+    }
+
+    /* No number is reported unless every backend agrees with the known answers; scalar goes first as the reference */
+    bool passed = true;
+    const char *name;
+    if (sha256_set_backend("scalar"))
+    {
+        passed &= known_answer_test("scalar");
+    }
+    for (size_t i = 0; (name = sha256_supported_backend(i)) != NULL; i++)
+    {
+        if (strcmp(name, "scalar") != 0)
+        {
+            sha256_set_backend(name);
+            passed &= known_answer_test(name);
+        }
+    }
+    sha256_set_backend(sha256_supported_backend(0));
+    for (size_t i = 0; (name = sha256_supported_batch_backend(i)) != NULL; i++)
+    {
+        sha256_set_batch_backend(name);
+        passed &= batch_known_answer_test(name);
+    }
+    for (size_t i = 0; (name = sha256_supported_search_backend(i)) != NULL; i++)
+    {
+        passed &= search_known_answer_test(name);
+    }
+#if SHA256_INSTRUMENTATION
+    passed &= instrumentation_test();
+#endif
+    if (make_scratch())
+    {
+        passed &= cache_known_answer_test();
+        passed &= file_known_answer_test();
+        passed &= tree_known_answer_test();
+        rmdir(scratch);
+    }
+    else
+    {
+        passed = false;
+    }
+    if (!passed)
+    {
+        fprintf(stderr, "sha256_bench: known answer test failed, not benchmarking\n");
+        return 1;
+    }
+
+    calibrate_timer();
+
+    if (options.json)
+    {
+        printf("{\n  \"tsc_hz\": %.0f,\n  \"timer_overhead_cycles\": %llu,\n  \"results\": [", tsc_hz, timer_overhead);
+    }
+    else
+    {
+        printf("known answers pass, tsc %.2f GHz, cycles are reference cycles\n", tsc_hz / 1e9);
+        printf("%-9s %-11s %-5s %11s %7s %8s %8s %11s %11s %11s\n", "backend", "mode", "cache", "size", "iters", "GB/s",
+               "cyc/B", "p50", "p90", "p99");
+    }
+
+    for (size_t i = 0; (name = sha256_supported_backend(i)) != NULL; i++)
+    {
+        if (selected(&options, name))
+        {
+            bench_backend(&options, name);
+        }
+    }
+
+    sha256_set_backend(sha256_supported_backend(0));
+    for (size_t i = 0; (name = sha256_supported_batch_backend(i)) != NULL; i++)
+    {
+        if (selected(&options, name))
+        {
+            bench_batch_backend(&options, name);
+        }
+    }
+
+    /* Search rates are hashes, not bytes, so they get their own table */
+    if (options.json)
+    {
+        printf("\n  ],\n  \"search\": [");
+    }
+    else
+    {
+        printf("\n%-9s %7s %12s %10s %14s\n", "search", "threads", "hashes", "MH/s", "MH/s per core");
+    }
+    first_result = true;
+    for (size_t i = 0; (name = sha256_supported_search_backend(i)) != NULL; i++)
+    {
+        if (selected(&options, name))
+        {
+            bench_search_backend(&options, name, 1);
+        }
+    }
+    if (options.backend == NULL)
+    {
+        bench_search_backend(&options, NULL, 0);
+    }
+
+    /* Chunking needs content that is not periodic, so it runs on the copy buffer filled with noise */
+    if (options.json)
+    {
+        printf("\n  ],\n  \"chunking\": [");
+    }
+    else
+    {
+        printf("\n%11s %9s %12s %12s\n", "chunking", "chunks", "1-pass GB/s", "2-pass GB/s");
+    }
+    first_result = true;
+    if (options.backend == NULL)
+    {
+        unsigned long long noise = 1;
+        for (size_t i = 0; i < copy_size; i++)
+        {
+            noise ^= noise << 13;
+            noise ^= noise >> 7;
+            noise ^= noise << 17;
+            copy_buffer[i] = (unsigned char)(noise >> 32);
+        }
+        for (size_t length = CDC_UPDATE; length <= copy_size; length *= 4)
+        {
+            bench_chunking(&options, length);
+        }
+    }
+
+    if (options.json)
+    {
+        printf("\n  ]\n}\n");
+    }
+
+    free(copy_buffer);
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,324 @@
+#include <string.h>
+
+#include "hmac_sha256.h"
+#include "sha256_internal.h"
+
+/* Padding after a 32-byte digest that follows one already absorbed 64-byte pad block: 0x80, zeros, 768 bits */
+static const unsigned char DIGEST_PADDING[32] = {
+    0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x03, 0x00,
+};
+
+/* The same block as words: the digest goes in words[0..7] */
+#define DIGEST_WORDS {0, 0, 0, 0, 0, 0, 0, 0, 0x80000000, 0, 0, 0, 0, 0, 0, 768}
+
+static void secure_zero(void *data, size_t length)
+{
+    volatile unsigned char *bytes = (volatile unsigned char *)data;
+    while (length-- > 0)
+    {
+        *bytes++ = 0;
+    }
+}
+
+void hmac_sha256_key_init(struct HMAC_SHA256_KEY *key, const unsigned char *secret, size_t length)
+{
+    unsigned char block[64] = {0};
+
+    if (length > 64)
+    {
+        struct SHA256 context;
+        sha256_init(&context);
+        sha256_update(&context, secret, length);
+        sha256_complete(block, &context);
+    }
+    else
+    {
+        memcpy(block, secret, length);
+    }
+
+    for (int i = 0; i < 64; i++)
+    {
+        block[i] ^= 0x36;
+    }
+    memcpy(key->inner, INITIAL_STATE, sizeof(key->inner));
+    sha256_process_blocks(key->inner, block, 1);
+
+    for (int i = 0; i < 64; i++)
+    {
+        block[i] ^= 0x36 ^ 0x5c;
+    }
+    memcpy(key->outer, INITIAL_STATE, sizeof(key->outer));
+    sha256_process_blocks(key->outer, block, 1);
+
+    secure_zero(block, sizeof(block));
+}
+
+void hmac_sha256_key_clear(struct HMAC_SHA256_KEY *key)
+{
+    secure_zero(key, sizeof(*key));
+}
+
+void hmac_sha256_init(struct HMAC_SHA256 *context, const struct HMAC_SHA256_KEY *key)
+{
+    context->key = key;
+    context->inner.length = 64;
+    context->inner.buffer_length = 0;
+    memcpy(context->inner.state, key->inner, sizeof(context->inner.state));
+}
+
+void hmac_sha256_update(struct HMAC_SHA256 *context, const unsigned char *input, size_t length)
+{
+    sha256_update(&context->inner, input, length);
+}
+
+/* The outer hash is always exactly one block: the inner digest plus constant padding */
+static void complete_outer(unsigned char mac[32], const struct HMAC_SHA256_KEY *key, const unsigned char inner_digest[32])
+{
+    unsigned int words[16] = DIGEST_WORDS;
+    unsigned int state[8];
+
+    for (int i = 0; i < 8; i++)
+    {
+        words[i] = load_be32(inner_digest + 4 * i);
+    }
+    memcpy(state, key->outer, sizeof(state));
+    sha256_process_words(state, words);
+    store_digest(mac, state);
+    secure_zero(words, sizeof(words));
+}
+
+void hmac_sha256_complete(unsigned char mac[32], struct HMAC_SHA256 *context)
+{
+    unsigned char inner_digest[32];
+
+    sha256_complete(inner_digest, &context->inner);
+    complete_outer(mac, context->key, inner_digest);
+    secure_zero(inner_digest, sizeof(inner_digest));
+    secure_zero(&context->inner, sizeof(context->inner));
+}
+
+void hmac_sha256(unsigned char mac[32], const struct HMAC_SHA256_KEY *key, const unsigned char *input, size_t length)
+{
+    struct HMAC_SHA256 context;
+
+    hmac_sha256_init(&context, key);
+    hmac_sha256_update(&context, input, length);
+    hmac_sha256_complete(mac, &context);
+}
+
+/* U_1 = HMAC(P, S || INT(index)) */
+static void pbkdf2_first(unsigned char u[32], const struct HMAC_SHA256_KEY *key, const unsigned char *salt, size_t salt_length, unsigned int index)
+{
+    struct HMAC_SHA256 context;
+    unsigned char counter[4] = {(unsigned char)(index >> 24), (unsigned char)(index >> 16), (unsigned char)(index >> 8), (unsigned char)index};
+
+    hmac_sha256_init(&context, key);
+    hmac_sha256_update(&context, salt, salt_length);
+    hmac_sha256_update(&context, counter, 4);
+    hmac_sha256_complete(u, &context);
+}
+
+/* One output block: every further U is a 32-byte message, so each link of the chain is one inner
+ * and one outer compression over the cached midstates with constant padding. U stays in words from
+ * one compression to the next and only the final T is stored as bytes. */
+static void pbkdf2_block(unsigned char t[32], const struct HMAC_SHA256_KEY *key, const unsigned char *salt, size_t salt_length,
+                         unsigned long iterations, unsigned int index)
+{
+    unsigned int words[16] = DIGEST_WORDS;
+    unsigned int state[8];
+    unsigned int sum[8];
+    unsigned char u[32];
+
+    pbkdf2_first(u, key, salt, salt_length, index);
+    for (int j = 0; j < 8; j++)
+    {
+        words[j] = load_be32(u + 4 * j);
+        sum[j] = words[j];
+    }
+
+    for (unsigned long i = 1; i < iterations; i++)
+    {
+        memcpy(state, key->inner, sizeof(state));
+        sha256_process_words(state, words);
+        memcpy(words, state, sizeof(state));
+
+        memcpy(state, key->outer, sizeof(state));
+        sha256_process_words(state, words);
+        memcpy(words, state, sizeof(state));
+
+        for (int j = 0; j < 8; j++)
+        {
+            sum[j] ^= state[j];
+        }
+    }
+    store_digest(t, sum);
+
+    secure_zero(u, sizeof(u));
+    secure_zero(words, sizeof(words));
+    secure_zero(state, sizeof(state));
+    secure_zero(sum, sizeof(sum));
+}
+
+/* Independent output blocks run their chains side by side, one per lane of the batch kernel */
+static void pbkdf2_blocks_many(unsigned char (*t)[32], size_t used, const struct sha256_batch_backend *batch, const struct HMAC_SHA256_KEY *key,
+                               const unsigned char *salt, size_t salt_length, unsigned long iterations, unsigned int first_index)
+{
+    ALIGNED(64) unsigned char blocks[SHA256_MAX_LANES][64];
+    const unsigned char *data[SHA256_MAX_LANES];
+    struct sha256_lanes lanes;
+    unsigned int state[8];
+
+    for (size_t lane = 0; lane < batch->lanes; lane++)
+    {
+        size_t source = lane < used ? lane : used - 1;
+        if (lane < used)
+        {
+            pbkdf2_first(blocks[lane], key, salt, salt_length, first_index + (unsigned int)lane);
+            memcpy(t[lane], blocks[lane], 32);
+            memcpy(blocks[lane] + 32, DIGEST_PADDING, 32);
+        }
+        data[lane] = blocks[source];
+    }
+
+    for (unsigned long i = 1; i < iterations; i++)
+    {
+        for (int pass = 0; pass < 2; pass++)
+        {
+            const unsigned int *midstate = pass == 0 ? key->inner : key->outer;
+
+            for (size_t lane = 0; lane < batch->lanes; lane++)
+            {
+                for (int w = 0; w < 8; w++)
+                {
+                    lanes.state[w][lane] = midstate[w];
+                }
+            }
+
+            batch->process_blocks_many(&lanes, data, 1);
+
+            for (size_t lane = 0; lane < used; lane++)
+            {
+                for (int w = 0; w < 8; w++)
+                {
+                    state[w] = lanes.state[w][lane];
+                }
+                store_digest(blocks[lane], state);
+            }
+        }
+
+        for (size_t lane = 0; lane < used; lane++)
+        {
+            for (int j = 0; j < 32; j++)
+            {
+                t[lane][j] ^= blocks[lane][j];
+            }
+        }
+    }
+
+    secure_zero(blocks, sizeof(blocks));
+    secure_zero(&lanes, sizeof(lanes));
+    secure_zero(state, sizeof(state));
+}
+
+void pbkdf2_hmac_sha256(unsigned char *output, size_t output_length, const unsigned char *password, size_t password_length,
+                        const unsigned char *salt, size_t salt_length, unsigned long iterations)
+{
+    const struct sha256_batch_backend *batch = sha256_batch_dispatch();
+    struct HMAC_SHA256_KEY key;
+    unsigned char t[SHA256_MAX_LANES][32];
+    size_t blocks = (output_length + 31) / 32;
+    size_t done = 0;
+
+    hmac_sha256_key_init(&key, password, password_length);
+
+    while (done < blocks)
+    {
+        size_t used = blocks - done < batch->lanes ? blocks - done : batch->lanes;
+        size_t bytes;
+
+        /* Same rule as sha256_hash_many: a mostly empty vector loses to the single-stream kernel */
+        if (used * 2 < batch->lanes || used == 1)
+        {
+            used = 1;
+            pbkdf2_block(t[0], &key, salt, salt_length, iterations, (unsigned int)done + 1);
+        }
+        else
+        {
+            pbkdf2_blocks_many(t, used, batch, &key, salt, salt_length, iterations, (unsigned int)done + 1);
+        }
+
+        bytes = output_length - done * 32 < used * 32 ? output_length - done * 32 : used * 32;
+        memcpy(output + done * 32, t, bytes);
+        done += used;
+    }
+
+    secure_zero(t, sizeof(t));
+    hmac_sha256_key_clear(&key);
+}
+
+void hkdf_sha256_extract(unsigned char prk[32], const unsigned char *salt, size_t salt_length, const unsigned char *ikm, size_t ikm_length)
+{
+    static const unsigned char ZERO_SALT[32] = {0};
+    struct HMAC_SHA256_KEY key;
+
+    if (salt == NULL || salt_length == 0)
+    {
+        salt = ZERO_SALT;
+        salt_length = sizeof(ZERO_SALT);
+    }
+
+    hmac_sha256_key_init(&key, salt, salt_length);
+    hmac_sha256(prk, &key, ikm, ikm_length);
+    hmac_sha256_key_clear(&key);
+}
+
+bool hkdf_sha256_expand(unsigned char *output, size_t output_length, const unsigned char prk[32], const unsigned char *info, size_t info_length)
+{
+    struct HMAC_SHA256_KEY key;
+    unsigned char t[32];
+    size_t done = 0;
+
+    if (output_length > 255 * 32)
+    {
+        return false;
+    }
+
+    hmac_sha256_key_init(&key, prk, 32);
+
+    for (unsigned char counter = 1; done < output_length; counter++)
+    {
+        struct HMAC_SHA256 context;
+        size_t bytes = output_length - done < 32 ? output_length - done : 32;
+
+        hmac_sha256_init(&context, &key);
+        if (counter > 1)
+        {
+            hmac_sha256_update(&context, t, 32);
+        }
+        if (info_length != 0)
+        {
+            hmac_sha256_update(&context, info, info_length);
+        }
+        hmac_sha256_update(&context, &counter, 1);
+        hmac_sha256_complete(t, &context);
+
+        memcpy(output + done, t, bytes);
+        done += bytes;
+    }
+
+    secure_zero(t, sizeof(t));
+    hmac_sha256_key_clear(&key);
+    return true;
+}
+
+bool hkdf_sha256(unsigned char *output, size_t output_length, const unsigned char *salt, size_t salt_length,
+                 const unsigned char *ikm, size_t ikm_length, const unsigned char *info, size_t info_length)
+{
+    unsigned char prk[32];
+    bool result;
+
+    hkdf_sha256_extract(prk, salt, salt_length, ikm, ikm_length);
+    result = hkdf_sha256_expand(output, output_length, prk, info, info_length);
+    secure_zero(prk, sizeof(prk));
+    return result;
+}
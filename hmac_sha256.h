@@ -0,0 +1,52 @@
+#ifndef HMAC_SHA256_H
+#define HMAC_SHA256_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sha256.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A prepared key: the SHA-256 state after absorbing the ipad and opad blocks */
+struct HMAC_SHA256_KEY
+{
+    unsigned int inner[8];
+    unsigned int outer[8];
+};
+
+struct HMAC_SHA256
+{
+    struct SHA256 inner;
+    const struct HMAC_SHA256_KEY *key;
+};
+
+void hmac_sha256_key_init(struct HMAC_SHA256_KEY *key, const unsigned char *secret, size_t length);
+void hmac_sha256_key_clear(struct HMAC_SHA256_KEY *key);
+
+/* The key must outlive the context */
+void hmac_sha256_init(struct HMAC_SHA256 *context, const struct HMAC_SHA256_KEY *key);
+void hmac_sha256_update(struct HMAC_SHA256 *context, const unsigned char *input, size_t length);
+/* Wipes the inner state, so the context needs hmac_sha256_init again before another message */
+void hmac_sha256_complete(unsigned char mac[32], struct HMAC_SHA256 *context);
+
+void hmac_sha256(unsigned char mac[32], const struct HMAC_SHA256_KEY *key, const unsigned char *input, size_t length);
+
+void pbkdf2_hmac_sha256(unsigned char *output, size_t output_length, const unsigned char *password, size_t password_length,
+                        const unsigned char *salt, size_t salt_length, unsigned long iterations);
+
+void hkdf_sha256_extract(unsigned char prk[32], const unsigned char *salt, size_t salt_length, const unsigned char *ikm, size_t ikm_length);
+
+/* Fails when output_length is above 255 * 32 bytes */
+bool hkdf_sha256_expand(unsigned char *output, size_t output_length, const unsigned char prk[32], const unsigned char *info, size_t info_length);
+
+bool hkdf_sha256(unsigned char *output, size_t output_length, const unsigned char *salt, size_t salt_length,
+                 const unsigned char *ikm, size_t ikm_length, const unsigned char *info, size_t info_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
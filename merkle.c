@@ -0,0 +1,339 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "merkle.h"
+#include "sha256.h"
+
+/* Levels narrower than this are hashed by the calling thread alone */
+#define PARALLEL_MIN_PAIRS 4096
+/* Pairs claimed at once by a pool thread, a multiple of every batch kernel width */
+#define CHUNK_PAIRS 1024
+
+static void hash_pair(unsigned char parent[32], const unsigned char left[32], const unsigned char right[32])
+{
+    unsigned char pair[64];
+
+    memcpy(pair, left, 32);
+    memcpy(pair + 32, right, 32);
+    sha256_64(parent, pair);
+}
+
+/* Threads that hash chunks of the current level; the builder thread works on the same level too */
+struct merkle_pool
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    pthread_t threads[64];
+    unsigned int thread_count;
+    unsigned long generation;
+    bool stop;
+
+    const unsigned char (*input)[64];
+    unsigned char (*output)[32];
+    size_t pairs;
+    size_t next;
+    unsigned int busy;
+};
+
+/* Called with the mutex held, returns with it held */
+static void pool_drain(struct merkle_pool *pool)
+{
+    while (pool->next < pool->pairs)
+    {
+        size_t first = pool->next;
+        size_t count = pool->pairs - first < CHUNK_PAIRS ? pool->pairs - first : CHUNK_PAIRS;
+
+        pool->next += count;
+        pthread_mutex_unlock(&pool->mutex);
+        sha256_64_many(pool->output + first, pool->input + first, count);
+        pthread_mutex_lock(&pool->mutex);
+    }
+}
+
+static void *pool_thread(void *argument)
+{
+    struct merkle_pool *pool = argument;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;)
+    {
+        while (!pool->stop && pool->generation == seen)
+        {
+            pthread_cond_wait(&pool->work, &pool->mutex);
+        }
+        if (pool->stop)
+        {
+            break;
+        }
+
+        seen = pool->generation;
+        pool->busy++;
+        pool_drain(pool);
+        if (--pool->busy == 0)
+        {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+static void pool_start(struct merkle_pool *pool, unsigned int threads)
+{
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    if (threads > sizeof(pool->threads) / sizeof(pool->threads[0]))
+    {
+        threads = sizeof(pool->threads) / sizeof(pool->threads[0]);
+    }
+
+    /* A thread that fails to start only costs parallelism */
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        if (pthread_create(&pool->threads[pool->thread_count], NULL, pool_thread, pool) == 0)
+        {
+            pool->thread_count++;
+        }
+    }
+}
+
+static void pool_hash_level(struct merkle_pool *pool, const unsigned char (*input)[64], unsigned char (*output)[32], size_t pairs)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->input = input;
+    pool->output = output;
+    pool->pairs = pairs;
+    pool->next = 0;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work);
+
+    pool_drain(pool);
+    while (pool->busy > 0)
+    {
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+static void pool_stop(struct merkle_pool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (unsigned int i = 0; i < pool->thread_count; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->mutex);
+}
+
+bool merkle_tree_build(struct merkle_tree *tree, const unsigned char (*leaves)[32], size_t count, unsigned int threads)
+{
+    struct merkle_pool pool;
+    bool parallel;
+    size_t total = 0;
+
+    memset(tree, 0, sizeof(*tree));
+    if (count == 0)
+    {
+        return false;
+    }
+
+    for (size_t width = count;; width = (width + 1) / 2)
+    {
+        tree->level_offset[tree->level_count++] = total;
+        total += width;
+        if (width == 1)
+        {
+            break;
+        }
+    }
+    tree->level_offset[tree->level_count] = total;
+
+    if (total > SIZE_MAX / 32)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+    tree->nodes = malloc(total * 32);
+    if (tree->nodes == NULL)
+    {
+        return false;
+    }
+    tree->leaf_count = count;
+    memcpy(tree->nodes, leaves, count * 32);
+
+    if (threads == 0)
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (unsigned int)online : 1;
+    }
+
+    parallel = threads > 1 && count / 2 >= PARALLEL_MIN_PAIRS;
+    if (parallel)
+    {
+        pool_start(&pool, threads - 1);
+    }
+
+    /* Pairs of adjacent 32-byte nodes are exactly the 64-byte inputs of the next level */
+    for (size_t level = 0; level + 1 < tree->level_count; level++)
+    {
+        size_t width = tree->level_offset[level + 1] - tree->level_offset[level];
+        size_t pairs = width / 2;
+        const unsigned char (*input)[64] = (const unsigned char (*)[64])tree->nodes[tree->level_offset[level]];
+        unsigned char (*output)[32] = &tree->nodes[tree->level_offset[level + 1]];
+
+        if (parallel && pairs >= PARALLEL_MIN_PAIRS)
+        {
+            pool_hash_level(&pool, input, output, pairs);
+        }
+        else
+        {
+            sha256_64_many(output, input, pairs);
+        }
+
+        if (width % 2 == 1)
+        {
+            memcpy(output[pairs], tree->nodes[tree->level_offset[level] + width - 1], 32);
+        }
+    }
+
+    if (parallel)
+    {
+        pool_stop(&pool);
+    }
+    return true;
+}
+
+void merkle_tree_free(struct merkle_tree *tree)
+{
+    free(tree->nodes);
+    memset(tree, 0, sizeof(*tree));
+}
+
+const unsigned char *merkle_tree_root(const struct merkle_tree *tree)
+{
+    return tree->nodes[tree->level_offset[tree->level_count - 1]];
+}
+
+size_t merkle_tree_proof(const struct merkle_tree *tree, size_t index, unsigned char (*proof)[32])
+{
+    size_t length = 0;
+
+    if (index >= tree->leaf_count)
+    {
+        return 0;
+    }
+    for (size_t level = 0; level + 1 < tree->level_count; level++)
+    {
+        size_t width = tree->level_offset[level + 1] - tree->level_offset[level];
+        size_t sibling = index ^ 1;
+
+        /* A promoted node has no sibling on this level */
+        if (sibling < width)
+        {
+            memcpy(proof[length++], tree->nodes[tree->level_offset[level] + sibling], 32);
+        }
+        index /= 2;
+    }
+    return length;
+}
+
+bool merkle_proof_verify(const unsigned char root[32], const unsigned char leaf[32], size_t index, size_t leaf_count,
+                         const unsigned char (*proof)[32], size_t proof_length)
+{
+    unsigned char hash[32];
+    size_t used = 0;
+
+    if (index >= leaf_count)
+    {
+        return false;
+    }
+
+    memcpy(hash, leaf, 32);
+    for (size_t width = leaf_count; width > 1; width = (width + 1) / 2, index /= 2)
+    {
+        if (index % 2 == 1 || index + 1 < width)
+        {
+            if (used == proof_length)
+            {
+                return false;
+            }
+            if (index % 2 == 1)
+            {
+                hash_pair(hash, proof[used], hash);
+            }
+            else
+            {
+                hash_pair(hash, hash, proof[used]);
+            }
+            used++;
+        }
+    }
+    return used == proof_length && memcmp(hash, root, 32) == 0;
+}
+
+void merkle_frontier_init(struct merkle_frontier *frontier)
+{
+    frontier->count = 0;
+}
+
+void merkle_frontier_append(struct merkle_frontier *frontier, const unsigned char leaf[32])
+{
+    unsigned char node[32];
+    int level = 0;
+
+    /* Like a binary increment: complete subtrees of equal size merge into one a level higher */
+    memcpy(node, leaf, 32);
+    while ((frontier->count >> level) & 1)
+    {
+        hash_pair(node, frontier->nodes[level], node);
+        level++;
+    }
+    memcpy(frontier->nodes[level], node, 32);
+    frontier->count++;
+}
+
+void merkle_frontier_root(unsigned char root[32], const struct merkle_frontier *frontier)
+{
+    bool empty = true;
+
+    if (frontier->count == 0)
+    {
+        struct SHA256 context;
+        sha256_init(&context);
+        sha256_complete(root, &context);
+        return;
+    }
+
+    /* Promoting odd nodes makes the right edge fold from the smallest subtree upwards */
+    for (int level = 0; level < MERKLE_MAX_DEPTH; level++)
+    {
+        if ((frontier->count >> level) & 1)
+        {
+            if (empty)
+            {
+                memcpy(root, frontier->nodes[level], 32);
+                empty = false;
+            }
+            else
+            {
+                hash_pair(root, frontier->nodes[level], root);
+            }
+        }
+    }
+}
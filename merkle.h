@@ -0,0 +1,52 @@
+#ifndef MERKLE_H
+#define MERKLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Binary SHA-256 Merkle trees: an inner node is sha256(left || right) and the last node of an
+ * odd-sized level is promoted to the next level unchanged. */
+
+#define MERKLE_MAX_DEPTH 64
+
+/* Every level is stored back to back in one array, leaves first and the root last */
+struct merkle_tree
+{
+    unsigned char (*nodes)[32];
+    size_t leaf_count;
+    size_t level_count;
+    size_t level_offset[MERKLE_MAX_DEPTH + 1];
+};
+
+/* threads = 0 uses every online cpu. Fails on an empty leaf array or when out of memory. */
+bool merkle_tree_build(struct merkle_tree *tree, const unsigned char (*leaves)[32], size_t count, unsigned int threads);
+void merkle_tree_free(struct merkle_tree *tree);
+const unsigned char *merkle_tree_root(const struct merkle_tree *tree);
+
+/* Writes the sibling hashes from the leaf up (at most MERKLE_MAX_DEPTH) and returns how many; 0 when index is not a leaf */
+size_t merkle_tree_proof(const struct merkle_tree *tree, size_t index, unsigned char (*proof)[32]);
+bool merkle_proof_verify(const unsigned char root[32], const unsigned char leaf[32], size_t index, size_t leaf_count,
+                         const unsigned char (*proof)[32], size_t proof_length);
+
+/* Incremental tree: keeps only the roots of the complete subtrees along the right edge */
+struct merkle_frontier
+{
+    unsigned char nodes[MERKLE_MAX_DEPTH][32];
+    unsigned long long count;
+};
+
+void merkle_frontier_init(struct merkle_frontier *frontier);
+void merkle_frontier_append(struct merkle_frontier *frontier, const unsigned char leaf[32]);
+
+/* Same root as merkle_tree_build over the appended leaves; sha256 of nothing when empty */
+void merkle_frontier_root(unsigned char root[32], const struct merkle_frontier *frontier);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
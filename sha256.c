@@ -0,0 +1,1231 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sha256_internal.h"
+
+/* sha256_update_copy bypasses the caches from here on, like memcpy does for copies this large */
+#define STREAMING_COPY_THRESHOLD (1024 * 1024)
+
+void sha256_init(struct SHA256 *context)
+{
+    context->length = 0;
+    context->buffer_length = 0;
+
+    context->state[0] = 0x6a09e667;
+    context->state[1] = 0xbb67ae85;
+    context->state[2] = 0x3c6ef372;
+    context->state[3] = 0xa54ff53a;
+    context->state[4] = 0x510e527f;
+    context->state[5] = 0x9b05688c;
+    context->state[6] = 0x1f83d9ab;
+    context->state[7] = 0x5be0cd19;
+}
+
+/* state[8] to the ABEF/CDGH register pair used by sha256rnds2 */
+static TARGET_SHA ALWAYS_INLINE void load_state_using_cpu_extensions(const unsigned int state[8], __m128i *abef, __m128i *cdgh)
+{
+    __m128i _tmp = _mm_loadu_si128((const __m128i *)&state[0]);
+    __m128i _state1 = _mm_loadu_si128((const __m128i *)&state[4]);
+
+    _tmp = _mm_shuffle_epi32(_tmp, 0xB1);         /* CDAB */
+    _state1 = _mm_shuffle_epi32(_state1, 0x1B);   /* EFGH */
+    *abef = _mm_alignr_epi8(_tmp, _state1, 8);    /* ABEF */
+    *cdgh = _mm_blend_epi16(_state1, _tmp, 0xF0); /* CDGH */
+}
+
+static TARGET_SHA ALWAYS_INLINE void store_state_using_cpu_extensions(unsigned int state[8], __m128i abef, __m128i cdgh)
+{
+    __m128i _tmp = _mm_shuffle_epi32(abef, 0x1B);           /* FEBA */
+    __m128i _state1 = _mm_shuffle_epi32(cdgh, 0xB1);        /* DCHG */
+    __m128i _state0 = _mm_blend_epi16(_tmp, _state1, 0xF0); /* DCBA */
+    _state1 = _mm_alignr_epi8(_state1, _tmp, 8);            /* ABEF */
+
+    _mm_storeu_si128((__m128i *)&state[0], _state0);
+    _mm_storeu_si128((__m128i *)&state[4], _state1);
+}
+
+/* 64 rounds over one block whose words are already in host order in _msg0.._msg3 */
+static TARGET_SHA ALWAYS_INLINE void process_message_using_cpu_extensions(__m128i *abef, __m128i *cdgh, __m128i _msg0, __m128i _msg1, __m128i _msg2, __m128i _msg3)
+{
+    __m128i _state0 = *abef, _state1 = *cdgh;
+    __m128i _msg, _tmp;
+    __m128i _abef_save, _cdgh_save;
+
+    /* Save current state */
+    _abef_save = _state0;
+    _cdgh_save = _state1;
+
+    /* Rounds 0-3 */
+    _msg = _mm_add_epi32(_msg0, _mm_set_epi64x(0xE9B5DBA5B5C0FBCFULL, 0x71374491428A2F98ULL));
+    _state1 = _mm_sha256rnds2_epu32(_state1, _state0, _msg);
+    _msg = _mm_shuffle_epi32(_msg, 0x0E);
+    _state0 = _mm_sha256rnds2_epu32(_state0, _state1, _msg);
+
+    /* Rounds 4-7 */
+    _msg = _mm_add_epi32(_msg1, _mm_set_epi64x(0xAB1C5ED5923F82A4ULL, 0x59F111F13956C25BULL));
+    _state1 = _mm_sha256rnds2_epu32(_state1, _state0, _msg);
+    _msg = _mm_shuffle_epi32(_msg, 0x0E);
+    _state0 = _mm_sha256rnds2_epu32(_state0, _state1, _msg);
+    _msg0 = _mm_sha256msg1_epu32(_msg0, _msg1);
+
+    /* Rounds 8-11 */
+    _msg = _mm_add_epi32(_msg2, _mm_set_epi64x(0x550C7DC3243185BEULL, 0x12835B01D807AA98ULL));
+    _state1 = _mm_sha256rnds2_epu32(_state1, _state0, _msg);
+    _msg = _mm_shuffle_epi32(_msg, 0x0E);
+    _state0 = _mm_sha256rnds2_epu32(_state0, _state1, _msg);
+    _msg1 = _mm_sha256msg1_epu32(_msg1, _msg2);
+
+    /* Rounds 12-15 */
+    _msg = _mm_add_epi32(_msg3, _mm_set_epi64x(0xC19BF1749BDC06A7ULL, 0x80DEB1FE72BE5D74ULL));
+    _state1 = _mm_sha256rnds2_epu32(_state1, _state0, _msg);
+    _tmp = _mm_alignr_epi8(_msg3, _msg2, 4);
+    _msg0 = _mm_add_epi32(_msg0, _tmp);
+    _msg0 = _mm_sha256msg2_epu32(_msg0, _msg3);
+    _msg = _mm_shuffle_epi32(_msg, 0x0E);
+    _state0 = _mm_sha256rnds2_epu32(_state0, _state1, _msg);
+    _msg2 = _mm_sha256msg1_epu32(_msg2, _msg3);
+
+    /* Rounds 16-19 */
+    _msg = _mm_add_epi32(_msg0, _mm_set_epi64x(0x240CA1CC0FC19DC6ULL, 0xEFBE4786E49B69C1ULL));
+    _state1 = _mm_sha256rnds2_epu32(_state1, _state0, _msg);
+    _tmp = _mm_alignr_epi8(_msg0, _msg3, 4);
+    _msg1 = _mm_add_epi32(_msg1, _tmp);
+    _msg1 = _mm_sha256msg2_epu32(_msg1, _msg0);
+    _msg = _mm_shuffle_epi32(_msg, 0x0E);
+    _state0 = _mm_sha256rnds2_epu32(_state0, _state1, _msg);
+    _msg3 = _mm_sha256msg1_epu32(_msg3, _msg0);
+
+    /* Rounds 20-23 */
+    _msg = _mm_add_epi32(_msg1, _mm_set_epi64x(0x76F988DA5CB0A9DCULL, 0x4A7484AA2DE92C6FULL));
+    _state1 = _mm_sha256rnds2_epu32(_state1, _state0, _msg);
+    _tmp = _mm_alignr_epi8(_msg1, _msg0, 4);
+    _msg2 = _mm_add_epi32(_msg2, _tmp);
+    _msg2 = _mm_sha256msg2_epu32(_msg2, _msg1);
+    _msg = _mm_shuffle_epi32(_msg, 0x0E);
+    _state0 = _mm_sha256rnds2_epu32(_state0, _state1, _msg);
+    _msg0 = _mm_sha256msg1_epu32(_msg0, _msg1);
+
+    /* Rounds 24-27 */
+    _msg = _mm_add_epi32(_msg2, _mm_set_epi64x(0xBF597FC7B00327C8ULL, 0xA831C66D983E5152ULL));
+    _state1 = _mm_sha256rnds2_epu32(_state1, _state0, _msg);
+    _tmp = _mm_alignr_epi8(_msg2, _msg1, 4);
+    _msg3 = _mm_add_epi32(_msg3, _tmp);
+    _msg3 = _mm_sha256msg2_epu32(_msg3, _msg2);
+    _msg = _mm_shuffle_epi32(_msg, 0x0E);
+    _state0 = _mm_sha256rnds2_epu32(_state0, _state1, _msg);
+    _msg1 = _mm_sha256msg1_epu32(_msg1, _msg2);
+
+    /* Rounds 28-31 */
+    _msg = _mm_add_epi32(_msg3, _mm_set_epi64x(0x1429296706CA6351ULL, 0xD5A79147C6E00BF3ULL));
+    _state1 = _mm_sha256rnds2_epu32(_state1, _state0, _msg);
+    _tmp = _mm_alignr_epi8(_msg3, _msg2, 4);
+    _msg0 = _mm_add_epi32(_msg0, _tmp);
+    _msg0 = _mm_sha256msg2_epu32(_msg0, _msg3);
+    _msg = _mm_shuffle_epi32(_msg, 0x0E);
+    _state0 = _mm_sha256rnds2_epu32(_state0, _state1, _msg);
+    _msg2 = _mm_sha256msg1_epu32(_msg2, _msg3);
+
+    /* Rounds 32-35 */
+    _msg = _mm_add_epi32(_msg0, _mm_set_epi64x(0x53380D134D2C6DFCULL, 0x2E1B213827B70A85ULL));
+    _state1 = _mm_sha256rnds2_epu32(_state1, _state0, _msg);
+    _tmp = _mm_alignr_epi8(_msg0, _msg3, 4);
+    _msg1 = _mm_add_epi32(_msg1, _tmp);
+    _msg1 = _mm_sha256msg2_epu32(_msg1, _msg0);
+    _msg = _mm_shuffle_epi32(_msg, 0x0E);
+    _state0 = _mm_sha256rnds2_epu32(_state0, _state1, _msg);
+    _msg3 = _mm_sha256msg1_epu32(_msg3, _msg0);
+
+    /* Rounds 36-39 */
+    _msg = _mm_add_epi32(_msg1, _mm_set_epi64x(0x92722C8581C2C92EULL, 0x766A0ABB650A7354ULL));
+    _state1 = _mm_sha256rnds2_epu32(_state1, _state0, _msg);
+    _tmp = _mm_alignr_epi8(_msg1, _msg0, 4);
+    _msg2 = _mm_add_epi32(_msg2, _tmp);
+    _msg2 = _mm_sha256msg2_epu32(_msg2, _msg1);
+    _msg = _mm_shuffle_epi32(_msg, 0x0E);
+    _state0 = _mm_sha256rnds2_epu32(_state0, _state1, _msg);
+    _msg0 = _mm_sha256msg1_epu32(_msg0, _msg1);
+
+    /* Rounds 40-43 */
+    _msg = _mm_add_epi32(_msg2, _mm_set_epi64x(0xC76C51A3C24B8B70ULL, 0xA81A664BA2BFE8A1ULL));
+    _state1 = _mm_sha256rnds2_epu32(_state1, _state0, _msg);
+    _tmp = _mm_alignr_epi8(_msg2, _msg1, 4);
+    _msg3 = _mm_add_epi32(_msg3, _tmp);
+    _msg3 = _mm_sha256msg2_epu32(_msg3, _msg2);
+    _msg = _mm_shuffle_epi32(_msg, 0x0E);
+    _state0 = _mm_sha256rnds2_epu32(_state0, _state1, _msg);
+    _msg1 = _mm_sha256msg1_epu32(_msg1, _msg2);
+
+    /* Rounds 44-47 */
+    _msg = _mm_add_epi32(_msg3, _mm_set_epi64x(0x106AA070F40E3585ULL, 0xD6990624D192E819ULL));
+    _state1 = _mm_sha256rnds2_epu32(_state1, _state0, _msg);
+    _tmp = _mm_alignr_epi8(_msg3, _msg2, 4);
+    _msg0 = _mm_add_epi32(_msg0, _tmp);
+    _msg0 = _mm_sha256msg2_epu32(_msg0, _msg3);
+    _msg = _mm_shuffle_epi32(_msg, 0x0E);
+    _state0 = _mm_sha256rnds2_epu32(_state0, _state1, _msg);
+    _msg2 = _mm_sha256msg1_epu32(_msg2, _msg3);
+
+    /* Rounds 48-51 */
+    _msg = _mm_add_epi32(_msg0, _mm_set_epi64x(0x34B0BCB52748774CULL, 0x1E376C0819A4C116ULL));
+    _state1 = _mm_sha256rnds2_epu32(_state1, _state0, _msg);
+    _tmp = _mm_alignr_epi8(_msg0, _msg3, 4);
+    _msg1 = _mm_add_epi32(_msg1, _tmp);
+    _msg1 = _mm_sha256msg2_epu32(_msg1, _msg0);
+    _msg = _mm_shuffle_epi32(_msg, 0x0E);
+    _state0 = _mm_sha256rnds2_epu32(_state0, _state1, _msg);
+    _msg3 = _mm_sha256msg1_epu32(_msg3, _msg0);
+
+    /* Rounds 52-55 */
+    _msg = _mm_add_epi32(_msg1, _mm_set_epi64x(0x682E6FF35B9CCA4FULL, 0x4ED8AA4A391C0CB3ULL));
+    _state1 = _mm_sha256rnds2_epu32(_state1, _state0, _msg);
+    _tmp = _mm_alignr_epi8(_msg1, _msg0, 4);
+    _msg2 = _mm_add_epi32(_msg2, _tmp);
+    _msg2 = _mm_sha256msg2_epu32(_msg2, _msg1);
+    _msg = _mm_shuffle_epi32(_msg, 0x0E);
+    _state0 = _mm_sha256rnds2_epu32(_state0, _state1, _msg);
+
+    /* Rounds 56-59 */
+    _msg = _mm_add_epi32(_msg2, _mm_set_epi64x(0x8CC7020884C87814ULL, 0x78A5636F748F82EEULL));
+    _state1 = _mm_sha256rnds2_epu32(_state1, _state0, _msg);
+    _tmp = _mm_alignr_epi8(_msg2, _msg1, 4);
+    _msg3 = _mm_add_epi32(_msg3, _tmp);
+    _msg3 = _mm_sha256msg2_epu32(_msg3, _msg2);
+    _msg = _mm_shuffle_epi32(_msg, 0x0E);
+    _state0 = _mm_sha256rnds2_epu32(_state0, _state1, _msg);
+
+    /* Rounds 60-63 */
+    _msg = _mm_add_epi32(_msg3, _mm_set_epi64x(0xC67178F2BEF9A3F7ULL, 0xA4506CEB90BEFFFAULL));
+    _state1 = _mm_sha256rnds2_epu32(_state1, _state0, _msg);
+    _msg = _mm_shuffle_epi32(_msg, 0x0E);
+    _state0 = _mm_sha256rnds2_epu32(_state0, _state1, _msg);
+
+    /* Combine state  */
+    *abef = _mm_add_epi32(_state0, _abef_save);
+    *cdgh = _mm_add_epi32(_state1, _cdgh_save);
+
+}
+
+static TARGET_SHA void process_blocks_using_cpu_extensions(unsigned int state[8], const unsigned char *block, size_t count)
+{
+    __m128i _state0, _state1;
+    const __m128i _mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    /* The state stays in ABEF/CDGH form across all blocks and is converted back once at the end */
+    load_state_using_cpu_extensions(state, &_state0, &_state1);
+
+    while (count-- > 0)
+    {
+        _mm_prefetch((const char *)(block + 64), _MM_HINT_T0);
+
+        process_message_using_cpu_extensions(&_state0, &_state1,
+                                             _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 0)), _mask),
+                                             _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 16)), _mask),
+                                             _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 32)), _mask),
+                                             _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 48)), _mask));
+        block += 64;
+    }
+
+    store_state_using_cpu_extensions(state, _state0, _state1);
+}
+
+static TARGET_SHA void process_words_using_cpu_extensions(unsigned int state[8], const unsigned int words[16])
+{
+    __m128i _state0, _state1;
+
+    load_state_using_cpu_extensions(state, &_state0, &_state1);
+    process_message_using_cpu_extensions(&_state0, &_state1,
+                                         _mm_loadu_si128((const __m128i *)&words[0]),
+                                         _mm_loadu_si128((const __m128i *)&words[4]),
+                                         _mm_loadu_si128((const __m128i *)&words[8]),
+                                         _mm_loadu_si128((const __m128i *)&words[12]));
+    store_state_using_cpu_extensions(state, _state0, _state1);
+}
+
+/* Rounds only: the message schedule with round constants added is known in advance */
+static TARGET_SHA void process_schedule_using_cpu_extensions(unsigned int state[8], const unsigned int wk[64])
+{
+    __m128i _state0, _state1, _abef_save, _cdgh_save, _msg;
+
+    load_state_using_cpu_extensions(state, &_state0, &_state1);
+    _abef_save = _state0;
+    _cdgh_save = _state1;
+
+    for (int i = 0; i < 64; i += 4)
+    {
+        _msg = _mm_loadu_si128((const __m128i *)&wk[i]);
+        _state1 = _mm_sha256rnds2_epu32(_state1, _state0, _msg);
+        _msg = _mm_shuffle_epi32(_msg, 0x0E);
+        _state0 = _mm_sha256rnds2_epu32(_state0, _state1, _msg);
+    }
+
+    _state0 = _mm_add_epi32(_state0, _abef_save);
+    _state1 = _mm_add_epi32(_state1, _cdgh_save);
+    store_state_using_cpu_extensions(state, _state0, _state1);
+}
+
+/* process_blocks that also stores each block to destination from the registers it was loaded into, so
+ * the source is read once. Streaming stores need a 16-byte aligned destination. */
+static TARGET_SHA void process_copy_using_cpu_extensions(unsigned int state[8], unsigned char *destination, const unsigned char *block,
+                                                        size_t count, bool streaming)
+{
+    __m128i _state0, _state1;
+    const __m128i _mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    load_state_using_cpu_extensions(state, &_state0, &_state1);
+
+    while (count-- > 0)
+    {
+        __m128i _msg0 = _mm_loadu_si128((const __m128i *)(block + 0));
+        __m128i _msg1 = _mm_loadu_si128((const __m128i *)(block + 16));
+        __m128i _msg2 = _mm_loadu_si128((const __m128i *)(block + 32));
+        __m128i _msg3 = _mm_loadu_si128((const __m128i *)(block + 48));
+
+        _mm_prefetch((const char *)(block + 64), _MM_HINT_T0);
+        if (streaming)
+        {
+            _mm_stream_si128((__m128i *)(destination + 0), _msg0);
+            _mm_stream_si128((__m128i *)(destination + 16), _msg1);
+            _mm_stream_si128((__m128i *)(destination + 32), _msg2);
+            _mm_stream_si128((__m128i *)(destination + 48), _msg3);
+        }
+        else
+        {
+            _mm_storeu_si128((__m128i *)(destination + 0), _msg0);
+            _mm_storeu_si128((__m128i *)(destination + 16), _msg1);
+            _mm_storeu_si128((__m128i *)(destination + 32), _msg2);
+            _mm_storeu_si128((__m128i *)(destination + 48), _msg3);
+        }
+
+        process_message_using_cpu_extensions(&_state0, &_state1, _mm_shuffle_epi8(_msg0, _mask), _mm_shuffle_epi8(_msg1, _mask),
+                                             _mm_shuffle_epi8(_msg2, _mask), _mm_shuffle_epi8(_msg3, _mask));
+        block += 64;
+        destination += 64;
+    }
+
+    /* Streaming stores are weakly ordered; the copy must be visible before anything the caller stores next */
+    if (streaming)
+    {
+        _mm_sfence();
+    }
+    store_state_using_cpu_extensions(state, _state0, _state1);
+}
+
+/* One round with the state names rotated by the caller instead of moving eight registers around;
+ * wk is the schedule word with its round constant already added. */
+#define ROUND(a, b, c, d, e, f, g, h, wk)                                                                              \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        unsigned int _t1 = h + SIG1(e) + CH(e, f, g) + (wk);                                                           \
+        d += _t1;                                                                                                      \
+        h = _t1 + SIG0(a) + MAJ(a, b, c);                                                                              \
+    } while (0)
+
+#define ROUNDS_4(i, WK)                                                                                                \
+    ROUND(a, b, c, d, e, f, g, h, WK((i) + 0));                                                                        \
+    ROUND(h, a, b, c, d, e, f, g, WK((i) + 1));                                                                        \
+    ROUND(g, h, a, b, c, d, e, f, WK((i) + 2));                                                                        \
+    ROUND(f, g, h, a, b, c, d, e, WK((i) + 3))
+
+#define ROUNDS_4_ODD(i, WK)                                                                                            \
+    ROUND(e, f, g, h, a, b, c, d, WK((i) + 0));                                                                        \
+    ROUND(d, e, f, g, h, a, b, c, WK((i) + 1));                                                                        \
+    ROUND(c, d, e, f, g, h, a, b, WK((i) + 2));                                                                        \
+    ROUND(b, c, d, e, f, g, h, a, WK((i) + 3))
+
+#define LOAD_STATE()                                                                                                   \
+    unsigned int a = state[0], b = state[1], c = state[2], d = state[3];                                               \
+    unsigned int e = state[4], f = state[5], g = state[6], h = state[7]
+
+#define ADD_STATE()                                                                                                    \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        state[0] += a;                                                                                                 \
+        state[1] += b;                                                                                                 \
+        state[2] += c;                                                                                                 \
+        state[3] += d;                                                                                                 \
+        state[4] += e;                                                                                                 \
+        state[5] += f;                                                                                                 \
+        state[6] += g;                                                                                                 \
+        state[7] += h;                                                                                                 \
+    } while (0)
+
+/* The scalar schedule lives in a rolling 16-word window: W[i] overwrites W[i - 16] right before round i */
+#define WK_WINDOW(i) (CONSTANTS[i] + w[(i) & 15])
+#define WK_EXPAND(i)                                                                                                   \
+    (CONSTANTS[i] + (w[(i) & 15] += sig1(w[((i) + 14) & 15]) + w[((i) + 9) & 15] + sig0(w[((i) + 1) & 15])))
+
+static ALWAYS_INLINE void process_window_scalar(unsigned int state[8], unsigned int w[16])
+{
+    LOAD_STATE();
+
+    ROUNDS_4(0, WK_WINDOW);
+    ROUNDS_4_ODD(4, WK_WINDOW);
+    ROUNDS_4(8, WK_WINDOW);
+    ROUNDS_4_ODD(12, WK_WINDOW);
+
+    for (int i = 16; i < 64; i += 8)
+    {
+        ROUNDS_4(i, WK_EXPAND);
+        ROUNDS_4_ODD(i + 4, WK_EXPAND);
+    }
+
+    ADD_STATE();
+}
+
+static void process_blocks_scalar(unsigned int state[8], const unsigned char *block, size_t count)
+{
+    unsigned int w[16];
+
+    for (; count > 0; count--, block += 64)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            w[i] = load_be32(block + 4 * i);
+        }
+        process_window_scalar(state, w);
+    }
+}
+
+static void process_words_scalar(unsigned int state[8], const unsigned int words[16])
+{
+    unsigned int w[16];
+
+    memcpy(w, words, sizeof(w));
+    process_window_scalar(state, w);
+}
+
+#define WK_PRECOMPUTED(i) wk[i]
+
+static void process_schedule_scalar(unsigned int state[8], const unsigned int wk[64])
+{
+    LOAD_STATE();
+
+    for (int i = 0; i < 64; i += 8)
+    {
+        ROUNDS_4(i, WK_PRECOMPUTED);
+        ROUNDS_4_ODD(i + 4, WK_PRECOMPUTED);
+    }
+
+    ADD_STATE();
+}
+
+static TARGET_SSSE3 ALWAYS_INLINE __m128i rotr_x4(__m128i x, int n)
+{
+    return _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - n));
+}
+
+static TARGET_SSSE3 ALWAYS_INLINE __m128i sig0_x4(__m128i x)
+{
+    return _mm_xor_si128(_mm_xor_si128(rotr_x4(x, 7), rotr_x4(x, 18)), _mm_srli_epi32(x, 3));
+}
+
+static TARGET_SSSE3 ALWAYS_INLINE __m128i sig1_x4(__m128i x)
+{
+    return _mm_xor_si128(_mm_xor_si128(rotr_x4(x, 17), rotr_x4(x, 19)), _mm_srli_epi32(x, 10));
+}
+
+/* W[t..t+3] from x0..x3 = W[t-16..t-1]. W[t+2] and W[t+3] depend on W[t] and W[t+1],
+ * so sig1 is applied in two halves; sig1(0) = 0 keeps the unused lanes out of the sum. */
+static TARGET_SSSE3 ALWAYS_INLINE __m128i schedule_x4(__m128i x0, __m128i x1, __m128i x2, __m128i x3)
+{
+    __m128i w = _mm_add_epi32(x0, sig0_x4(_mm_alignr_epi8(x1, x0, 4)));
+    w = _mm_add_epi32(w, _mm_alignr_epi8(x3, x2, 4));
+    w = _mm_add_epi32(w, sig1_x4(_mm_srli_si128(x3, 8)));
+    return _mm_add_epi32(w, sig1_x4(_mm_slli_si128(w, 8)));
+}
+
+#define WK_BUFFER(i) wk[(i) & 15]
+
+/* Vector schedule for the next 16 words runs alongside the scalar rounds over the current 16 */
+static TARGET_SSSE3 ALWAYS_INLINE void process_block_ssse3(unsigned int state[8], const unsigned char *block)
+{
+    ALIGNED(16) unsigned int wk[16];
+    const __m128i _mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i _x0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 0)), _mask);
+    __m128i _x1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 16)), _mask);
+    __m128i _x2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 32)), _mask);
+    __m128i _x3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 48)), _mask);
+
+    LOAD_STATE();
+
+    for (int i = 0; i < 64; i += 16)
+    {
+        _mm_store_si128((__m128i *)&wk[0], _mm_add_epi32(_x0, _mm_loadu_si128((const __m128i *)&CONSTANTS[i + 0])));
+        _mm_store_si128((__m128i *)&wk[4], _mm_add_epi32(_x1, _mm_loadu_si128((const __m128i *)&CONSTANTS[i + 4])));
+        _mm_store_si128((__m128i *)&wk[8], _mm_add_epi32(_x2, _mm_loadu_si128((const __m128i *)&CONSTANTS[i + 8])));
+        _mm_store_si128((__m128i *)&wk[12], _mm_add_epi32(_x3, _mm_loadu_si128((const __m128i *)&CONSTANTS[i + 12])));
+
+        if (i < 48)
+        {
+            _x0 = schedule_x4(_x0, _x1, _x2, _x3);
+            ROUNDS_4(i + 0, WK_BUFFER);
+            _x1 = schedule_x4(_x1, _x2, _x3, _x0);
+            ROUNDS_4_ODD(i + 4, WK_BUFFER);
+            _x2 = schedule_x4(_x2, _x3, _x0, _x1);
+            ROUNDS_4(i + 8, WK_BUFFER);
+            _x3 = schedule_x4(_x3, _x0, _x1, _x2);
+            ROUNDS_4_ODD(i + 12, WK_BUFFER);
+        }
+        else
+        {
+            ROUNDS_4(i + 0, WK_BUFFER);
+            ROUNDS_4_ODD(i + 4, WK_BUFFER);
+            ROUNDS_4(i + 8, WK_BUFFER);
+            ROUNDS_4_ODD(i + 12, WK_BUFFER);
+        }
+    }
+
+    ADD_STATE();
+}
+
+static TARGET_SSSE3 void process_blocks_ssse3(unsigned int state[8], const unsigned char *block, size_t count)
+{
+    for (; count > 0; count--, block += 64)
+    {
+        process_block_ssse3(state, block);
+    }
+}
+
+static TARGET_AVX2 ALWAYS_INLINE __m256i rotr_2x4(__m256i x, int n)
+{
+    return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+static TARGET_AVX2 ALWAYS_INLINE __m256i sig0_2x4(__m256i x)
+{
+    return _mm256_xor_si256(_mm256_xor_si256(rotr_2x4(x, 7), rotr_2x4(x, 18)), _mm256_srli_epi32(x, 3));
+}
+
+static TARGET_AVX2 ALWAYS_INLINE __m256i sig1_2x4(__m256i x)
+{
+    return _mm256_xor_si256(_mm256_xor_si256(rotr_2x4(x, 17), rotr_2x4(x, 19)), _mm256_srli_epi32(x, 10));
+}
+
+/* schedule_x4 for two blocks at once, one per 128-bit half; alignr and byte shifts never cross halves */
+static TARGET_AVX2 ALWAYS_INLINE __m256i schedule_2x4(__m256i x0, __m256i x1, __m256i x2, __m256i x3)
+{
+    __m256i w = _mm256_add_epi32(x0, sig0_2x4(_mm256_alignr_epi8(x1, x0, 4)));
+    w = _mm256_add_epi32(w, _mm256_alignr_epi8(x3, x2, 4));
+    w = _mm256_add_epi32(w, sig1_2x4(_mm256_srli_si256(x3, 8)));
+    return _mm256_add_epi32(w, sig1_2x4(_mm256_slli_si256(w, 8)));
+}
+
+static TARGET_AVX2 ALWAYS_INLINE __m256i load_2x4(const unsigned char *first, const unsigned char *second, __m256i mask)
+{
+    __m256i x = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)first));
+    x = _mm256_inserti128_si256(x, _mm_loadu_si128((const __m128i *)second), 1);
+    return _mm256_shuffle_epi8(x, mask);
+}
+
+static TARGET_AVX2 ALWAYS_INLINE __m256i add_constants_2x4(__m256i x, int i)
+{
+    return _mm256_add_epi32(x, _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)&CONSTANTS[i])));
+}
+
+#define WK_FIRST(i) wk[(i) >> 2][(i) & 3]
+#define WK_SECOND(i) wk[(i) >> 2][4 + ((i) & 3)]
+
+/* Two blocks share one schedule pass: the second block's W+K is computed during the first block's
+ * rounds and its own rounds then only read the saved words. */
+static TARGET_AVX2_BMI2 void process_blocks_avx2(unsigned int state[8], const unsigned char *block, size_t count)
+{
+    ALIGNED(32) unsigned int wk[16][8];
+    const __m256i _mask = _mm256_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL, 0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    for (; count >= 2; count -= 2, block += 128)
+    {
+        __m256i _x0 = load_2x4(block + 0, block + 64, _mask);
+        __m256i _x1 = load_2x4(block + 16, block + 80, _mask);
+        __m256i _x2 = load_2x4(block + 32, block + 96, _mask);
+        __m256i _x3 = load_2x4(block + 48, block + 112, _mask);
+
+        {
+            LOAD_STATE();
+
+            for (int i = 0; i < 64; i += 16)
+            {
+                _mm256_store_si256((__m256i *)wk[(i >> 2) + 0], add_constants_2x4(_x0, i + 0));
+                _mm256_store_si256((__m256i *)wk[(i >> 2) + 1], add_constants_2x4(_x1, i + 4));
+                _mm256_store_si256((__m256i *)wk[(i >> 2) + 2], add_constants_2x4(_x2, i + 8));
+                _mm256_store_si256((__m256i *)wk[(i >> 2) + 3], add_constants_2x4(_x3, i + 12));
+
+                if (i < 48)
+                {
+                    _x0 = schedule_2x4(_x0, _x1, _x2, _x3);
+                    ROUNDS_4(i + 0, WK_FIRST);
+                    _x1 = schedule_2x4(_x1, _x2, _x3, _x0);
+                    ROUNDS_4_ODD(i + 4, WK_FIRST);
+                    _x2 = schedule_2x4(_x2, _x3, _x0, _x1);
+                    ROUNDS_4(i + 8, WK_FIRST);
+                    _x3 = schedule_2x4(_x3, _x0, _x1, _x2);
+                    ROUNDS_4_ODD(i + 12, WK_FIRST);
+                }
+                else
+                {
+                    ROUNDS_4(i + 0, WK_FIRST);
+                    ROUNDS_4_ODD(i + 4, WK_FIRST);
+                    ROUNDS_4(i + 8, WK_FIRST);
+                    ROUNDS_4_ODD(i + 12, WK_FIRST);
+                }
+            }
+
+            ADD_STATE();
+        }
+
+        {
+            LOAD_STATE();
+
+            for (int i = 0; i < 64; i += 8)
+            {
+                ROUNDS_4(i, WK_SECOND);
+                ROUNDS_4_ODD(i + 4, WK_SECOND);
+            }
+
+            ADD_STATE();
+        }
+    }
+
+    if (count > 0)
+    {
+        process_block_ssse3(state, block);
+    }
+}
+
+/* Backends whose schedule does not keep the raw block in registers copy a few KiB and then hash the
+ * source, which the copy has just pulled into L1, so memory is still read once. */
+#define COPY_CHUNK_BLOCKS 64
+
+static TARGET_SSSE3 void copy_blocks_streaming(unsigned char *destination, const unsigned char *block, size_t count)
+{
+    for (size_t i = 0; i < count * 64; i += 16)
+    {
+        _mm_stream_si128((__m128i *)(destination + i), _mm_loadu_si128((const __m128i *)(block + i)));
+    }
+}
+
+static ALWAYS_INLINE void copy_then_hash(unsigned int state[8], unsigned char *destination, const unsigned char *block, size_t count,
+                                        bool streaming, void (*process_blocks)(unsigned int state[8], const unsigned char *block, size_t count))
+{
+    while (count > 0)
+    {
+        size_t chunk = count < COPY_CHUNK_BLOCKS ? count : COPY_CHUNK_BLOCKS;
+
+        if (streaming)
+        {
+            copy_blocks_streaming(destination, block, chunk);
+        }
+        else
+        {
+            memcpy(destination, block, chunk * 64);
+        }
+        process_blocks(state, block, chunk);
+        block += chunk * 64;
+        destination += chunk * 64;
+        count -= chunk;
+    }
+
+    if (streaming)
+    {
+        _mm_sfence();
+    }
+}
+
+static TARGET_AVX2_BMI2 void process_copy_avx2(unsigned int state[8], unsigned char *destination, const unsigned char *block, size_t count,
+                                               bool streaming)
+{
+    copy_then_hash(state, destination, block, count, streaming, process_blocks_avx2);
+}
+
+static TARGET_SSSE3 void process_copy_ssse3(unsigned int state[8], unsigned char *destination, const unsigned char *block, size_t count,
+                                            bool streaming)
+{
+    copy_then_hash(state, destination, block, count, streaming, process_blocks_ssse3);
+}
+
+/* No streaming without SSE: the scalar kernel is too slow for the copy's cache traffic to matter */
+static void process_copy_scalar(unsigned int state[8], unsigned char *destination, const unsigned char *block, size_t count,
+                                bool streaming)
+{
+    (void)streaming;
+    copy_then_hash(state, destination, block, count, false, process_blocks_scalar);
+}
+
+typedef void (*process_blocks_function)(unsigned int state[8], const unsigned char *block, size_t count);
+typedef void (*process_words_function)(unsigned int state[8], const unsigned int words[16]);
+typedef void (*process_schedule_function)(unsigned int state[8], const unsigned int wk[64]);
+typedef void (*process_copy_function)(unsigned int state[8], unsigned char *destination, const unsigned char *block, size_t count,
+                                      bool streaming);
+
+struct sha256_backend
+{
+    const char *name;
+    bool (*supported)();
+    process_blocks_function process_blocks;
+    /* One block given as host-order words, for inputs that already are words (digests, padding) */
+    process_words_function process_words;
+    /* Rounds over a precomputed W+K schedule, for constant blocks */
+    process_schedule_function process_schedule;
+    /* process_blocks that also copies the blocks to destination, for sha256_update_copy */
+    process_copy_function process_copy;
+};
+
+/* Ordered by preference: the first supported entry wins unless SHA256_BACKEND names another one. */
+static const struct sha256_backend BACKENDS[] = {
+#if USE_CPU_EXTENSIONS
+    {"shani", cpu_supports_sha256_extensions, process_blocks_using_cpu_extensions, process_words_using_cpu_extensions, process_schedule_using_cpu_extensions,
+     process_copy_using_cpu_extensions},
+    {"avx2", cpu_supports_avx2_bmi2, process_blocks_avx2, process_words_scalar, process_schedule_scalar, process_copy_avx2},
+    {"ssse3", cpu_supports_ssse3, process_blocks_ssse3, process_words_scalar, process_schedule_scalar, process_copy_ssse3},
+#endif
+    {"scalar", cpu_supports_scalar, process_blocks_scalar, process_words_scalar, process_schedule_scalar, process_copy_scalar},
+};
+
+#define BACKENDS_COUNT (sizeof(BACKENDS) / sizeof(BACKENDS[0]))
+
+static void process_blocks_unresolved(unsigned int state[8], const unsigned char *block, size_t count);
+static void process_words_unresolved(unsigned int state[8], const unsigned int words[16]);
+static void process_schedule_unresolved(unsigned int state[8], const unsigned int wk[64]);
+static void process_copy_unresolved(unsigned int state[8], unsigned char *destination, const unsigned char *block, size_t count,
+                                    bool streaming);
+
+static const struct sha256_backend UNRESOLVED_BACKEND = {NULL, NULL, process_blocks_unresolved, process_words_unresolved, process_schedule_unresolved,
+                                                         process_copy_unresolved};
+
+/* cpuid is serializing, so it runs once: the first hashed block swaps in the selected backend. Atomic
+ * because that first block, like sha256_set_backend, may come on any thread; the loads are plain movs. */
+static _Atomic(const struct sha256_backend *) backend = &UNRESOLVED_BACKEND;
+
+static ALWAYS_INLINE const struct sha256_backend *current_backend()
+{
+    return atomic_load_explicit(&backend, memory_order_acquire);
+}
+
+static const struct sha256_backend *find_backend(const char *name)
+{
+    for (size_t i = 0; i < BACKENDS_COUNT; i++)
+    {
+        if (strcmp(BACKENDS[i].name, name) == 0 && BACKENDS[i].supported())
+        {
+            return &BACKENDS[i];
+        }
+    }
+    return NULL;
+}
+
+static const struct sha256_backend *select_backend()
+{
+    const char *name = getenv("SHA256_BACKEND");
+
+    if (name != NULL && name[0] != '\0')
+    {
+        const struct sha256_backend *forced = find_backend(name);
+        if (forced != NULL)
+        {
+            return forced;
+        }
+        fprintf(stderr, "sha256: backend \"%s\" is unknown or not supported by this cpu, ignoring SHA256_BACKEND\n", name);
+    }
+
+    for (size_t i = 0; i < BACKENDS_COUNT; i++)
+    {
+        if (BACKENDS[i].supported())
+        {
+            return &BACKENDS[i];
+        }
+    }
+    return NULL;
+}
+
+/* Threads racing here select the same backend; one that lost to sha256_set_backend keeps the forced one */
+static const struct sha256_backend *resolve_backend()
+{
+    const struct sha256_backend *current = current_backend();
+    if (current == &UNRESOLVED_BACKEND)
+    {
+        const struct sha256_backend *selected = select_backend();
+        if (atomic_compare_exchange_strong_explicit(&backend, &current, selected, memory_order_acq_rel, memory_order_acquire))
+        {
+            current = selected;
+        }
+    }
+    return current;
+}
+
+static void process_blocks_unresolved(unsigned int state[8], const unsigned char *block, size_t count)
+{
+    resolve_backend()->process_blocks(state, block, count);
+}
+
+static void process_words_unresolved(unsigned int state[8], const unsigned int words[16])
+{
+    resolve_backend()->process_words(state, words);
+}
+
+static void process_schedule_unresolved(unsigned int state[8], const unsigned int wk[64])
+{
+    resolve_backend()->process_schedule(state, wk);
+}
+
+static void process_copy_unresolved(unsigned int state[8], unsigned char *destination, const unsigned char *block, size_t count,
+                                    bool streaming)
+{
+    resolve_backend()->process_copy(state, destination, block, count, streaming);
+}
+
+#if SHA256_INSTRUMENTATION
+_Static_assert(BACKENDS_COUNT <= SHA256_INSTRUMENTED_BACKENDS, "SHA256_INSTRUMENTED_BACKENDS is too small for the backend table");
+
+static inline unsigned long long kernel_begin(size_t count)
+{
+    SHA256_PROBE_BLOCKS_BEGIN(count);
+#if SHA256_INSTRUMENTATION_LATENCY
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/* Attributed after the call, by which time a first call has swapped the unresolved stub for a backend */
+static void kernel_end(unsigned long long start, size_t count)
+{
+    struct sha256_thread_counters *counters = sha256_counters();
+    size_t index = (size_t)(current_backend() - BACKENDS);
+
+    sha256_count(&counters->kernel_calls[index], 1);
+    sha256_count(&counters->blocks[index], count);
+#if SHA256_INSTRUMENTATION_LATENCY
+    unsigned long long cycles = __rdtsc() - start;
+    unsigned int bucket = 0;
+    while (bucket + 1 < SHA256_LATENCY_BUCKETS && cycles >> (bucket + 1) != 0)
+    {
+        bucket++;
+    }
+    sha256_count(&counters->latency_cycles[index][bucket], 1);
+#else
+    (void)start;
+#endif
+    SHA256_PROBE_BLOCKS_END(index, count);
+}
+
+const char *sha256_backend_name(size_t index)
+{
+    return index < BACKENDS_COUNT ? BACKENDS[index].name : NULL;
+}
+#endif
+
+/* Every kernel call of this file goes through these four, the only place instrumented builds differ */
+static ALWAYS_INLINE void run_blocks(unsigned int state[8], const unsigned char *block, size_t count)
+{
+#if SHA256_INSTRUMENTATION
+    unsigned long long start = kernel_begin(count);
+    current_backend()->process_blocks(state, block, count);
+    kernel_end(start, count);
+#else
+    current_backend()->process_blocks(state, block, count);
+#endif
+}
+
+static ALWAYS_INLINE void run_words(unsigned int state[8], const unsigned int words[16])
+{
+#if SHA256_INSTRUMENTATION
+    unsigned long long start = kernel_begin(1);
+    current_backend()->process_words(state, words);
+    kernel_end(start, 1);
+#else
+    current_backend()->process_words(state, words);
+#endif
+}
+
+static ALWAYS_INLINE void run_schedule(unsigned int state[8], const unsigned int wk[64])
+{
+#if SHA256_INSTRUMENTATION
+    unsigned long long start = kernel_begin(1);
+    current_backend()->process_schedule(state, wk);
+    kernel_end(start, 1);
+#else
+    current_backend()->process_schedule(state, wk);
+#endif
+}
+
+static ALWAYS_INLINE void run_copy(unsigned int state[8], unsigned char *destination, const unsigned char *block, size_t count,
+                                   bool streaming)
+{
+#if SHA256_INSTRUMENTATION
+    unsigned long long start = kernel_begin(count);
+    current_backend()->process_copy(state, destination, block, count, streaming);
+    kernel_end(start, count);
+#else
+    current_backend()->process_copy(state, destination, block, count, streaming);
+#endif
+}
+
+void sha256_process_blocks(unsigned int state[8], const unsigned char *block, size_t count)
+{
+    run_blocks(state, block, count);
+}
+
+void sha256_process_words(unsigned int state[8], const unsigned int words[16])
+{
+    run_words(state, words);
+}
+
+const char *sha256_backend()
+{
+    return resolve_backend()->name;
+}
+
+const char *sha256_supported_backend(size_t index)
+{
+    for (size_t i = 0; i < BACKENDS_COUNT; i++)
+    {
+        if (BACKENDS[i].supported() && index-- == 0)
+        {
+            return BACKENDS[i].name;
+        }
+    }
+    return NULL;
+}
+
+bool sha256_set_backend(const char *name)
+{
+    const struct sha256_backend *forced = find_backend(name);
+    if (forced == NULL)
+    {
+        return false;
+    }
+    atomic_store_explicit(&backend, forced, memory_order_release);
+    return true;
+}
+
+void sha256_update(struct SHA256 *context, const unsigned char *input, size_t length)
+{
+    SHA256_COUNT(update_calls, 1);
+    SHA256_COUNT(update_bytes, length);
+    context->length += length;
+
+    if (context->buffer_length + length < 64)
+    {
+        SHA256_COUNT(buffered_updates, 1);
+        SHA256_COUNT(buffered_bytes, length);
+        memcpy(context->buffer + context->buffer_length, input, length);
+        context->buffer_length += length;
+        return;
+    }
+
+    if (context->buffer_length > 0)
+    {
+        size_t fill = 64 - context->buffer_length;
+        SHA256_COUNT(buffered_bytes, fill);
+        memcpy(context->buffer + context->buffer_length, input, fill);
+        run_blocks(context->state, context->buffer, 1);
+        input += fill;
+        length -= fill;
+    }
+
+    /* Every full block goes to the kernel in one call so the state stays in registers */
+    size_t blocks = length / 64;
+    if (blocks > 0)
+    {
+        run_blocks(context->state, input, blocks);
+    }
+
+    context->buffer_length = length % 64;
+    SHA256_COUNT(buffered_bytes, context->buffer_length);
+    memcpy(context->buffer, input + blocks * 64, context->buffer_length);
+}
+
+void sha256_update_copy(struct SHA256 *context, unsigned char *destination, const unsigned char *input, size_t length)
+{
+    SHA256_COUNT(update_calls, 1);
+    SHA256_COUNT(update_bytes, length);
+    context->length += length;
+
+    if (context->buffer_length + length < 64)
+    {
+        SHA256_COUNT(buffered_updates, 1);
+        SHA256_COUNT(buffered_bytes, length);
+        memcpy(context->buffer + context->buffer_length, input, length);
+        memcpy(destination, input, length);
+        context->buffer_length += length;
+        return;
+    }
+
+    if (context->buffer_length > 0)
+    {
+        size_t fill = 64 - context->buffer_length;
+        SHA256_COUNT(buffered_bytes, fill);
+        memcpy(context->buffer + context->buffer_length, input, fill);
+        memcpy(destination, input, fill);
+        run_blocks(context->state, context->buffer, 1);
+        input += fill;
+        destination += fill;
+        length -= fill;
+    }
+
+    /* Copies larger than the caches would only evict useful lines on their way to memory */
+    size_t blocks = length / 64;
+    if (blocks > 0)
+    {
+        bool streaming = length >= STREAMING_COPY_THRESHOLD && ((uintptr_t)destination & 15) == 0;
+        run_copy(context->state, destination, input, blocks, streaming);
+    }
+
+    context->buffer_length = length % 64;
+    SHA256_COUNT(buffered_bytes, context->buffer_length);
+    memcpy(context->buffer, input + blocks * 64, context->buffer_length);
+    memcpy(destination + blocks * 64, input + blocks * 64, context->buffer_length);
+}
+
+void sha256_updatev(struct SHA256 *context, const struct iovec *iov, int iovcnt)
+{
+    for (int i = 0; i < iovcnt; i++)
+    {
+        /* Fully contained blocks go to the kernel straight from the fragment, like in sha256_update */
+        if (iov[i].iov_len > 0)
+        {
+            sha256_update(context, (const unsigned char *)iov[i].iov_base, iov[i].iov_len);
+        }
+    }
+}
+
+void sha256_complete(unsigned char digest[32], struct SHA256 *context)
+{
+    size_t bits_count = context->length * 8;
+
+    SHA256_COUNT(complete_calls, 1);
+    context->buffer[context->buffer_length++] = 0x80;
+
+    if (context->buffer_length > 56)
+    {
+        SHA256_COUNT(complete_two_blocks, 1);
+        memset(context->buffer + context->buffer_length, 0, 64 - context->buffer_length);
+
+        run_blocks(context->state, context->buffer, 1);
+        context->buffer_length = 0;
+    }
+
+    memset(context->buffer + context->buffer_length, 0, 56 - context->buffer_length);
+    *(unsigned long long *)(context->buffer + 56) = _byteswap_uint64(bits_count);
+
+    run_blocks(context->state, context->buffer, 1);
+
+    *(unsigned int *)(digest + 0) = _byteswap_ulong(context->state[0]);
+    *(unsigned int *)(digest + 4) = _byteswap_ulong(context->state[1]);
+    *(unsigned int *)(digest + 8) = _byteswap_ulong(context->state[2]);
+    *(unsigned int *)(digest + 12) = _byteswap_ulong(context->state[3]);
+    *(unsigned int *)(digest + 16) = _byteswap_ulong(context->state[4]);
+    *(unsigned int *)(digest + 20) = _byteswap_ulong(context->state[5]);
+    *(unsigned int *)(digest + 24) = _byteswap_ulong(context->state[6]);
+    *(unsigned int *)(digest + 28) = _byteswap_ulong(context->state[7]);
+
+    context->buffer_length = 0;
+}
+
+/* Export layout, every integer big-endian:
+ *   0  magic "S2CK"          4  version (16 bits)      6  buffer_length, 0
+ *   8  bytes hashed (64)    16  state[8]               48  buffer, unused bytes zero
+ * 112  first 16 bytes of sha256 over bytes 0..111 */
+#define EXPORT_VERSION 1
+#define EXPORT_TAG_OFFSET 112
+
+static void store_be32(unsigned char *out, unsigned int value)
+{
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+}
+
+static unsigned int read_be32(const unsigned char *in)
+{
+    return (unsigned int)in[0] << 24 | (unsigned int)in[1] << 16 | (unsigned int)in[2] << 8 | in[3];
+}
+
+static void export_tag(unsigned char tag[32], const unsigned char *data)
+{
+    struct SHA256 context;
+    sha256_init(&context);
+    sha256_update(&context, data, EXPORT_TAG_OFFSET);
+    sha256_complete(tag, &context);
+}
+
+void sha256_export(unsigned char out[SHA256_EXPORT_SIZE], const struct SHA256 *context)
+{
+    unsigned long long length = context->length;
+    unsigned char tag[32];
+
+    memset(out, 0, SHA256_EXPORT_SIZE);
+    memcpy(out, "S2CK", 4);
+    out[4] = EXPORT_VERSION >> 8;
+    out[5] = EXPORT_VERSION & 0xff;
+    out[6] = (unsigned char)context->buffer_length;
+    store_be32(out + 8, (unsigned int)(length >> 32));
+    store_be32(out + 12, (unsigned int)length);
+    for (int i = 0; i < 8; i++)
+    {
+        store_be32(out + 16 + 4 * i, context->state[i]);
+    }
+    memcpy(out + 48, context->buffer, context->buffer_length);
+
+    export_tag(tag, out);
+    memcpy(out + EXPORT_TAG_OFFSET, tag, SHA256_EXPORT_SIZE - EXPORT_TAG_OFFSET);
+}
+
+bool sha256_import(struct SHA256 *context, const unsigned char in[SHA256_EXPORT_SIZE])
+{
+    unsigned char tag[32];
+    unsigned long long length = (unsigned long long)read_be32(in + 8) << 32 | read_be32(in + 12);
+    size_t buffer_length = in[6];
+
+    export_tag(tag, in);
+    if (memcmp(tag, in + EXPORT_TAG_OFFSET, SHA256_EXPORT_SIZE - EXPORT_TAG_OFFSET) != 0)
+    {
+        return false;
+    }
+
+    /* A valid tag on a malformed layout means a different writer, not corruption; reject it all the same */
+    if (memcmp(in, "S2CK", 4) != 0 || (in[4] << 8 | in[5]) != EXPORT_VERSION || in[7] != 0 || buffer_length != length % 64 ||
+        (size_t)length != length)
+    {
+        return false;
+    }
+    for (size_t i = buffer_length; i < 64; i++)
+    {
+        if (in[48 + i] != 0)
+        {
+            return false;
+        }
+    }
+
+    context->length = (size_t)length;
+    context->buffer_length = buffer_length;
+    for (int i = 0; i < 8; i++)
+    {
+        context->state[i] = read_be32(in + 16 + 4 * i);
+    }
+    memcpy(context->buffer, in + 48, buffer_length);
+    return true;
+}
+
+/* W+K of the block that pads a 64-byte message: 0x80, zeros, 512 bits. Generated offline from CONSTANTS;
+ * sha256_padding_schedule_agrees recomputes it for the known answer test. */
+static const unsigned int PADDING_64_SCHEDULE[64] = {
+    0xc28a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf374,
+    0x649b69c1, 0xf0fe4786, 0x0fe1edc6, 0x240cf254, 0x4fe9346f, 0x6cc984be, 0x61b9411e, 0x16f988fa,
+    0xf2c65152, 0xa88e5a6d, 0xb019fc65, 0xb9d99ec7, 0x9a1231c3, 0xe70eeaa0, 0xfdb1232b, 0xc7353eb0,
+    0x3069bad5, 0xcb976d5f, 0x5a0f118f, 0xdc1eeefd, 0x0a35b689, 0xde0b7a04, 0x58f4ca9d, 0xe15d5b16,
+    0x007f3e86, 0x37088980, 0xa507ea32, 0x6fab9537, 0x17406110, 0x0d8cd6f1, 0xcdaa3b6d, 0xc0bbbe37,
+    0x83613bda, 0xdb48a363, 0x0b02e931, 0x6fd15ca7, 0x521afaca, 0x31338431, 0x6ed41a95, 0x6d437890,
+    0xc39c91f2, 0x9eccabbd, 0xb5c9a0e6, 0x532fb63c, 0xd2c741c6, 0x07237ea3, 0xa4954b68, 0x4c191d76,
+};
+
+bool sha256_padding_schedule_agrees()
+{
+    unsigned int w[64] = {0x80000000, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 512};
+
+    for (int i = 16; i < 64; i++)
+    {
+        w[i] = sig1(w[i - 2]) + w[i - 7] + sig0(w[i - 15]) + w[i - 16];
+    }
+    for (int i = 0; i < 64; i++)
+    {
+        if (w[i] + CONSTANTS[i] != PADDING_64_SCHEDULE[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void sha256_32(unsigned char digest[32], const unsigned char input[32])
+{
+    unsigned int state[8];
+    unsigned int words[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0x80000000, 0, 0, 0, 0, 0, 0, 256};
+
+    for (int i = 0; i < 8; i++)
+    {
+        words[i] = load_be32(input + 4 * i);
+    }
+
+    memcpy(state, INITIAL_STATE, sizeof(state));
+    run_words(state, words);
+    store_digest(digest, state);
+}
+
+void sha256_64(unsigned char digest[32], const unsigned char input[64])
+{
+    unsigned int state[8];
+
+    memcpy(state, INITIAL_STATE, sizeof(state));
+    run_blocks(state, input, 1);
+    run_schedule(state, PADDING_64_SCHEDULE);
+    store_digest(digest, state);
+}
+
+void sha256_midstate(unsigned int midstate[8], const unsigned char block[64])
+{
+    memcpy(midstate, INITIAL_STATE, sizeof(INITIAL_STATE));
+    run_blocks(midstate, block, 1);
+}
+
+/* Second block of an 80-byte message: 16 tail bytes, 0x80, zeros, 640 bits */
+static void process_80_tail(unsigned int state[8], const unsigned char tail[16])
+{
+    unsigned int words[16] = {0, 0, 0, 0, 0x80000000, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 640};
+
+    for (int i = 0; i < 4; i++)
+    {
+        words[i] = load_be32(tail + 4 * i);
+    }
+    run_words(state, words);
+}
+
+/* The second SHA-256 of SHA256d reads the first digest as words straight from its state */
+static void sha256d_second(unsigned char digest[32], const unsigned int first[8])
+{
+    unsigned int state[8];
+    unsigned int words[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0x80000000, 0, 0, 0, 0, 0, 0, 256};
+
+    memcpy(words, first, 8 * sizeof(unsigned int));
+    memcpy(state, INITIAL_STATE, sizeof(state));
+    run_words(state, words);
+    store_digest(digest, state);
+}
+
+void sha256_80_midstate(unsigned char digest[32], const unsigned int midstate[8], const unsigned char tail[16])
+{
+    unsigned int state[8];
+
+    memcpy(state, midstate, sizeof(state));
+    process_80_tail(state, tail);
+    store_digest(digest, state);
+}
+
+void sha256_80(unsigned char digest[32], const unsigned char input[80])
+{
+    unsigned int midstate[8];
+
+    sha256_midstate(midstate, input);
+    sha256_80_midstate(digest, midstate, input + 64);
+}
+
+void sha256d_80_midstate(unsigned char digest[32], const unsigned int midstate[8], const unsigned char tail[16])
+{
+    unsigned int state[8];
+
+    memcpy(state, midstate, sizeof(state));
+    process_80_tail(state, tail);
+    sha256d_second(digest, state);
+}
+
+void sha256d_80(unsigned char digest[32], const unsigned char input[80])
+{
+    unsigned int midstate[8];
+
+    sha256_midstate(midstate, input);
+    sha256d_80_midstate(digest, midstate, input + 64);
+}
@@ -0,0 +1,82 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(_WIN32)
+struct iovec
+{
+    void *iov_base;
+    size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct SHA256
+{
+    size_t length;
+    size_t buffer_length;
+    unsigned char buffer[64];
+    unsigned int state[8];
+};
+
+void sha256_init(struct SHA256 *context);
+void sha256_update(struct SHA256 *context, const unsigned char *input, size_t length);
+void sha256_complete(unsigned char digest[32], struct SHA256 *context);
+
+/* sha256_update that also copies input to destination, reading each byte once. The ranges must not
+ * overlap. Copies of 1 MiB and more bypass the caches when whole blocks land 16-byte aligned in
+ * destination, as they do for an aligned destination and a context without buffered bytes. */
+void sha256_update_copy(struct SHA256 *context, unsigned char *destination, const unsigned char *input, size_t length);
+
+/* sha256_update over a chain of fragments: only bytes of blocks that straddle fragments are copied */
+void sha256_updatev(struct SHA256 *context, const struct iovec *iov, int iovcnt);
+
+/* Portable snapshot of a context: versioned, big-endian, with a truncated SHA-256 of the rest as a
+ * corruption check (not an authenticator). Import fails on a bad tag or an inconsistent layout. */
+#define SHA256_EXPORT_SIZE 128
+void sha256_export(unsigned char out[SHA256_EXPORT_SIZE], const struct SHA256 *context);
+bool sha256_import(struct SHA256 *context, const unsigned char in[SHA256_EXPORT_SIZE]);
+
+/* One-shot hashes of fixed-size inputs that skip the context buffering and pad with precomputed words */
+void sha256_32(unsigned char digest[32], const unsigned char input[32]);
+void sha256_64(unsigned char digest[32], const unsigned char input[64]);
+void sha256_80(unsigned char digest[32], const unsigned char input[80]);
+void sha256d_80(unsigned char digest[32], const unsigned char input[80]);
+
+/* State after the first 64 bytes, reusable when only the last 16 bytes of an 80-byte input change */
+void sha256_midstate(unsigned int midstate[8], const unsigned char block[64]);
+void sha256_80_midstate(unsigned char digest[32], const unsigned int midstate[8], const unsigned char tail[16]);
+void sha256d_80_midstate(unsigned char digest[32], const unsigned int midstate[8], const unsigned char tail[16]);
+
+/* Hashes count independent messages of the same length, several at a time across SIMD lanes */
+void sha256_hash_many(const unsigned char *const *messages, size_t length, size_t count, unsigned char (*digests)[32]);
+
+/* Like sha256_hash_many for messages of different lengths: a lane takes the next message as soon as its own is done */
+void sha256_hash_many_lengths(const unsigned char *const *messages, const size_t *lengths, size_t count, unsigned char (*digests)[32]);
+
+/* sha256_64 over count contiguous 64-byte inputs, batched like sha256_hash_many */
+void sha256_64_many(unsigned char (*digests)[32], const unsigned char (*inputs)[64], size_t count);
+
+/* Name of the selected single-stream backend; SHA256_BACKEND or sha256_set_backend() override it */
+const char *sha256_backend();
+bool sha256_set_backend(const char *name);
+/* Backends usable on this cpu in preference order, NULL past the last one */
+const char *sha256_supported_backend(size_t index);
+
+/* Name of the selected multi-lane backend; SHA256_BATCH_BACKEND or sha256_set_batch_backend() override it */
+const char *sha256_batch_backend();
+bool sha256_set_batch_backend(const char *name);
+const char *sha256_supported_batch_backend(size_t index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
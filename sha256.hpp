@@ -0,0 +1,247 @@
+#ifndef SHA256_HPP
+#define SHA256_HPP
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+#include <type_traits>
+
+#include "sha256.h"
+#include "sha256_primitives.h"
+
+/* SHA-256 usable in constant expressions. The context is the C struct SHA256, so during constant
+ * evaluation the rounds run in portable constexpr code and at runtime the same calls go to the
+ * dispatched kernels of sha256.c. Digests of literals cost nothing at runtime. */
+
+#if defined(__cpp_lib_is_constant_evaluated)
+#define SHA256_IS_CONSTANT_EVALUATED() std::is_constant_evaluated()
+#elif defined(__GNUC__) || defined(__clang__) || (defined(_MSC_VER) && _MSC_VER >= 1925)
+#define SHA256_IS_CONSTANT_EVALUATED() __builtin_is_constant_evaluated()
+#else
+/* Without a way to tell, runtime calls take the constexpr path too: correct, only slower */
+#define SHA256_IS_CONSTANT_EVALUATED() true
+#endif
+
+#if defined(__cpp_consteval)
+#define SHA256_CONSTEVAL consteval
+#else
+#define SHA256_CONSTEVAL constexpr
+#endif
+
+namespace sha256 {
+
+using digest = std::array<unsigned char, 32>;
+
+namespace detail {
+
+constexpr void process_block(unsigned int state[8], const unsigned char block[64])
+{
+    using namespace sha256_primitives;
+    unsigned int w[64] = {};
+
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = (unsigned int)block[4 * i] << 24 | (unsigned int)block[4 * i + 1] << 16 | (unsigned int)block[4 * i + 2] << 8 |
+               (unsigned int)block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++)
+    {
+        w[i] = sig1(w[i - 2]) + w[i - 7] + sig0(w[i - 15]) + w[i - 16];
+    }
+
+    unsigned int a = state[0], b = state[1], c = state[2], d = state[3];
+    unsigned int e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (int i = 0; i < 64; i++)
+    {
+        unsigned int t1 = h + SIG1(e) + CH(e, f, g) + CONSTANTS[i] + w[i];
+        unsigned int t2 = SIG0(a) + MAJ(a, b, c);
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+constexpr int hex_value(char c)
+{
+    return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+}
+
+} // namespace detail
+
+class hasher
+{
+public:
+    constexpr hasher() : context_{0, 0, {}, {}}
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            context_.state[i] = sha256_primitives::INITIAL_STATE[i];
+        }
+    }
+
+    constexpr hasher &update(const unsigned char *data, std::size_t length)
+    {
+        if (!SHA256_IS_CONSTANT_EVALUATED())
+        {
+            sha256_update(&context_, data, length);
+            return *this;
+        }
+
+        context_.length += length;
+        for (std::size_t i = 0; i < length; i++)
+        {
+            context_.buffer[context_.buffer_length++] = data[i];
+            if (context_.buffer_length == 64)
+            {
+                detail::process_block(context_.state, context_.buffer);
+                context_.buffer_length = 0;
+            }
+        }
+        return *this;
+    }
+
+    constexpr hasher &update(std::string_view data)
+    {
+        if (!SHA256_IS_CONSTANT_EVALUATED())
+        {
+            sha256_update(&context_, reinterpret_cast<const unsigned char *>(data.data()), data.size());
+            return *this;
+        }
+
+        /* Constant evaluation cannot reinterpret chars as bytes, so they go through one at a time */
+        for (char c : data)
+        {
+            const unsigned char byte = static_cast<unsigned char>(c);
+            update(&byte, 1);
+        }
+        return *this;
+    }
+
+    template <std::size_t N>
+    constexpr hasher &update(const std::array<unsigned char, N> &data)
+    {
+        return update(data.data(), N);
+    }
+
+    constexpr digest complete()
+    {
+        digest result = {};
+
+        if (!SHA256_IS_CONSTANT_EVALUATED())
+        {
+            sha256_complete(result.data(), &context_);
+            return result;
+        }
+
+        unsigned long long bits = (unsigned long long)context_.length * 8;
+        context_.buffer[context_.buffer_length++] = 0x80;
+        if (context_.buffer_length > 56)
+        {
+            while (context_.buffer_length < 64)
+            {
+                context_.buffer[context_.buffer_length++] = 0;
+            }
+            detail::process_block(context_.state, context_.buffer);
+            context_.buffer_length = 0;
+        }
+        while (context_.buffer_length < 56)
+        {
+            context_.buffer[context_.buffer_length++] = 0;
+        }
+        for (int i = 0; i < 8; i++)
+        {
+            context_.buffer[56 + i] = (unsigned char)(bits >> (56 - 8 * i));
+        }
+        detail::process_block(context_.state, context_.buffer);
+        context_.buffer_length = 0;
+
+        for (int i = 0; i < 32; i++)
+        {
+            result[i] = (unsigned char)(context_.state[i / 4] >> (24 - 8 * (i % 4)));
+        }
+        return result;
+    }
+
+private:
+    struct SHA256 context_;
+};
+
+constexpr digest hash(std::string_view data)
+{
+    return hasher().update(data).complete();
+}
+
+constexpr digest hash(const unsigned char *data, std::size_t length)
+{
+    return hasher().update(data, length).complete();
+}
+
+template <std::size_t N>
+constexpr digest hash(const std::array<unsigned char, N> &data)
+{
+    return hasher().update(data).complete();
+}
+
+/* std::array comparison is only constexpr from C++20 on */
+constexpr bool equal(const digest &a, const digest &b)
+{
+    for (std::size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i] != b[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* 64 hex digits to a digest; anything else yields all zeroes */
+constexpr digest from_hex(std::string_view hex)
+{
+    digest result = {};
+
+    if (hex.size() != 64)
+    {
+        return result;
+    }
+    for (std::size_t i = 0; i < 32; i++)
+    {
+        int high = detail::hex_value(hex[2 * i]);
+        int low = detail::hex_value(hex[2 * i + 1]);
+        if (high < 0 || low < 0)
+        {
+            return digest{};
+        }
+        result[i] = (unsigned char)(high << 4 | low);
+    }
+    return result;
+}
+
+namespace literals {
+
+/* "config-v3"_sha256 is always computed by the compiler */
+SHA256_CONSTEVAL digest operator""_sha256(const char *data, std::size_t length)
+{
+    return hash(std::string_view(data, length));
+}
+
+} // namespace literals
+
+} // namespace sha256
+
+#endif
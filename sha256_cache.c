@@ -0,0 +1,658 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sha256_cache.h"
+
+#define CACHE_MAGIC "S2DC"
+#define CACHE_VERSION 1
+#define INITIAL_CAPACITY (64 * 1024)
+/* Inserts stop at this load so probe runs stay short; compaction then makes room */
+#define MAX_LOAD_PERCENT 75
+/* A write this soon after the last one may not move coarse timestamps, so such keys are not trusted */
+#define SETTLE_NS 2000000000LL
+
+enum slot_state
+{
+    SLOT_EMPTY,
+    SLOT_WRITING,
+    SLOT_LIVE,
+    /* Replaced or damaged; skipped by lookups and dropped by compaction, never reused */
+    SLOT_DEAD,
+};
+
+enum table_state
+{
+    TABLE_ACTIVE,
+    /* A compaction is copying the table; inserts wait so none is lost */
+    TABLE_FROZEN,
+    /* Replaced by a compacted file at the same path */
+    TABLE_RETIRED,
+};
+
+struct cache_header
+{
+    char magic[4];
+    unsigned int version;
+    unsigned long long capacity;
+    /* Slots ever claimed, live or not */
+    atomic_ullong used;
+    atomic_uint state;
+    unsigned char reserved[36];
+};
+
+struct cache_slot
+{
+    atomic_uint state;
+    /* Catches entries torn by a crash before the kernel wrote back the whole slot */
+    unsigned int check;
+    struct sha256_cache_key key;
+    unsigned char digest[32];
+};
+
+struct cache_mapping
+{
+    struct cache_mapping *previous;
+    int fd;
+    size_t size;
+    struct cache_header *header;
+    struct cache_slot *slots;
+};
+
+struct sha256_cache
+{
+    char *path;
+    /* Read without locking; mappings replaced after a compaction stay mapped until close */
+    _Atomic(struct cache_mapping *) current;
+    pthread_mutex_t mutex;
+};
+
+static unsigned long long mix(unsigned long long x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ x >> 31;
+}
+
+static unsigned long long key_hash(const struct sha256_cache_key *key)
+{
+    unsigned long long h = mix(key->device ^ mix(key->inode));
+    h = mix(h ^ key->size);
+    h = mix(h ^ (unsigned long long)key->mtime_ns);
+    return mix(h ^ (unsigned long long)key->ctime_ns);
+}
+
+static unsigned int slot_check(const struct sha256_cache_key *key, const unsigned char digest[32])
+{
+    unsigned long long h = key_hash(key);
+    for (int i = 0; i < 4; i++)
+    {
+        unsigned long long word;
+        memcpy(&word, digest + 8 * i, 8);
+        h = mix(h ^ word);
+    }
+    return (unsigned int)(h >> 32);
+}
+
+static bool same_key(const struct sha256_cache_key *a, const struct sha256_cache_key *b)
+{
+    return a->inode == b->inode && a->device == b->device && a->size == b->size && a->mtime_ns == b->mtime_ns &&
+           a->ctime_ns == b->ctime_ns;
+}
+
+static size_t file_size(unsigned long long capacity)
+{
+    return sizeof(struct cache_header) + capacity * sizeof(struct cache_slot);
+}
+
+/* Zeroed slots are empty, so a new table is a header and a hole */
+static bool initialize_file(int fd, unsigned long long capacity)
+{
+    struct cache_header header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, 4);
+    header.version = CACHE_VERSION;
+    header.capacity = capacity;
+    return ftruncate(fd, file_size(capacity)) == 0 && pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+}
+
+static struct cache_mapping *map_file(int fd)
+{
+    struct cache_mapping *mapping;
+    struct stat status;
+
+    if (fstat(fd, &status) != 0)
+    {
+        return NULL;
+    }
+    if ((size_t)status.st_size < sizeof(struct cache_header))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    mapping = calloc(1, sizeof(*mapping));
+    if (mapping == NULL)
+    {
+        return NULL;
+    }
+    mapping->fd = fd;
+    mapping->size = status.st_size;
+    mapping->header = mmap(NULL, mapping->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping->header == MAP_FAILED)
+    {
+        free(mapping);
+        return NULL;
+    }
+
+    /* A capacity whose size wraps around could match a small file and send probes outside it */
+    unsigned long long capacity = mapping->header->capacity;
+    if (memcmp(mapping->header->magic, CACHE_MAGIC, 4) != 0 || mapping->header->version != CACHE_VERSION || capacity == 0 ||
+        (capacity & (capacity - 1)) != 0 || capacity > (SIZE_MAX - sizeof(struct cache_header)) / sizeof(struct cache_slot) ||
+        file_size(capacity) != mapping->size)
+    {
+        munmap(mapping->header, mapping->size);
+        free(mapping);
+        errno = EINVAL;
+        return NULL;
+    }
+    mapping->slots = (struct cache_slot *)(mapping->header + 1);
+    return mapping;
+}
+
+static void unmap_file(struct cache_mapping *mapping)
+{
+    munmap(mapping->header, mapping->size);
+    close(mapping->fd);
+    free(mapping);
+}
+
+/* Creation happens under the file lock, so two processes starting on a missing cache agree on one table */
+static struct cache_mapping *open_file(const char *path)
+{
+    struct cache_mapping *mapping = NULL;
+    struct stat status;
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    int error = 0;
+
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    if (flock(fd, LOCK_EX) != 0 || fstat(fd, &status) != 0 || (status.st_size == 0 && !initialize_file(fd, INITIAL_CAPACITY)))
+    {
+        error = errno;
+    }
+    flock(fd, LOCK_UN);
+
+    if (error == 0)
+    {
+        mapping = map_file(fd);
+        error = errno;
+    }
+    if (mapping == NULL)
+    {
+        close(fd);
+        errno = error;
+    }
+    return mapping;
+}
+
+/* Follows a compaction done by anyone, this process or another, by mapping the file now at the path */
+static struct cache_mapping *current_mapping(struct sha256_cache *cache)
+{
+    struct cache_mapping *mapping = atomic_load_explicit(&cache->current, memory_order_acquire);
+
+    if (atomic_load_explicit(&mapping->header->state, memory_order_acquire) != TABLE_RETIRED)
+    {
+        return mapping;
+    }
+
+    pthread_mutex_lock(&cache->mutex);
+    if (atomic_load(&cache->current) == mapping)
+    {
+        struct cache_mapping *replacement = open_file(cache->path);
+        if (replacement != NULL)
+        {
+            replacement->previous = mapping;
+            atomic_store_explicit(&cache->current, replacement, memory_order_release);
+        }
+    }
+    mapping = atomic_load(&cache->current);
+    pthread_mutex_unlock(&cache->mutex);
+    return mapping;
+}
+
+/* Blocks on the lock held by a running compaction. A table left frozen by a compaction that died is
+ * thawed, which is safe once its lock is free. */
+static void wait_for_compaction(struct sha256_cache *cache, struct cache_mapping *mapping)
+{
+    struct stat ours, theirs;
+    int fd = open(cache->path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        return;
+    }
+    if (flock(fd, LOCK_EX) == 0)
+    {
+        unsigned int frozen = TABLE_FROZEN;
+        if (fstat(fd, &theirs) == 0 && fstat(mapping->fd, &ours) == 0 && theirs.st_ino == ours.st_ino && theirs.st_dev == ours.st_dev)
+        {
+            atomic_compare_exchange_strong(&mapping->header->state, &frozen, TABLE_ACTIVE);
+        }
+        flock(fd, LOCK_UN);
+    }
+    close(fd);
+}
+
+static enum sha256_cache_status insert_slot(struct cache_mapping *mapping, const struct sha256_cache_key *key,
+                                            const unsigned char digest[32])
+{
+    unsigned long long mask = mapping->header->capacity - 1;
+    unsigned long long index = key_hash(key);
+    unsigned int check = slot_check(key, digest);
+    bool replaced = false;
+
+    for (unsigned long long probe = 0; probe <= mask; probe++)
+    {
+        struct cache_slot *slot = &mapping->slots[(index + probe) & mask];
+        unsigned int state = atomic_load_explicit(&slot->state, memory_order_acquire);
+
+        if (state == SLOT_EMPTY)
+        {
+            if (atomic_compare_exchange_strong(&slot->state, &state, SLOT_WRITING))
+            {
+                atomic_fetch_add(&mapping->header->used, 1);
+                slot->key = *key;
+                memcpy(slot->digest, digest, 32);
+                slot->check = check;
+                atomic_store_explicit(&slot->state, SLOT_LIVE, memory_order_release);
+                return replaced ? SHA256_CACHE_STALE : SHA256_CACHE_MISS;
+            }
+            /* Lost the slot to another writer; state now says what it holds */
+        }
+
+        if (state == SLOT_LIVE && same_key(&slot->key, key))
+        {
+            if (slot->check == check && memcmp(slot->digest, digest, 32) == 0)
+            {
+                return SHA256_CACHE_HIT;
+            }
+            /* A torn slot is not a stale digest, only garbage to replace */
+            replaced |= slot->check == slot_check(&slot->key, slot->digest);
+            atomic_compare_exchange_strong(&slot->state, &state, SLOT_DEAD);
+        }
+    }
+    errno = ENOSPC;
+    return SHA256_CACHE_OFF;
+}
+
+void sha256_cache_key(struct sha256_cache_key *key, const struct stat *status)
+{
+    key->device = status->st_dev;
+    key->inode = status->st_ino;
+    key->size = status->st_size;
+    key->mtime_ns = status->st_mtim.tv_sec * 1000000000LL + status->st_mtim.tv_nsec;
+    key->ctime_ns = status->st_ctim.tv_sec * 1000000000LL + status->st_ctim.tv_nsec;
+}
+
+bool sha256_cache_open(struct sha256_cache **cache, const char *path)
+{
+    struct sha256_cache *opened = calloc(1, sizeof(*opened));
+    struct cache_mapping *mapping;
+
+    if (opened == NULL)
+    {
+        return false;
+    }
+    opened->path = strdup(path);
+    mapping = opened->path != NULL ? open_file(path) : NULL;
+    if (mapping == NULL)
+    {
+        int error = errno;
+        free(opened->path);
+        free(opened);
+        errno = error;
+        return false;
+    }
+
+    atomic_init(&opened->current, mapping);
+    pthread_mutex_init(&opened->mutex, NULL);
+    *cache = opened;
+    return true;
+}
+
+void sha256_cache_close(struct sha256_cache *cache)
+{
+    struct cache_mapping *mapping;
+
+    if (cache == NULL)
+    {
+        return;
+    }
+    mapping = atomic_load(&cache->current);
+    while (mapping != NULL)
+    {
+        struct cache_mapping *previous = mapping->previous;
+        unmap_file(mapping);
+        mapping = previous;
+    }
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache->path);
+    free(cache);
+}
+
+bool sha256_cache_lookup(struct sha256_cache *cache, const struct sha256_cache_key *key, unsigned char digest[32])
+{
+    struct cache_mapping *mapping = current_mapping(cache);
+    unsigned long long mask = mapping->header->capacity - 1;
+    unsigned long long index = key_hash(key);
+
+    for (unsigned long long probe = 0; probe <= mask; probe++)
+    {
+        const struct cache_slot *slot = &mapping->slots[(index + probe) & mask];
+        unsigned int state = atomic_load_explicit(&slot->state, memory_order_acquire);
+
+        if (state == SLOT_EMPTY)
+        {
+            return false;
+        }
+        /* Published slots never change again except to die, so plain reads cannot tear */
+        if (state == SLOT_LIVE && same_key(&slot->key, key) && slot->check == slot_check(key, slot->digest))
+        {
+            memcpy(digest, slot->digest, 32);
+            return true;
+        }
+    }
+    return false;
+}
+
+enum sha256_cache_status sha256_cache_insert(struct sha256_cache *cache, const struct sha256_cache_key *key,
+                                             const unsigned char digest[32])
+{
+    enum sha256_cache_status result = SHA256_CACHE_OFF;
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    long long now_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+    if (key->mtime_ns > now_ns - SETTLE_NS || key->ctime_ns > now_ns - SETTLE_NS)
+    {
+        errno = EAGAIN;
+        return SHA256_CACHE_OFF;
+    }
+
+    /* Gives up after a few rounds of other processes compacting under us; it is only a cache */
+    for (int attempt = 0; attempt < 8; attempt++)
+    {
+        struct cache_mapping *mapping = current_mapping(cache);
+        unsigned int state = atomic_load(&mapping->header->state);
+
+        if (state == TABLE_FROZEN)
+        {
+            wait_for_compaction(cache, mapping);
+            continue;
+        }
+        if (state == TABLE_RETIRED)
+        {
+            continue;
+        }
+        if (atomic_load(&mapping->header->used) * 100 >= mapping->header->capacity * MAX_LOAD_PERCENT)
+        {
+            if (!sha256_cache_compact(cache))
+            {
+                return SHA256_CACHE_OFF;
+            }
+            continue;
+        }
+
+        enum sha256_cache_status inserted = insert_slot(mapping, key, digest);
+        if (inserted == SHA256_CACHE_OFF)
+        {
+            return result;
+        }
+        if (result == SHA256_CACHE_OFF)
+        {
+            result = inserted;
+        }
+
+        /* Pairs with the fence after the freeze in sha256_cache_compact: a release store followed by a
+         * load may be reordered, the fences may not, so either the copy saw this slot, or this sees the
+         * freeze and writes the entry again into the compacted table */
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load(&mapping->header->state) == TABLE_ACTIVE)
+        {
+            return result;
+        }
+    }
+    return result;
+}
+
+enum sha256_cache_status sha256_cache_record(struct sha256_cache *cache, const char *path, const struct sha256_cache_key *before,
+                                             const unsigned char digest[32], bool verify)
+{
+    struct sha256_cache_key after;
+    struct stat status;
+
+    if (stat(path, &status) != 0)
+    {
+        return SHA256_CACHE_OFF;
+    }
+    sha256_cache_key(&after, &status);
+    if (!same_key(before, &after))
+    {
+        return SHA256_CACHE_OFF;
+    }
+
+    enum sha256_cache_status result = sha256_cache_insert(cache, &after, digest);
+    if (result == SHA256_CACHE_HIT)
+    {
+        /* Without verify the entry appeared from a concurrent writer since the lookup */
+        result = verify ? SHA256_CACHE_VERIFIED : SHA256_CACHE_MISS;
+    }
+    return result;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const struct cache_slot *x = a, *y = b;
+
+    if (x->key.device != y->key.device)
+    {
+        return x->key.device < y->key.device ? -1 : 1;
+    }
+    if (x->key.inode != y->key.inode)
+    {
+        return x->key.inode < y->key.inode ? -1 : 1;
+    }
+    /* Newest version of each inode first */
+    if (x->key.ctime_ns != y->key.ctime_ns)
+    {
+        return x->key.ctime_ns > y->key.ctime_ns ? -1 : 1;
+    }
+    return x->key.mtime_ns > y->key.mtime_ns ? -1 : x->key.mtime_ns < y->key.mtime_ns;
+}
+
+/* Live entries of the frozen table, one per inode, into a new file at the temporary path */
+static bool write_compacted(struct cache_mapping *mapping, int fd)
+{
+    unsigned long long capacity = mapping->header->capacity;
+    unsigned long long live = 0;
+    struct cache_slot *entries = malloc(capacity * sizeof(*entries));
+
+    if (entries == NULL)
+    {
+        return false;
+    }
+    for (unsigned long long i = 0; i < capacity; i++)
+    {
+        const struct cache_slot *slot = &mapping->slots[i];
+        if (atomic_load_explicit(&slot->state, memory_order_acquire) == SLOT_LIVE && slot->check == slot_check(&slot->key, slot->digest))
+        {
+            entries[live].key = slot->key;
+            memcpy(entries[live++].digest, slot->digest, 32);
+        }
+    }
+    qsort(entries, live, sizeof(*entries), compare_entries);
+
+    unsigned long long kept = 0;
+    for (unsigned long long i = 0; i < live; i++)
+    {
+        if (kept == 0 || entries[i].key.inode != entries[kept - 1].key.inode || entries[i].key.device != entries[kept - 1].key.device)
+        {
+            entries[kept++] = entries[i];
+        }
+    }
+
+    /* At most half full afterwards, so a table that is mostly live doubles */
+    unsigned long long new_capacity = INITIAL_CAPACITY;
+    while (new_capacity < kept * 2)
+    {
+        new_capacity *= 2;
+    }
+
+    struct cache_mapping *compacted = NULL;
+    bool ok = initialize_file(fd, new_capacity) && (compacted = map_file(fd)) != NULL;
+    for (unsigned long long i = 0; ok && i < kept; i++)
+    {
+        ok = insert_slot(compacted, &entries[i].key, entries[i].digest) != SHA256_CACHE_OFF;
+    }
+    if (compacted != NULL)
+    {
+        munmap(compacted->header, compacted->size);
+        free(compacted);
+    }
+    free(entries);
+    return ok && fsync(fd) == 0;
+}
+
+bool sha256_cache_compact(struct sha256_cache *cache)
+{
+    struct cache_mapping *mapping = current_mapping(cache);
+    struct stat ours, theirs;
+    bool ok = false;
+    int error = 0;
+
+    /* The lock goes on a descriptor of its own, so threads of one process exclude each other too */
+    int lock = open(cache->path, O_RDONLY | O_CLOEXEC);
+    if (lock < 0)
+    {
+        return false;
+    }
+    if (flock(lock, LOCK_EX) != 0)
+    {
+        error = errno;
+        close(lock);
+        errno = error;
+        return false;
+    }
+
+    /* Someone else already compacted the table this handle was looking at */
+    if (fstat(lock, &theirs) != 0 || fstat(mapping->fd, &ours) != 0 || theirs.st_ino != ours.st_ino ||
+        theirs.st_dev != ours.st_dev || atomic_load(&mapping->header->state) == TABLE_RETIRED)
+    {
+        flock(lock, LOCK_UN);
+        close(lock);
+        current_mapping(cache);
+        return true;
+    }
+
+    size_t length = strlen(cache->path);
+    char *temporary = malloc(length + 8);
+    int fd = -1;
+    if (temporary != NULL)
+    {
+        memcpy(temporary, cache->path, length);
+        memcpy(temporary + length, ".XXXXXX", 8);
+        fd = mkostemp(temporary, O_CLOEXEC);
+    }
+
+    if (fd >= 0)
+    {
+        atomic_store(&mapping->header->state, TABLE_FROZEN);
+        atomic_thread_fence(memory_order_seq_cst);
+        ok = write_compacted(mapping, fd) && fchmod(fd, ours.st_mode & 0777) == 0 && rename(temporary, cache->path) == 0;
+        error = errno;
+        if (!ok)
+        {
+            unlink(temporary);
+        }
+        atomic_store(&mapping->header->state, ok ? TABLE_RETIRED : TABLE_ACTIVE);
+        close(fd);
+    }
+    else
+    {
+        error = temporary != NULL ? errno : ENOMEM;
+    }
+    free(temporary);
+    flock(lock, LOCK_UN);
+    close(lock);
+
+    if (ok)
+    {
+        current_mapping(cache);
+    }
+    errno = error;
+    return ok;
+}
+
+bool sha256_cache_file(struct sha256_cache *cache, unsigned char digest[32], const char *path, bool verify,
+                       const struct sha256_file_options *options, struct sha256_file_stats *stats, enum sha256_cache_status *status)
+{
+    enum sha256_cache_status result = SHA256_CACHE_OFF;
+    struct sha256_file_stats unused;
+    struct sha256_cache_key key;
+    struct stat info;
+    bool cached = cache != NULL && strcmp(path, "-") != 0 && stat(path, &info) == 0 && S_ISREG(info.st_mode);
+
+    if (stats == NULL)
+    {
+        stats = &unused;
+    }
+
+    if (cached)
+    {
+        sha256_cache_key(&key, &info);
+        if (!verify && sha256_cache_lookup(cache, &key, digest))
+        {
+            memset(stats, 0, sizeof(*stats));
+            stats->bytes = key.size;
+            result = SHA256_CACHE_HIT;
+        }
+    }
+
+    if (result != SHA256_CACHE_HIT)
+    {
+        if (!sha256_file(digest, path, options, stats))
+        {
+            return false;
+        }
+        if (cached)
+        {
+            result = sha256_cache_record(cache, path, &key, digest, verify);
+        }
+    }
+
+    if (status != NULL)
+    {
+        *status = result;
+    }
+    return true;
+}
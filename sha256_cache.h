@@ -0,0 +1,74 @@
+#ifndef SHA256_CACHE_H
+#define SHA256_CACHE_H
+
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#include "sha256_file.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Persistent digests of files that have not changed since they were last hashed. The cache file is an
+ * open-addressed table mapped into every process that uses it: lookups take no locks, inserts only ever
+ * append, and compaction writes a new table and renames it into place while others keep running.
+ * The file is in host byte order and only meaningful on the machine (and filesystems) that wrote it. */
+struct sha256_cache;
+
+/* Identifies one version of one file without reading it; any write moves mtime or ctime */
+struct sha256_cache_key
+{
+    unsigned long long device;
+    unsigned long long inode;
+    unsigned long long size;
+    long long mtime_ns;
+    long long ctime_ns;
+};
+
+enum sha256_cache_status
+{
+    /* No cache, or the file cannot be cached: stdin, pipes, or a file that changed while it was read */
+    SHA256_CACHE_OFF,
+    SHA256_CACHE_MISS,
+    SHA256_CACHE_HIT,
+    /* A hit picked for verification that was hashed again and matched */
+    SHA256_CACHE_VERIFIED,
+    /* A hit picked for verification whose recorded digest was wrong; the fresh one replaced it */
+    SHA256_CACHE_STALE,
+};
+
+void sha256_cache_key(struct sha256_cache_key *key, const struct stat *status);
+
+/* Opens the cache file at path, creating it when missing. One handle may be shared by any number of
+ * threads, and any number of processes may open the same file. Returns false with errno set, EINVAL
+ * for a file that is not a cache. */
+bool sha256_cache_open(struct sha256_cache **cache, const char *path);
+void sha256_cache_close(struct sha256_cache *cache);
+
+bool sha256_cache_lookup(struct sha256_cache *cache, const struct sha256_cache_key *key, unsigned char digest[32]);
+
+/* Records digest for key: SHA256_CACHE_MISS for a new entry, SHA256_CACHE_HIT when it was already
+ * there, SHA256_CACHE_STALE when a different digest was and got replaced. Returns SHA256_CACHE_OFF
+ * with errno set when nothing was recorded, EAGAIN for timestamps too recent to trust. */
+enum sha256_cache_status sha256_cache_insert(struct sha256_cache *cache, const struct sha256_cache_key *key,
+                                             const unsigned char digest[32]);
+
+/* Records a digest read from path if the file still matches before, the key taken before reading it */
+enum sha256_cache_status sha256_cache_record(struct sha256_cache *cache, const char *path, const struct sha256_cache_key *before,
+                                             const unsigned char digest[32], bool verify);
+
+/* Rewrites the table without replaced entries and older versions of the same inode, sized for what
+ * is left. Inserts wait for it; lookups do not. */
+bool sha256_cache_compact(struct sha256_cache *cache);
+
+/* sha256_file through the cache: a hit skips reading the file, a miss is hashed and recorded. With
+ * verify a hit is hashed anyway and checked. On a hit stats only has bytes. status may be NULL. */
+bool sha256_cache_file(struct sha256_cache *cache, unsigned char digest[32], const char *path, bool verify,
+                       const struct sha256_file_options *options, struct sha256_file_stats *stats, enum sha256_cache_status *status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,340 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sha256_cdc.h"
+#include "sha256_jobs.h"
+
+/* Chunks between two emits; the job manager is flushed with lanes left empty once per batch */
+#define BATCH_CHUNKS 512
+#define LARGEST_CHUNK (1024 * 1024 * 1024)
+
+/* Random 64-bit values per byte, generated offline with splitmix64. Changing them moves every boundary. */
+static const unsigned long long GEAR[256] = {
+    0x35dbde2905cb03a0ULL, 0x5640417f5513f4a5ULL, 0xacdc015d2e0c3924ULL, 0xbe910936e37ef6a3ULL,
+    0x6f58b7114170ce54ULL, 0x9ac846a31cfa3c45ULL, 0xc6e0a0de3dd437d2ULL, 0x18aca13b76c34ea7ULL,
+    0x6550429a98364732ULL, 0xb0105b316a50e2ccULL, 0x2052b404a677ace5ULL, 0x6a823504edbd4457ULL,
+    0xde21d4d3274e22b1ULL, 0x9f755263e3ab8bf2ULL, 0xb4f54b4aeb872d5fULL, 0xc146b30dddae6768ULL,
+    0xdb0ea187596d975cULL, 0x8258730dab069d11ULL, 0xbbdf2925f4605a8cULL, 0x4264d29d0f07df90ULL,
+    0x0586ba35c8bce57aULL, 0xb805551fa4e60b77ULL, 0xb4ae113080a7cf07ULL, 0x5e07fd03cab09b39ULL,
+    0xd05c5b1ed06a4afeULL, 0x96dcd045d6602784ULL, 0x857f6ca6094d616cULL, 0xefddf613f59f6f48ULL,
+    0xac32dec892b5f7beULL, 0x1166297c00dea534ULL, 0x3b9da740db6887a8ULL, 0x8bf5e69152dbd406ULL,
+    0xd8e8b5898d561442ULL, 0x4ff3ee53500bf35bULL, 0x81cb933b18f8765dULL, 0xe9edc4a4e89a8f6cULL,
+    0x579d8cdefc967519ULL, 0xcd735b85fde945b6ULL, 0x76e07af5315474cdULL, 0x4a08814bbb29b0e8ULL,
+    0x53ffbf1911fd7245ULL, 0x2a377bd3f58e6287ULL, 0x64cb4c44e6188d53ULL, 0x6f4989c57d56b6a8ULL,
+    0x8d34e2b09e84264eULL, 0x6bded0d88fae25e6ULL, 0x77efa51b05f8a206ULL, 0x6f651ac7e1ffeb87ULL,
+    0xf3805be9c8aa1dd8ULL, 0xb181e3fb818c6a2bULL, 0x67c365a33166db39ULL, 0xf5ac702039818f12ULL,
+    0x1457388ef495d254ULL, 0x2b7169121b80da27ULL, 0x450e2a5bbe4617c3ULL, 0x036d2dba4c30d110ULL,
+    0xb7882f1933ee01e2ULL, 0x60db73abdad1788aULL, 0x7b8b63498782fec5ULL, 0x6fc26401e725cd3bULL,
+    0x7ea9d003f49af500ULL, 0xe193ada8c4c94357ULL, 0xf6ac1a9c1150d3d5ULL, 0x836f44013968a6cdULL,
+    0x35e6e4366a451c9fULL, 0x60d380c1237e1292ULL, 0x4d26291573793c6dULL, 0x1cf96b710446c403ULL,
+    0xfef00888ceb742dcULL, 0xfcf2e60bc289990aULL, 0x5ec73c2c1fd5e3c6ULL, 0xc9bd1aa4384f529bULL,
+    0x2859d9bf680d311fULL, 0xa6d69037cbbed5d4ULL, 0x5b6f881ae39dc702ULL, 0xbc962533aa1a16a3ULL,
+    0xd4bb85904d90737cULL, 0x20bca434a732509aULL, 0xacaa4edaf09c4074ULL, 0x8c6144df59bae4d2ULL,
+    0x7c42b55cb5201138ULL, 0x03f84efbfad4944fULL, 0x80b9c479e26a2220ULL, 0xa64b5a2bd3b4bcf9ULL,
+    0x4f8a4737c1226347ULL, 0xc3c5ac59480e5a9eULL, 0xfcf06959d41a35f4ULL, 0x8a415db4ab6dd6eeULL,
+    0x6d83059039cf3d15ULL, 0x41dfda004a288953ULL, 0xc8b81b6d07cd0e36ULL, 0xe6aa71e2dc254f47ULL,
+    0x5d7b0062625c9a2dULL, 0x4764cd0a47b66746ULL, 0xa9be62634345ad3eULL, 0x4093e0d879fe1782ULL,
+    0xdf88076bce235130ULL, 0x93de7b880b3b24f5ULL, 0x959911c5478c0501ULL, 0xcb03b573c6424300ULL,
+    0x177d388918d91f64ULL, 0x1df132b987a0a6f4ULL, 0xb9df833f0c45e5bfULL, 0x0ef6d74c89f078a0ULL,
+    0xb6c2e22369646da0ULL, 0x88b8907f3a588bc8ULL, 0x17ea9dbfa9a1e6a2ULL, 0x1b31e10037806303ULL,
+    0x2bbf07ff079fa1b8ULL, 0xfdaf1c7a702239e9ULL, 0xe10610772f348b50ULL, 0x0a1e4d8bcd154ef2ULL,
+    0x0f5d3a93d4e8223eULL, 0x7964b0febd902d25ULL, 0x34fcf975fb4d70eaULL, 0x29e1c85938c991c1ULL,
+    0x1f2344c69a8eb9eaULL, 0x3a6f3ddc0f686d16ULL, 0x87a3a823354b292dULL, 0x3818a4d8f0bc01b5ULL,
+    0xbd06317fe283e2d3ULL, 0xed567b20ad9a9f28ULL, 0x98159ac0ad446033ULL, 0x0a0084652000b110ULL,
+    0x043479e91db65653ULL, 0x9a34be3c2a131331ULL, 0x7a1f6cad117ecf76ULL, 0xdca8636a6af45e10ULL,
+    0x7a7d6aec4c4e8bfcULL, 0xe01a19a8b3e2d647ULL, 0x345aadd4584ba992ULL, 0x91ca43de314e2a30ULL,
+    0xdc8c4d8d5547e352ULL, 0x648952804904d92cULL, 0x272e72b2b9da8f0dULL, 0x649f0522b8e657b9ULL,
+    0x37e73f445958bb90ULL, 0xcb299629797901bbULL, 0xfd37e8da75da3a8fULL, 0x32761af5d9e21b0aULL,
+    0x7bf457ebfdca350dULL, 0x5ede1000ce65615eULL, 0xcc0c690b1dd9ca64ULL, 0x3bfcc700fffe0b0dULL,
+    0xccd6eb460720fda7ULL, 0xed6eea3e1ab1a43fULL, 0xd47f711b211ad363ULL, 0x84042f09bdb05145ULL,
+    0xbc215c17d6a39fd0ULL, 0xef5a9ce87b0d13bbULL, 0xcdf63aaba7bf97a6ULL, 0x796c3aa2c095369dULL,
+    0x51f24e87c0f3208cULL, 0x1d987fa608e56f5fULL, 0x3e0a846e4293db84ULL, 0x1eed28db441ed58aULL,
+    0xac65ebe971323232ULL, 0xc4c3ecdfaf836790ULL, 0xa82031594770114aULL, 0x5f735a3f7c814d7fULL,
+    0x79794b9647f771d4ULL, 0x98e308b71ea0a50aULL, 0xf08675312f9bb5e0ULL, 0x3b5960fad19d1439ULL,
+    0x1e4e8f00db65e1d5ULL, 0xd822496706f5252aULL, 0x4abd88c3315afe72ULL, 0x00798116a2281e0cULL,
+    0xc4778cc1256ba935ULL, 0x8a04e0a2a142db44ULL, 0xd0832858ad44e3d1ULL, 0x2d3fa97e099478beULL,
+    0x45d65a2d9ab5e2c5ULL, 0x485940b4d30f73d9ULL, 0x1311ab33c3a3190bULL, 0x34f3a1c3b63fbe4dULL,
+    0xb8cfcd02af42aa47ULL, 0x0ea85807092649c7ULL, 0x4b75ec67286a77f9ULL, 0xf2c309b8262b958eULL,
+    0x8cf7ab95891adccdULL, 0xcf3ed7bb15e94a59ULL, 0x422fc55c954ea24aULL, 0x51cfffcaec2ea4fcULL,
+    0xe1a915a3fbfdb3f5ULL, 0xaf6d970eb2c29830ULL, 0xb7180cf9878683e0ULL, 0x323fad91cf10ea21ULL,
+    0xfd8e636cdbdf0c67ULL, 0x82fca5ec9abb5338ULL, 0x27db8e9352dc112dULL, 0xe0f1307d3079e6a4ULL,
+    0x032b7a0fa5a0c1b8ULL, 0x592881f84f05af39ULL, 0x82746e79f16fd849ULL, 0x369d32c781e7d3edULL,
+    0x706826dadd2bd5e0ULL, 0x104fbef9300f1894ULL, 0xcbb7b0ad11ef96b2ULL, 0xfb8a8c480750bac9ULL,
+    0xb495c50a823bb0c2ULL, 0xfdd944bbfa969ed0ULL, 0x67af2a375d23fc21ULL, 0xce3e1fecd86d0a7eULL,
+    0x12d519bf36d815bbULL, 0x4da0fdf5f1b2afb9ULL, 0xb3b78ff71a847951ULL, 0x6b8c70881a36eaa5ULL,
+    0x2c3cb84cef7606efULL, 0x1cf5a60fdf4cf4e4ULL, 0x16ff9e36984c9bb6ULL, 0x682e21e94ba4d52cULL,
+    0x531c368ada73a51dULL, 0x337d7cd281d67db6ULL, 0x9c00cbb6d97e6f62ULL, 0xcb8dd4b3a7c92695ULL,
+    0x8f49169bf0ba6cbcULL, 0x16be14e48cdaf54aULL, 0xb6524046254c6778ULL, 0x164fcdc3d3c3fcadULL,
+    0xe4eb5b6171c596bcULL, 0x69b6668cb41f363cULL, 0x3945df8e167244ceULL, 0xef9d18b1c2b7c8deULL,
+    0x6e582427c7121a5bULL, 0x26a061d2fce788a8ULL, 0x065ed3a1379071a9ULL, 0xdb40f975de681850ULL,
+    0xff17c495cb1c3bf7ULL, 0x011e33ce87c05308ULL, 0xfb9fc5a8ed1868deULL, 0xd96b39acf5f3f0e7ULL,
+    0x8186693f101a7668ULL, 0x8a8f568874bc0e0eULL, 0xbf7de05c0c2be144ULL, 0xe2e91be16e965869ULL,
+    0x574398bd32edafd9ULL, 0x809072cb1235e5c7ULL, 0x7dae097da639b0caULL, 0x8aff1b8abd873296ULL,
+    0xe0602711172544baULL, 0x4e65918f7066164cULL, 0x1cc7274c1a7eb556ULL, 0xe2c1e02e62b6b95eULL,
+    0x53583d38be621e0bULL, 0x934183cab4c01df4ULL, 0xb367a53acfdd27c3ULL, 0x3c75dec463227e13ULL,
+    0x8b3e515407ee776cULL, 0x9bdb80f84c18d4bbULL, 0x0e626953b3ee50b2ULL, 0xcacae5532c867f26ULL,
+    0x55e3a0f3c800436bULL, 0x6fa2aed32253f3bdULL, 0x3ff1ca42bb46a05aULL, 0xdf3ad9a01971df6bULL,
+};
+
+struct sha256_cdc
+{
+    struct sha256_jobs *jobs;
+    size_t min_size;
+    size_t average_size;
+    size_t max_size;
+    /* Chunks shorter than average_size need more zero bits to end, longer ones fewer, which pulls
+     * lengths towards the average (FastCDC normalization) */
+    unsigned long long mask_small;
+    unsigned long long mask_large;
+    void (*emit)(const struct sha256_chunk *chunks, size_t count, void *argument);
+    void *argument;
+
+    /* The chunk in progress: where it starts, bytes so far and the gear hash over them */
+    unsigned long long offset;
+    size_t length;
+    unsigned long long fingerprint;
+    /* Its bytes from earlier updates, hashed into carry.context */
+    struct sha256_job carry;
+    bool carrying;
+
+    struct sha256_chunk chunks[BATCH_CHUNKS];
+    struct sha256_job chunk_jobs[BATCH_CHUNKS];
+    size_t count;
+};
+
+/* Rolls the hash over data[*i..end) and stops after the first byte where the masked bits are zero, or
+ * at end. Both hashes of a pair derive from the one before them, which keeps the dependency chain at
+ * one shift and add per two bytes. */
+static inline bool gear_scan(unsigned long long *fingerprint, const unsigned char *data, size_t *i, size_t end, unsigned long long mask)
+{
+    unsigned long long hash = *fingerprint;
+    size_t j = *i;
+
+    for (; j + 2 <= end; j += 2)
+    {
+        unsigned long long first = GEAR[data[j]];
+        unsigned long long second = (first << 1) + GEAR[data[j + 1]];
+        first += hash << 1;
+        second += hash << 2;
+        if ((first & mask) == 0)
+        {
+            *i = j + 1;
+            return true;
+        }
+        if ((second & mask) == 0)
+        {
+            *i = j + 2;
+            return true;
+        }
+        hash = second;
+    }
+    if (j < end)
+    {
+        hash = (hash << 1) + GEAR[data[j++]];
+        if ((hash & mask) == 0)
+        {
+            *i = j;
+            return true;
+        }
+    }
+
+    *fingerprint = hash;
+    *i = j;
+    return false;
+}
+
+/* Continues the chunk in progress, seen bytes long, over data. Returns the bytes it takes from data,
+ * with *found set when the chunk ends after them. */
+static size_t scan(const struct sha256_cdc *cdc, unsigned long long *fingerprint, size_t seen, const unsigned char *data,
+                   size_t length, bool *found)
+{
+    size_t i = 0;
+
+    /* Boundaries before min_size are never taken, so those bytes are not looked at */
+    if (seen + 1 < cdc->min_size)
+    {
+        i = cdc->min_size - 1 - seen < length ? cdc->min_size - 1 - seen : length;
+    }
+
+    size_t small_end = cdc->average_size - 1 > seen ? cdc->average_size - 1 - seen : 0;
+    size_t large_end = cdc->max_size - 1 - seen;
+    small_end = small_end < length ? small_end : length;
+    large_end = large_end < length ? large_end : length;
+
+    *found = gear_scan(fingerprint, data, &i, small_end, cdc->mask_small) || gear_scan(fingerprint, data, &i, large_end, cdc->mask_large);
+    if (*found)
+    {
+        return i;
+    }
+
+    /* Past the last byte max_size allows the chunk ends whatever the content */
+    *found = i < length;
+    return *found ? i + 1 : length;
+}
+
+static void emit_chunks(struct sha256_cdc *cdc)
+{
+    sha256_jobs_flush(cdc->jobs);
+    while (sha256_jobs_completed(cdc->jobs) != NULL)
+    {
+    }
+
+    for (size_t i = 0; i < cdc->count; i++)
+    {
+        memcpy(cdc->chunks[i].digest, cdc->chunk_jobs[i].digest, 32);
+    }
+    if (cdc->count > 0 && cdc->emit != NULL)
+    {
+        cdc->emit(cdc->chunks, cdc->count, cdc->argument);
+    }
+    cdc->count = 0;
+}
+
+/* The chunk in progress ends after data; it goes to the lanes straight away */
+static void end_chunk(struct sha256_cdc *cdc, const unsigned char *data, size_t length)
+{
+    if (cdc->count == BATCH_CHUNKS)
+    {
+        emit_chunks(cdc);
+    }
+
+    struct sha256_job *job = &cdc->chunk_jobs[cdc->count];
+    struct sha256_chunk *chunk = &cdc->chunks[cdc->count++];
+
+    if (cdc->carrying)
+    {
+        job->context = cdc->carry.context;
+        cdc->carrying = false;
+    }
+    else
+    {
+        sha256_init(&job->context);
+    }
+    job->data = data;
+    job->length = length;
+    job->more = false;
+    sha256_jobs_submit(cdc->jobs, job);
+
+    chunk->offset = cdc->offset;
+    chunk->length = cdc->length;
+    cdc->offset += cdc->length;
+    cdc->length = 0;
+    cdc->fingerprint = 0;
+}
+
+bool sha256_cdc_create(struct sha256_cdc **cdc, const struct sha256_cdc_options *options)
+{
+    struct sha256_cdc_options defaults = {0, 0, 0, NULL, NULL};
+
+    if (options == NULL)
+    {
+        options = &defaults;
+    }
+    size_t min_size = options->min_size, average_size = options->average_size, max_size = options->max_size;
+
+    if (min_size == 0 && average_size == 0 && max_size == 0)
+    {
+        min_size = 2 * 1024;
+        average_size = 8 * 1024;
+        max_size = 64 * 1024;
+    }
+    if (min_size < 64 || min_size >= average_size || average_size >= max_size || max_size > LARGEST_CHUNK)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    *cdc = calloc(1, sizeof(**cdc));
+    if (*cdc == NULL)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+    if (!sha256_jobs_create(&(*cdc)->jobs, NULL))
+    {
+        free(*cdc);
+        return false;
+    }
+
+    /* The top bits of the hash depend on the last 64 bytes; average_size asks for log2(average_size)
+     * of them to be zero, normalization moves that by 2 either way */
+    unsigned int bits = 0;
+    while ((2ull << bits) <= average_size)
+    {
+        bits++;
+    }
+    (*cdc)->min_size = min_size;
+    (*cdc)->average_size = average_size;
+    (*cdc)->max_size = max_size;
+    (*cdc)->mask_small = ~0ull << (64 - (bits + 2));
+    (*cdc)->mask_large = ~0ull << (64 - (bits - 2));
+    (*cdc)->emit = options->emit;
+    (*cdc)->argument = options->argument;
+    (*cdc)->carry.more = true;
+    return true;
+}
+
+void sha256_cdc_destroy(struct sha256_cdc *cdc)
+{
+    if (cdc != NULL)
+    {
+        sha256_jobs_destroy(cdc->jobs);
+        free(cdc);
+    }
+}
+
+void sha256_cdc_update(struct sha256_cdc *cdc, const unsigned char *data, size_t length)
+{
+    size_t start = 0;
+    size_t done = 0;
+
+    while (done < length)
+    {
+        bool found;
+        size_t taken = scan(cdc, &cdc->fingerprint, cdc->length, data + done, length - done, &found);
+
+        done += taken;
+        cdc->length += taken;
+        if (found)
+        {
+            end_chunk(cdc, data + start, done - start);
+            start = done;
+        }
+    }
+
+    /* data is only valid during this call, so the start of the next chunk is hashed now */
+    if (start < length)
+    {
+        if (!cdc->carrying)
+        {
+            sha256_init(&cdc->carry.context);
+            cdc->carrying = true;
+        }
+        cdc->carry.data = data + start;
+        cdc->carry.length = length - start;
+        sha256_jobs_submit(cdc->jobs, &cdc->carry);
+    }
+    emit_chunks(cdc);
+}
+
+void sha256_cdc_finish(struct sha256_cdc *cdc)
+{
+    static const unsigned char NOTHING[1] = {0};
+
+    if (cdc->length > 0)
+    {
+        end_chunk(cdc, NOTHING, 0);
+    }
+    emit_chunks(cdc);
+    cdc->offset = 0;
+}
+
+size_t sha256_cdc_cut(const struct sha256_cdc *cdc, const unsigned char *data, size_t length)
+{
+    unsigned long long fingerprint = 0;
+    bool found;
+    size_t taken = scan(cdc, &fingerprint, 0, data, length, &found);
+
+    return found ? taken : length;
+}
@@ -0,0 +1,56 @@
+#ifndef SHA256_CDC_H
+#define SHA256_CDC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Content-defined chunking for deduplication: a gear rolling hash (FastCDC) cuts a stream into chunks
+ * whose boundaries follow the content, and every chunk gets its sha256. Each chunk goes to the
+ * multi-buffer job manager as soon as its boundary is found, so it is hashed while its bytes are
+ * still in cache instead of in a second pass over the stream. */
+
+struct sha256_cdc;
+
+struct sha256_chunk
+{
+    unsigned long long offset;
+    size_t length;
+    unsigned char digest[32];
+};
+
+struct sha256_cdc_options
+{
+    /* No chunk but the last is shorter than min_size or longer than max_size, and most are near
+     * average_size. All 0 means 2 KiB, 8 KiB and 64 KiB. */
+    size_t min_size;
+    size_t average_size;
+    size_t max_size;
+    /* Receives the chunks in stream order, a batch at a time */
+    void (*emit)(const struct sha256_chunk *chunks, size_t count, void *argument);
+    void *argument;
+};
+
+/* options may be NULL for the default sizes and no callback, e.g. for sha256_cdc_cut alone. Returns
+ * false with errno set, EINVAL unless 64 <= min_size < average_size < max_size <= 1 GiB. */
+bool sha256_cdc_create(struct sha256_cdc **cdc, const struct sha256_cdc_options *options);
+void sha256_cdc_destroy(struct sha256_cdc *cdc);
+
+/* Every chunk that ends in data is emitted before this returns; the unfinished last one is hashed as
+ * far as it goes and continues with the next call. Updates of a few MiB keep all lanes busy. */
+void sha256_cdc_update(struct sha256_cdc *cdc, const unsigned char *data, size_t length);
+/* Emits the last chunk and starts a new stream at offset 0 */
+void sha256_cdc_finish(struct sha256_cdc *cdc);
+
+/* The length of the chunk at the start of data, where data holds the rest of the stream: the
+ * boundary search alone, for callers that hash chunks themselves */
+size_t sha256_cdc_cut(const struct sha256_cdc *cdc, const unsigned char *data, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,80 @@
+#include "sha256.hpp"
+
+/* Compile-time known answers for sha256.hpp, plus a runtime check that the constexpr rounds agree
+ * with the dispatched kernels; sha256_bench runs it with its known-answer test. */
+
+using sha256::equal;
+using sha256::from_hex;
+using sha256::hash;
+using namespace sha256::literals;
+
+static_assert(equal(hash(""), from_hex("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855")), "empty");
+static_assert(equal(hash("abc"), from_hex("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad")), "abc");
+static_assert(equal(hash("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+                    from_hex("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1")),
+              "two blocks");
+static_assert(equal(hash("ale,etopakistan?ale,etopakistan?ale,etopakistan?ale,etopakistan?"),
+                    from_hex("0b8b1f0a231239a67468d9169bef9ef09a26d3197d3ba0b4116d9afbedf83d3c")),
+              "one full block");
+static_assert(equal(sha256::hasher()
+                        .update("hello")
+                        .update(" ")
+                        .update("world")
+                        .update("11111111111111111111111111111111111111111111111111111222222222222222222222222222222222222222222222"
+                                "22222222222222222223333333333333333333333333333333333333333333333333333333333333333")
+                        .complete(),
+                    from_hex("e0c00eec1438d3d91cdf61901416fabb43e5e0c72b23a72ebb9165848ac31a47")),
+              "split updates");
+static_assert(equal("abc"_sha256, hash("abc")), "literal");
+static_assert(equal(hash(std::array<unsigned char, 3>{'a', 'b', 'c'}), hash("abc")), "array");
+static_assert(!equal(hash("abc"), hash("abd")), "different inputs");
+
+namespace {
+
+constexpr std::size_t SWEEP_LENGTH = 200;
+
+constexpr unsigned char sweep_byte(std::size_t i)
+{
+    return (unsigned char)(i * 131 + 7);
+}
+
+/* Digests of every prefix length, all computed by the compiler */
+struct sweep_table
+{
+    sha256::digest digests[SWEEP_LENGTH + 1];
+
+    constexpr sweep_table() : digests{}
+    {
+        unsigned char data[SWEEP_LENGTH] = {};
+        for (std::size_t i = 0; i < SWEEP_LENGTH; i++)
+        {
+            data[i] = sweep_byte(i);
+        }
+        for (std::size_t length = 0; length <= SWEEP_LENGTH; length++)
+        {
+            digests[length] = hash(data, length);
+        }
+    }
+};
+
+constexpr sweep_table SWEEP;
+
+} // namespace
+
+extern "C" bool sha256_constexpr_agrees()
+{
+    unsigned char data[SWEEP_LENGTH];
+    for (std::size_t i = 0; i < SWEEP_LENGTH; i++)
+    {
+        data[i] = sweep_byte(i);
+    }
+
+    for (std::size_t length = 0; length <= SWEEP_LENGTH; length++)
+    {
+        if (!equal(hash(data, length), SWEEP.digests[length]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
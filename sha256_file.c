@@ -0,0 +1,490 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sha256_file.h"
+
+#define DEFAULT_BUFFER_SIZE (2 * 1024 * 1024)
+#define MAX_BUFFERS 3
+
+struct file_pipeline
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t filled;
+    pthread_cond_t emptied;
+
+    const struct sha256_file_options *options;
+    int fd;
+    bool direct;
+    off_t offset;
+
+    unsigned char *buffers[MAX_BUFFERS];
+    size_t lengths[MAX_BUFFERS];
+    unsigned int buffer_count;
+    size_t buffer_size;
+
+    /* Buffers handed over so far in each direction; their difference is the fill level of the ring */
+    unsigned long long produced;
+    unsigned long long consumed;
+    bool finished;
+    int error;
+
+    double hash_wait_seconds;
+};
+
+/* The unit of mmap offsets, and an alignment O_DIRECT accepts */
+static size_t page_size()
+{
+    long size = sysconf(_SC_PAGESIZE);
+    return size > 0 ? (size_t)size : 4096;
+}
+
+static double now_seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static long major_faults()
+{
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_majflt : 0;
+}
+
+/* sha256_update that stops at every multiple of the checkpoint interval to report the context */
+static void hash_chunk(struct SHA256 *context, const unsigned char *data, size_t length, const struct sha256_file_options *options)
+{
+    unsigned long long interval = options->checkpoint_interval;
+
+    while (options->checkpoint != NULL && interval > 0)
+    {
+        unsigned long long part = interval - context->length % interval;
+        if (part > length)
+        {
+            break;
+        }
+        sha256_update(context, data, part);
+        options->checkpoint(context, options->checkpoint_argument);
+        data += part;
+        length -= part;
+    }
+    sha256_update(context, data, length);
+}
+
+/* Fills one buffer; only the end of the file may come back short */
+static ssize_t read_full(struct file_pipeline *pipeline, unsigned char *buffer)
+{
+    size_t done = 0;
+
+    while (done < pipeline->buffer_size)
+    {
+        ssize_t n = read(pipeline->fd, buffer + done, pipeline->buffer_size - done);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        done += n;
+
+        /* A short O_DIRECT read leaves an unaligned offset, and it only happens at the end */
+        if (pipeline->direct)
+        {
+            break;
+        }
+    }
+    return done;
+}
+
+static void *reader_thread(void *argument)
+{
+    struct file_pipeline *pipeline = argument;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pipeline->mutex);
+        if (pipeline->produced - pipeline->consumed == pipeline->buffer_count)
+        {
+            double start = now_seconds();
+            while (pipeline->produced - pipeline->consumed == pipeline->buffer_count)
+            {
+                pthread_cond_wait(&pipeline->emptied, &pipeline->mutex);
+            }
+            pipeline->hash_wait_seconds += now_seconds() - start;
+        }
+        unsigned int slot = pipeline->produced % pipeline->buffer_count;
+        pthread_mutex_unlock(&pipeline->mutex);
+
+        ssize_t length = read_full(pipeline, pipeline->buffers[slot]);
+        int error = length < 0 ? errno : 0;
+
+        if (length > 0 && pipeline->options->drop_cache)
+        {
+            posix_fadvise(pipeline->fd, pipeline->offset, length, POSIX_FADV_DONTNEED);
+        }
+        pipeline->offset += length > 0 ? length : 0;
+
+        pthread_mutex_lock(&pipeline->mutex);
+        pipeline->lengths[slot] = length > 0 ? length : 0;
+        pipeline->error = error;
+        pipeline->finished = length < (ssize_t)pipeline->buffer_size;
+        pipeline->produced++;
+        pthread_cond_signal(&pipeline->filled);
+        bool finished = pipeline->finished;
+        pthread_mutex_unlock(&pipeline->mutex);
+
+        if (finished)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Returns 0 or the error of thread creation or of the reads */
+static int run_pipeline(struct file_pipeline *pipeline, struct SHA256 *context, struct sha256_file_stats *stats)
+{
+    pthread_t reader;
+    int error;
+
+    pthread_mutex_init(&pipeline->mutex, NULL);
+    pthread_cond_init(&pipeline->filled, NULL);
+    pthread_cond_init(&pipeline->emptied, NULL);
+
+    error = pthread_create(&reader, NULL, reader_thread, pipeline);
+    if (error == 0)
+    {
+        /* The hasher never touches the fd: it only waits when the ring is empty, which is the io-bound case */
+        for (;;)
+        {
+            pthread_mutex_lock(&pipeline->mutex);
+            if (pipeline->consumed == pipeline->produced && !pipeline->finished)
+            {
+                double start = now_seconds();
+                while (pipeline->consumed == pipeline->produced && !pipeline->finished)
+                {
+                    pthread_cond_wait(&pipeline->filled, &pipeline->mutex);
+                }
+                stats->io_wait_seconds += now_seconds() - start;
+            }
+            if (pipeline->consumed == pipeline->produced)
+            {
+                pthread_mutex_unlock(&pipeline->mutex);
+                break;
+            }
+            unsigned int slot = pipeline->consumed % pipeline->buffer_count;
+            size_t length = pipeline->lengths[slot];
+            pthread_mutex_unlock(&pipeline->mutex);
+
+            hash_chunk(context, pipeline->buffers[slot], length, pipeline->options);
+            stats->bytes += length;
+
+            pthread_mutex_lock(&pipeline->mutex);
+            pipeline->consumed++;
+            pthread_cond_signal(&pipeline->emptied);
+            pthread_mutex_unlock(&pipeline->mutex);
+        }
+
+        pthread_join(reader, NULL);
+        stats->hash_wait_seconds += pipeline->hash_wait_seconds;
+        error = pipeline->error;
+    }
+
+    pthread_cond_destroy(&pipeline->emptied);
+    pthread_cond_destroy(&pipeline->filled);
+    pthread_mutex_destroy(&pipeline->mutex);
+    return error;
+}
+
+/* O_DIRECT wants aligned buffers; page alignment also keeps the kernel copies cheap */
+static int allocate_buffers(struct file_pipeline *pipeline, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++)
+    {
+        void *buffer;
+        if (pipeline->buffers[i] == NULL)
+        {
+            int error = posix_memalign(&buffer, page_size(), pipeline->buffer_size);
+            if (error != 0)
+            {
+                return error;
+            }
+            pipeline->buffers[i] = buffer;
+        }
+    }
+    return 0;
+}
+
+static bool hash_pipelined(struct SHA256 *context, int fd, const struct sha256_file_options *options, struct sha256_file_stats *stats)
+{
+    struct file_pipeline pipeline;
+    int error;
+
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.options = options;
+    pipeline.fd = fd;
+    pipeline.buffer_size = options->buffer_size;
+    pipeline.buffer_count = options->buffer_count;
+#ifdef O_DIRECT
+    pipeline.direct = (fcntl(fd, F_GETFL) & O_DIRECT) != 0;
+#endif
+    pipeline.offset = lseek(fd, 0, SEEK_CUR);
+    if (pipeline.offset < 0)
+    {
+        pipeline.offset = 0;
+    }
+
+#ifdef O_DIRECT
+    /* A resumed stream may start mid-page, where O_DIRECT reads would fail */
+    if (pipeline.direct && pipeline.offset % (off_t)page_size() != 0)
+    {
+        pipeline.direct = fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT) != 0;
+    }
+#endif
+
+    /* A file that fits one buffer leaves nothing to overlap, so it skips the reader thread */
+    struct stat status;
+    bool small = fstat(fd, &status) == 0 && S_ISREG(status.st_mode) && status.st_size - pipeline.offset < (off_t)pipeline.buffer_size;
+
+    error = allocate_buffers(&pipeline, small ? 1 : pipeline.buffer_count);
+    if (error == 0 && small)
+    {
+        ssize_t length = read_full(&pipeline, pipeline.buffers[0]);
+        if (length < 0)
+        {
+            error = errno;
+        }
+        else
+        {
+            if (options->drop_cache && length > 0)
+            {
+                posix_fadvise(fd, pipeline.offset, length, POSIX_FADV_DONTNEED);
+            }
+            hash_chunk(context, pipeline.buffers[0], length, options);
+            stats->bytes += length;
+            pipeline.offset += length;
+
+            /* A file that grew since fstat goes through the pipeline for the rest */
+            if (length == (ssize_t)pipeline.buffer_size)
+            {
+                small = false;
+                error = allocate_buffers(&pipeline, pipeline.buffer_count);
+            }
+        }
+    }
+
+    if (error == 0 && !small)
+    {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        error = run_pipeline(&pipeline, context, stats);
+    }
+
+    for (unsigned int i = 0; i < pipeline.buffer_count; i++)
+    {
+        free(pipeline.buffers[i]);
+    }
+
+    if (error != 0)
+    {
+        errno = error;
+        return false;
+    }
+    return true;
+}
+
+static bool hash_mapped(struct SHA256 *context, int fd, off_t offset, off_t size, const struct sha256_file_options *options,
+                        struct sha256_file_stats *stats)
+{
+    /* mmap offsets must be page aligned, the bytes before offset are mapped but skipped */
+    size_t page = page_size();
+    off_t base = offset - offset % (off_t)page;
+    size_t length = size - base;
+    size_t mapped = length;
+    struct stat status;
+
+    if (offset >= size)
+    {
+        return true;
+    }
+
+    unsigned char *map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, base);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+    madvise(map, length, MADV_SEQUENTIAL);
+
+    size_t chunk = options->buffer_size;
+    for (size_t start = offset - base; start < mapped;)
+    {
+        /* Touching pages past the end of a file that shrank raises SIGBUS, so a truncation is followed
+         * chunk by chunk, as reads would stop early; only one landing inside a chunk is fatal */
+        if (fstat(fd, &status) == 0 && status.st_size < base + (off_t)mapped)
+        {
+            mapped = status.st_size > base ? status.st_size - base : 0;
+            size = base + mapped;
+            if (start >= mapped)
+            {
+                break;
+            }
+        }
+
+        size_t end = (start - start % chunk) + chunk < mapped ? (start - start % chunk) + chunk : mapped;
+
+        /* Readahead for the next chunk runs while this one is hashed */
+        if (end < mapped)
+        {
+            madvise(map + end, mapped - end < chunk ? mapped - end : chunk, MADV_WILLNEED);
+        }
+
+        hash_chunk(context, map + start, end - start, options);
+        stats->bytes += end - start;
+
+        if (options->drop_cache)
+        {
+            size_t first = start - start % page;
+            madvise(map + first, end - first, MADV_DONTNEED);
+            posix_fadvise(fd, base + first, end - first, POSIX_FADV_DONTNEED);
+        }
+        start = end;
+    }
+
+    munmap(map, length);
+    lseek(fd, size, SEEK_SET);
+    return true;
+}
+
+bool sha256_file_update(struct SHA256 *context, int fd, const struct sha256_file_options *options, struct sha256_file_stats *stats)
+{
+    struct sha256_file_options defaults = {SHA256_FILE_BUFFERED, 0, 0, false, 0, NULL, NULL};
+    struct sha256_file_stats ignored;
+    struct stat status;
+    bool ok;
+
+    if (options != NULL)
+    {
+        defaults = *options;
+    }
+    if (defaults.buffer_size == 0)
+    {
+        defaults.buffer_size = DEFAULT_BUFFER_SIZE;
+    }
+    size_t page = page_size();
+    defaults.buffer_size = (defaults.buffer_size + page - 1) / page * page;
+    if (defaults.buffer_count < 2 || defaults.buffer_count > MAX_BUFFERS)
+    {
+        defaults.buffer_count = MAX_BUFFERS;
+    }
+    if (stats == NULL)
+    {
+        stats = &ignored;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    double start = now_seconds();
+    long faults = major_faults();
+
+    /* Pipes and character devices cannot be mapped and go through the read pipeline */
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (defaults.mode == SHA256_FILE_MMAP && offset >= 0 && fstat(fd, &status) == 0 && S_ISREG(status.st_mode))
+    {
+        ok = hash_mapped(context, fd, offset, status.st_size, &defaults, stats);
+    }
+    else
+    {
+        ok = hash_pipelined(context, fd, &defaults, stats);
+    }
+
+    stats->seconds = now_seconds() - start;
+    stats->major_faults = major_faults() - faults;
+    return ok;
+}
+
+static int open_file(const char *path, enum sha256_file_mode mode)
+{
+    if (strcmp(path, "-") == 0)
+    {
+        return STDIN_FILENO;
+    }
+
+#ifdef O_DIRECT
+    if (mode == SHA256_FILE_DIRECT)
+    {
+        int fd = open(path, O_RDONLY | O_DIRECT);
+        /* tmpfs and some network filesystems reject O_DIRECT */
+        if (fd >= 0 || errno != EINVAL)
+        {
+            return fd;
+        }
+    }
+#endif
+    return open(path, O_RDONLY);
+}
+
+bool sha256_file_resume(unsigned char digest[32], const char *path, struct SHA256 *context, const struct sha256_file_options *options,
+                        struct sha256_file_stats *stats)
+{
+    int fd = open_file(path, options != NULL ? options->mode : SHA256_FILE_BUFFERED);
+    struct stat status;
+    bool ok;
+
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    /* Standard input cannot seek, so it can only start from the beginning */
+    if (context->length > 0 && lseek(fd, context->length, SEEK_SET) != (off_t)context->length)
+    {
+        ok = false;
+        errno = fd == STDIN_FILENO ? ESPIPE : errno;
+    }
+    /* Seeking past the end succeeds, and hashing on from there would finish a digest of bytes the file no longer holds */
+    else if (context->length > 0 && fstat(fd, &status) == 0 && S_ISREG(status.st_mode) && status.st_size < (off_t)context->length)
+    {
+        ok = false;
+        errno = EINVAL;
+    }
+    else
+    {
+        ok = sha256_file_update(context, fd, options, stats);
+    }
+    if (ok)
+    {
+        sha256_complete(digest, context);
+    }
+
+    if (fd != STDIN_FILENO)
+    {
+        int error = errno;
+        close(fd);
+        errno = error;
+    }
+    return ok;
+}
+
+bool sha256_file(unsigned char digest[32], const char *path, const struct sha256_file_options *options, struct sha256_file_stats *stats)
+{
+    struct SHA256 context;
+
+    sha256_init(&context);
+    return sha256_file_resume(digest, path, &context, options, stats);
+}
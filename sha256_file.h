@@ -0,0 +1,67 @@
+#ifndef SHA256_FILE_H
+#define SHA256_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sha256.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum sha256_file_mode
+{
+    /* A reader thread fills a ring of buffers through the page cache while the caller hashes */
+    SHA256_FILE_BUFFERED,
+    /* Same pipeline with O_DIRECT, falling back to buffered where the filesystem refuses it */
+    SHA256_FILE_DIRECT,
+    /* mmap with MADV_SEQUENTIAL, asking for the next chunk before hashing the current one. A file that
+     * shrinks between chunks is hashed up to its new end, like a read would; one truncated while a
+     * chunk is being hashed raises SIGBUS, so files that may be truncated under us want the others. */
+    SHA256_FILE_MMAP,
+};
+
+struct sha256_file_options
+{
+    enum sha256_file_mode mode;
+    /* Bytes per read, rounded up to the page size; 0 picks 2 MiB */
+    size_t buffer_size;
+    /* Depth of the read ring, 2 or 3; 0 picks 3 */
+    unsigned int buffer_count;
+    /* Drop hashed ranges from the page cache so one pass does not evict everything else */
+    bool drop_cache;
+    /* When set, called with the context each time its length reaches a multiple of checkpoint_interval,
+     * e.g. to store sha256_export() output for a later sha256_file_resume() */
+    unsigned long long checkpoint_interval;
+    void (*checkpoint)(const struct SHA256 *context, void *argument);
+    void *checkpoint_argument;
+};
+
+struct sha256_file_stats
+{
+    unsigned long long bytes;
+    double seconds;
+    /* Time the hasher sat idle waiting for data, and the reader waiting for a free buffer */
+    double io_wait_seconds;
+    double hash_wait_seconds;
+    /* Page faults that had to go to disk; the only stall signal in mmap mode */
+    long major_faults;
+};
+
+/* Hashes fd from its current offset to the end into context. options and stats may be NULL.
+ * Returns false with errno set when reading fails. */
+bool sha256_file_update(struct SHA256 *context, int fd, const struct sha256_file_options *options, struct sha256_file_stats *stats);
+
+/* Whole file by path, "-" is standard input */
+bool sha256_file(unsigned char digest[32], const char *path, const struct sha256_file_options *options, struct sha256_file_stats *stats);
+
+/* Continues a context (typically from sha256_import) at byte context->length of the file; fails with EINVAL when the file is shorter */
+bool sha256_file_resume(unsigned char digest[32], const char *path, struct SHA256 *context, const struct sha256_file_options *options,
+                        struct sha256_file_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
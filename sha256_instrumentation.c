@@ -0,0 +1,132 @@
+#include <string.h>
+
+#include "sha256_instrumentation.h"
+#include "sha256_internal.h"
+
+#if SHA256_INSTRUMENTATION
+#include <pthread.h>
+#include <stdlib.h>
+
+_Thread_local struct sha256_thread_counters *sha256_local_counters;
+
+/* Counters of every thread that registered. Exited threads hand theirs to the free list, where they keep
+ * counting towards snapshots and are reused by the next new thread. */
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct sha256_thread_counters *registry;
+static struct sha256_thread_counters *free_list;
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+
+static void release_thread(void *argument)
+{
+    struct sha256_thread_counters *counters = argument;
+
+    /* A later destructor that hashes registers again instead of writing to a block someone else may take */
+    sha256_local_counters = NULL;
+    pthread_mutex_lock(&registry_mutex);
+    for (struct sha256_thread_counters **link = &registry; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == counters)
+        {
+            *link = counters->next;
+            break;
+        }
+    }
+    counters->next = free_list;
+    free_list = counters;
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+static void create_exit_key()
+{
+    pthread_key_create(&exit_key, release_thread);
+}
+
+/* Without memory the thread shares a static block: racy counts beat crashing in a hash function */
+static struct sha256_thread_counters overflow;
+
+struct sha256_thread_counters *sha256_register_thread()
+{
+    struct sha256_thread_counters *counters;
+
+    pthread_once(&exit_key_once, create_exit_key);
+    pthread_mutex_lock(&registry_mutex);
+    counters = free_list;
+    if (counters != NULL)
+    {
+        free_list = counters->next;
+    }
+    else
+    {
+        size_t size = (sizeof(*counters) + 63) / 64 * 64;
+        counters = aligned_alloc(64, size);
+        if (counters != NULL)
+        {
+            memset(counters, 0, size);
+        }
+    }
+
+    if (counters != NULL)
+    {
+        counters->next = registry;
+        registry = counters;
+        pthread_setspecific(exit_key, counters);
+    }
+    else
+    {
+        counters = &overflow;
+    }
+    pthread_mutex_unlock(&registry_mutex);
+
+    sha256_local_counters = counters;
+    return counters;
+}
+
+static void add_counters(struct sha256_instrumentation *snapshot, struct sha256_thread_counters *counters)
+{
+    snapshot->update_calls += atomic_load_explicit(&counters->update_calls, memory_order_relaxed);
+    snapshot->update_bytes += atomic_load_explicit(&counters->update_bytes, memory_order_relaxed);
+    snapshot->buffered_updates += atomic_load_explicit(&counters->buffered_updates, memory_order_relaxed);
+    snapshot->buffered_bytes += atomic_load_explicit(&counters->buffered_bytes, memory_order_relaxed);
+    snapshot->complete_calls += atomic_load_explicit(&counters->complete_calls, memory_order_relaxed);
+    snapshot->complete_two_blocks += atomic_load_explicit(&counters->complete_two_blocks, memory_order_relaxed);
+    for (int i = 0; i < SHA256_INSTRUMENTED_BACKENDS; i++)
+    {
+        snapshot->kernel_calls[i] += atomic_load_explicit(&counters->kernel_calls[i], memory_order_relaxed);
+        snapshot->blocks[i] += atomic_load_explicit(&counters->blocks[i], memory_order_relaxed);
+#if SHA256_INSTRUMENTATION_LATENCY
+        for (int j = 0; j < SHA256_LATENCY_BUCKETS; j++)
+        {
+            snapshot->latency_cycles[i][j] += atomic_load_explicit(&counters->latency_cycles[i][j], memory_order_relaxed);
+        }
+#endif
+    }
+}
+#endif
+
+void sha256_instrumentation_snapshot(struct sha256_instrumentation *snapshot)
+{
+    memset(snapshot, 0, sizeof(*snapshot));
+
+#if SHA256_INSTRUMENTATION
+    snapshot->enabled = true;
+    snapshot->latency = SHA256_INSTRUMENTATION_LATENCY;
+    snapshot->probes = SHA256_PROBES_AVAILABLE;
+    for (int i = 0; i < SHA256_INSTRUMENTED_BACKENDS; i++)
+    {
+        snapshot->backend_names[i] = sha256_backend_name(i);
+    }
+
+    pthread_mutex_lock(&registry_mutex);
+    for (struct sha256_thread_counters *counters = registry; counters != NULL; counters = counters->next)
+    {
+        add_counters(snapshot, counters);
+    }
+    for (struct sha256_thread_counters *counters = free_list; counters != NULL; counters = counters->next)
+    {
+        add_counters(snapshot, counters);
+    }
+    add_counters(snapshot, &overflow);
+    pthread_mutex_unlock(&registry_mutex);
+#endif
+}
@@ -0,0 +1,53 @@
+#ifndef SHA256_INSTRUMENTATION_H
+#define SHA256_INSTRUMENTATION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Counters of the paths taken inside sha256.c. They are only collected when the library is built with
+ * -DSHA256_INSTRUMENTATION=ON; otherwise the hot paths are compiled exactly as without this header and
+ * a snapshot comes back with enabled false and every counter zero. */
+
+#define SHA256_INSTRUMENTED_BACKENDS 4
+#define SHA256_LATENCY_BUCKETS 32
+
+struct sha256_instrumentation
+{
+    bool enabled;
+    /* Built with SHA256_INSTRUMENTATION_LATENCY / SHA256_INSTRUMENTATION_PROBES */
+    bool latency;
+    bool probes;
+
+    unsigned long long update_calls;
+    unsigned long long update_bytes;
+    /* sha256_update calls that returned early with everything still below one block */
+    unsigned long long buffered_updates;
+    /* Bytes copied into context->buffer, whether or not the call reached a kernel */
+    unsigned long long buffered_bytes;
+    unsigned long long complete_calls;
+    /* complete() calls whose padding spilled into a second final block */
+    unsigned long long complete_two_blocks;
+
+    /* Indexed like backend_names, which lists every backend of this build, supported or not. Only the
+     * single-stream kernels behind sha256_update, sha256_complete and the fixed-size functions count here;
+     * multi-buffer batches (sha256_hash_many, sha256_64_many and what is built on them) do not. */
+    const char *backend_names[SHA256_INSTRUMENTED_BACKENDS];
+    unsigned long long kernel_calls[SHA256_INSTRUMENTED_BACKENDS];
+    unsigned long long blocks[SHA256_INSTRUMENTED_BACKENDS];
+    /* Kernel calls by duration: bucket i counts calls of [2^i, 2^(i+1)) reference cycles */
+    unsigned long long latency_cycles[SHA256_INSTRUMENTED_BACKENDS][SHA256_LATENCY_BUCKETS];
+};
+
+/* Sums the counters of every thread that ever hashed, including threads that have exited. Counters
+ * only grow; subtract two snapshots to measure an interval. */
+void sha256_instrumentation_snapshot(struct sha256_instrumentation *snapshot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
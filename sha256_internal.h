@@ -0,0 +1,255 @@
+#ifndef SHA256_INTERNAL_H
+#define SHA256_INTERNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "sha256.h"
+#include "sha256_primitives.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_SHA
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#define TARGET_AVX2_BMI2
+#define TARGET_AVX512
+#define ALIGNED(n) __declspec(align(n))
+#define ALWAYS_INLINE __forceinline
+#else
+#include <cpuid.h>
+#include <immintrin.h>
+#define TARGET_SHA __attribute__((target("sha,sse4.1")))
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX2_BMI2 __attribute__((target("avx2,bmi2")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#define ALIGNED(n) __attribute__((aligned(n)))
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+static inline unsigned int _byteswap_ulong(unsigned int x)
+{
+    return __builtin_bswap32(x);
+}
+
+static inline unsigned long long _byteswap_uint64(unsigned long long x)
+{
+    return __builtin_bswap64(x);
+}
+#endif
+
+#define USE_CPU_EXTENSIONS true
+
+static inline void cpuid(int cpu_info[4], int function, int subfunction)
+{
+#if defined(_MSC_VER)
+    __cpuid(cpu_info, 0);
+    if (cpu_info[0] < function)
+    {
+        cpu_info[0] = cpu_info[1] = cpu_info[2] = cpu_info[3] = 0;
+        return;
+    }
+    __cpuidex(cpu_info, function, subfunction);
+#else
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    __get_cpuid_count(function, subfunction, &eax, &ebx, &ecx, &edx);
+    cpu_info[0] = eax;
+    cpu_info[1] = ebx;
+    cpu_info[2] = ecx;
+    cpu_info[3] = edx;
+#endif
+}
+
+static inline bool cpu_supports_ssse3()
+{
+    int cpu_info[4] = {0};
+    cpuid(cpu_info, 1, 0);
+    return (cpu_info[2] >> 9) & 1;
+}
+
+static inline bool cpu_supports_sse41()
+{
+    int cpu_info[4] = {0};
+    cpuid(cpu_info, 1, 0);
+    return (cpu_info[2] >> 19) & 1;
+}
+
+static inline bool cpu_supports_sha256_extensions()
+{
+    int cpu_info[4] = {0};
+    int function = 7;
+    int subfunction = 0;
+    cpuid(cpu_info, function, subfunction);
+    return ((cpu_info[1] >> 29) & 1) && cpu_supports_sse41();
+}
+
+/* AVX state must also be enabled by the os in XCR0, not only reported by cpuid */
+static inline unsigned long long xgetbv()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+static inline bool cpu_supports_avx2()
+{
+    int cpu_info[4] = {0};
+    cpuid(cpu_info, 1, 0);
+    if (!((cpu_info[2] >> 27) & 1) || (xgetbv() & 0x06) != 0x06)
+    {
+        return false;
+    }
+    cpuid(cpu_info, 7, 0);
+    return (cpu_info[1] >> 5) & 1;
+}
+
+static inline bool cpu_supports_avx2_bmi2()
+{
+    int cpu_info[4] = {0};
+    cpuid(cpu_info, 7, 0);
+    return cpu_supports_avx2() && ((cpu_info[1] >> 8) & 1);
+}
+
+static inline bool cpu_supports_avx512()
+{
+    int cpu_info[4] = {0};
+    if (!cpu_supports_avx2() || (xgetbv() & 0xE6) != 0xE6)
+    {
+        return false;
+    }
+    cpuid(cpu_info, 7, 0);
+    return ((cpu_info[1] >> 16) & 1) && ((cpu_info[1] >> 30) & 1);
+}
+
+static inline bool cpu_supports_scalar()
+{
+    return true;
+}
+
+static inline unsigned int load_be32(const unsigned char *p)
+{
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+static inline void store_digest(unsigned char digest[32], const unsigned int state[8])
+{
+    for (int i = 0; i < 8; i++)
+    {
+        unsigned int word = _byteswap_ulong(state[i]);
+        memcpy(digest + 4 * i, &word, 4);
+    }
+}
+
+#ifndef SHA256_INSTRUMENTATION
+#define SHA256_INSTRUMENTATION 0
+#endif
+#ifndef SHA256_INSTRUMENTATION_LATENCY
+#define SHA256_INSTRUMENTATION_LATENCY 0
+#endif
+#ifndef SHA256_INSTRUMENTATION_PROBES
+#define SHA256_INSTRUMENTATION_PROBES 0
+#endif
+
+#if SHA256_INSTRUMENTATION
+#include <stdatomic.h>
+
+#include "sha256_instrumentation.h"
+
+/* One per thread, on cache lines of its own. Only the owning thread writes, so increments are a relaxed
+ * load and store rather than a locked add; snapshots read them from other threads. */
+struct sha256_thread_counters
+{
+    ALIGNED(64) atomic_ullong update_calls;
+    atomic_ullong update_bytes;
+    atomic_ullong buffered_updates;
+    atomic_ullong buffered_bytes;
+    atomic_ullong complete_calls;
+    atomic_ullong complete_two_blocks;
+    atomic_ullong kernel_calls[SHA256_INSTRUMENTED_BACKENDS];
+    atomic_ullong blocks[SHA256_INSTRUMENTED_BACKENDS];
+#if SHA256_INSTRUMENTATION_LATENCY
+    atomic_ullong latency_cycles[SHA256_INSTRUMENTED_BACKENDS][SHA256_LATENCY_BUCKETS];
+#endif
+    struct sha256_thread_counters *next;
+};
+
+extern _Thread_local struct sha256_thread_counters *sha256_local_counters;
+
+/* Allocates and registers the calling thread's counters on its first hash */
+struct sha256_thread_counters *sha256_register_thread();
+
+static inline struct sha256_thread_counters *sha256_counters()
+{
+    struct sha256_thread_counters *counters = sha256_local_counters;
+    return counters != NULL ? counters : sha256_register_thread();
+}
+
+static inline void sha256_count(atomic_ullong *counter, unsigned long long amount)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+#define SHA256_COUNT(field, amount) sha256_count(&sha256_counters()->field, (amount))
+
+/* Name of entry index of the single-stream backend table, NULL past the end */
+const char *sha256_backend_name(size_t index);
+#else
+#define SHA256_COUNT(field, amount) ((void)0)
+#endif
+
+#if SHA256_INSTRUMENTATION && SHA256_INSTRUMENTATION_PROBES && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SHA256_PROBES_AVAILABLE 1
+/* USDT probes: a nop in the instruction stream until perf or bpftrace attaches to sdt:sha256:* */
+#define SHA256_PROBE_BLOCKS_BEGIN(blocks) DTRACE_PROBE1(sha256, blocks_begin, blocks)
+#define SHA256_PROBE_BLOCKS_END(backend, blocks) DTRACE_PROBE2(sha256, blocks_end, backend, blocks)
+#endif
+#endif
+
+#ifndef SHA256_PROBES_AVAILABLE
+#define SHA256_PROBES_AVAILABLE 0
+#define SHA256_PROBE_BLOCKS_BEGIN(blocks) ((void)(blocks))
+#define SHA256_PROBE_BLOCKS_END(backend, blocks) ((void)(backend), (void)(blocks))
+#endif
+
+/* Runs count blocks through the selected single-stream backend */
+void sha256_process_blocks(unsigned int state[8], const unsigned char *block, size_t count);
+/* One block given as big-endian words already loaded, the fast path for short fixed-layout messages */
+void sha256_process_words(unsigned int state[8], const unsigned int words[16]);
+
+#define SHA256_MAX_LANES 16
+
+/* Structure-of-arrays state for multi-lane kernels: state[word][lane], each row aligned for the widest vector */
+struct sha256_lanes
+{
+    ALIGNED(64) unsigned int state[8][SHA256_MAX_LANES];
+};
+
+/* Every lane consumes count blocks starting at its own data[lane] pointer */
+typedef void (*process_blocks_many_function)(struct sha256_lanes *lanes, const unsigned char *const *data, size_t count);
+
+struct sha256_batch_backend
+{
+    const char *name;
+    bool (*supported)();
+    size_t lanes;
+    process_blocks_many_function process_blocks_many;
+};
+
+/* Selected multi-lane backend, resolved on first use */
+const struct sha256_batch_backend *sha256_batch_dispatch();
+
+/* A multi-lane backend by name, NULL when unknown or not supported by this cpu */
+const struct sha256_batch_backend *sha256_find_batch_backend(const char *name);
+
+/* Builds the padded final block(s) of a length-byte message from its last tail_length bytes in tail
+ * and returns how many there are */
+size_t sha256_pad_tail(unsigned char tail[128], const unsigned char *input, size_t tail_length, size_t length);
+
+#endif
@@ -0,0 +1,425 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sha256_internal.h"
+#include "sha256_jobs.h"
+
+/* What a lane hashes next: the block that completes the context's buffered bytes, the job's whole
+ * blocks in place, then the padded final block(s) */
+enum lane_stage
+{
+    STAGE_HEAD,
+    STAGE_BODY,
+    STAGE_TAIL,
+    STAGE_DONE,
+};
+
+struct sha256_jobs
+{
+    struct sha256_lanes lanes;
+    ALIGNED(64) unsigned char staging[SHA256_MAX_LANES][128];
+    /* Per lane: its job (NULL when idle), the blocks left in the current run and where they are */
+    struct sha256_job *job[SHA256_MAX_LANES];
+    const unsigned char *data[SHA256_MAX_LANES];
+    size_t blocks[SHA256_MAX_LANES];
+    /* Where the job's whole blocks start, past the bytes that completed the buffered block */
+    size_t body[SHA256_MAX_LANES];
+    enum lane_stage stage[SHA256_MAX_LANES];
+    /* Lanes without a job, so a submit does not look at the busy ones */
+    unsigned char idle[SHA256_MAX_LANES];
+    size_t idle_count;
+
+    const struct sha256_batch_backend *batch;
+    size_t active;
+    size_t in_flight;
+    struct sha256_job *pending_head;
+    struct sha256_job *pending_tail;
+    struct sha256_job *completed_head;
+    struct sha256_job *completed_tail;
+    bool delivering;
+
+    void (*complete)(struct sha256_job *job, void *argument);
+    void *argument;
+    unsigned long long max_latency_ns;
+};
+
+static unsigned long long now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ull + (unsigned long long)now.tv_nsec;
+}
+
+static void push(struct sha256_job **head, struct sha256_job **tail, struct sha256_job *job)
+{
+    job->next = NULL;
+    if (*tail != NULL)
+    {
+        (*tail)->next = job;
+    }
+    else
+    {
+        *head = job;
+    }
+    *tail = job;
+}
+
+static struct sha256_job *pop(struct sha256_job **head, struct sha256_job **tail)
+{
+    struct sha256_job *job = *head;
+    if (job != NULL)
+    {
+        *head = job->next;
+        if (*head == NULL)
+        {
+            *tail = NULL;
+        }
+        job->next = NULL;
+    }
+    return job;
+}
+
+static void finish_job(struct sha256_jobs *jobs, size_t lane)
+{
+    struct sha256_job *job = jobs->job[lane];
+
+    for (int i = 0; i < 8; i++)
+    {
+        job->context.state[i] = jobs->lanes.state[i][lane];
+    }
+    if (!job->more)
+    {
+        store_digest(job->digest, job->context.state);
+        job->context.buffer_length = 0;
+    }
+
+    jobs->job[lane] = NULL;
+    jobs->active--;
+    jobs->in_flight--;
+    push(&jobs->completed_head, &jobs->completed_tail, job);
+}
+
+/* Moves a lane whose run is used up to its next stage, completing its job and taking the next one as
+ * needed, until it has blocks to hash or nothing is pending */
+static void advance_lane(struct sha256_jobs *jobs, size_t lane)
+{
+    while (jobs->blocks[lane] == 0)
+    {
+        struct sha256_job *job = jobs->job[lane];
+
+        if (job == NULL)
+        {
+            job = pop(&jobs->pending_head, &jobs->pending_tail);
+            if (job == NULL)
+            {
+                jobs->idle[jobs->idle_count++] = (unsigned char)lane;
+                return;
+            }
+
+            struct SHA256 *context = &job->context;
+            jobs->job[lane] = job;
+            jobs->active++;
+            for (int i = 0; i < 8; i++)
+            {
+                jobs->lanes.state[i][lane] = context->state[i];
+            }
+            context->length += job->length;
+
+            /* Everything short of a block only joins the buffered bytes, like in sha256_update, unless
+             * there are none and the job is final: then its tail pads straight from its data */
+            if (context->buffer_length + job->length < 64 && (context->buffer_length > 0 || job->more))
+            {
+                memcpy(context->buffer + context->buffer_length, job->data, job->length);
+                context->buffer_length += job->length;
+                jobs->body[lane] = job->length;
+                jobs->stage[lane] = STAGE_TAIL;
+            }
+            else if (context->buffer_length > 0)
+            {
+                size_t fill = 64 - context->buffer_length;
+                memcpy(jobs->staging[lane], context->buffer, context->buffer_length);
+                memcpy(jobs->staging[lane] + context->buffer_length, job->data, fill);
+                context->buffer_length = 0;
+                jobs->data[lane] = jobs->staging[lane];
+                jobs->blocks[lane] = 1;
+                jobs->body[lane] = fill;
+                jobs->stage[lane] = STAGE_HEAD;
+            }
+            else
+            {
+                jobs->body[lane] = 0;
+                jobs->stage[lane] = STAGE_HEAD;
+            }
+            continue;
+        }
+
+        switch (jobs->stage[lane])
+        {
+        case STAGE_HEAD:
+            jobs->data[lane] = job->data + jobs->body[lane];
+            jobs->blocks[lane] = (job->length - jobs->body[lane]) / 64;
+            jobs->stage[lane] = STAGE_BODY;
+            break;
+        case STAGE_BODY:
+        {
+            size_t consumed = jobs->body[lane] + (job->length - jobs->body[lane]) / 64 * 64;
+            if (job->more)
+            {
+                job->context.buffer_length = job->length - consumed;
+                memcpy(job->context.buffer, job->data + consumed, job->context.buffer_length);
+                jobs->stage[lane] = STAGE_TAIL;
+                break;
+            }
+            jobs->data[lane] = jobs->staging[lane];
+            jobs->blocks[lane] = sha256_pad_tail(jobs->staging[lane], job->data + consumed, job->length - consumed, job->context.length);
+            jobs->stage[lane] = STAGE_DONE;
+            break;
+        }
+        case STAGE_TAIL:
+            if (!job->more)
+            {
+                jobs->data[lane] = jobs->staging[lane];
+                jobs->blocks[lane] = sha256_pad_tail(jobs->staging[lane], job->context.buffer, job->context.buffer_length, job->context.length);
+            }
+            jobs->stage[lane] = STAGE_DONE;
+            break;
+        case STAGE_DONE:
+            finish_job(jobs, lane);
+            break;
+        }
+    }
+}
+
+static void fill_lanes(struct sha256_jobs *jobs)
+{
+    while (jobs->pending_head != NULL && jobs->idle_count > 0)
+    {
+        advance_lane(jobs, jobs->idle[--jobs->idle_count]);
+    }
+}
+
+/* Advances every lane by the shortest remaining run; idle lanes shadow a busy one and their results are dropped */
+static void step(struct sha256_jobs *jobs)
+{
+    size_t lanes = jobs->batch->lanes;
+    size_t count = 0;
+    size_t busy = 0;
+
+    for (size_t lane = 0; lane < lanes; lane++)
+    {
+        if (jobs->job[lane] != NULL && (count == 0 || jobs->blocks[lane] < count))
+        {
+            count = jobs->blocks[lane];
+            busy = lane;
+        }
+    }
+    for (size_t lane = 0; lane < lanes; lane++)
+    {
+        if (jobs->job[lane] == NULL)
+        {
+            jobs->data[lane] = jobs->data[busy];
+        }
+    }
+
+    jobs->batch->process_blocks_many(&jobs->lanes, jobs->data, count);
+
+    for (size_t lane = 0; lane < lanes; lane++)
+    {
+        if (jobs->job[lane] != NULL)
+        {
+            jobs->data[lane] += count * 64;
+            jobs->blocks[lane] -= count;
+            advance_lane(jobs, lane);
+        }
+    }
+}
+
+/* A mostly empty vector costs more than finishing its few lanes one by one */
+static void finish_single(struct sha256_jobs *jobs, size_t lane)
+{
+    while (jobs->job[lane] != NULL)
+    {
+        if (jobs->blocks[lane] > 0)
+        {
+            unsigned int state[8];
+            for (int i = 0; i < 8; i++)
+            {
+                state[i] = jobs->lanes.state[i][lane];
+            }
+            sha256_process_blocks(state, jobs->data[lane], jobs->blocks[lane]);
+            for (int i = 0; i < 8; i++)
+            {
+                jobs->lanes.state[i][lane] = state[i];
+            }
+            jobs->blocks[lane] = 0;
+        }
+
+        /* Only the lane's own stages: nothing is pending while lanes are idle */
+        advance_lane(jobs, lane);
+    }
+}
+
+static void drain(struct sha256_jobs *jobs)
+{
+    fill_lanes(jobs);
+    while (jobs->active > 0)
+    {
+        if (jobs->active * 2 < jobs->batch->lanes)
+        {
+            for (size_t lane = 0; lane < jobs->batch->lanes; lane++)
+            {
+                finish_single(jobs, lane);
+            }
+        }
+        else
+        {
+            step(jobs);
+        }
+    }
+}
+
+/* Callbacks run after the manager is consistent again, so they may submit */
+static void deliver(struct sha256_jobs *jobs)
+{
+    if (jobs->complete == NULL)
+    {
+        return;
+    }
+
+    struct sha256_job *job;
+    jobs->delivering = true;
+    while ((job = pop(&jobs->completed_head, &jobs->completed_tail)) != NULL)
+    {
+        jobs->complete(job, jobs->argument);
+    }
+    jobs->delivering = false;
+}
+
+static bool latency_exceeded(const struct sha256_jobs *jobs)
+{
+    if (jobs->max_latency_ns == 0 || jobs->active == 0)
+    {
+        return false;
+    }
+
+    unsigned long long oldest = ~0ull;
+    for (size_t lane = 0; lane < jobs->batch->lanes; lane++)
+    {
+        if (jobs->job[lane] != NULL && jobs->job[lane]->submitted_ns < oldest)
+        {
+            oldest = jobs->job[lane]->submitted_ns;
+        }
+    }
+    return now_ns() - oldest >= jobs->max_latency_ns;
+}
+
+/* Hashes while every lane has work, and with lanes left empty once forced or a job is overdue. Jobs
+ * that callbacks submit start the next round. */
+static void run(struct sha256_jobs *jobs, bool force)
+{
+    do
+    {
+        fill_lanes(jobs);
+        while (jobs->active == jobs->batch->lanes)
+        {
+            step(jobs);
+        }
+        if (force || latency_exceeded(jobs))
+        {
+            drain(jobs);
+        }
+        deliver(jobs);
+    } while (jobs->pending_head != NULL);
+}
+
+bool sha256_jobs_create(struct sha256_jobs **jobs, const struct sha256_jobs_options *options)
+{
+    struct sha256_jobs_options defaults = {NULL, NULL, 0, NULL};
+    const struct sha256_batch_backend *batch;
+
+    if (options == NULL)
+    {
+        options = &defaults;
+    }
+    batch = options->backend != NULL ? sha256_find_batch_backend(options->backend) : sha256_batch_dispatch();
+    if (batch == NULL)
+    {
+        errno = ENOENT;
+        return false;
+    }
+
+    size_t size = (sizeof(**jobs) + 63) / 64 * 64;
+    *jobs = aligned_alloc(64, size);
+    if (*jobs == NULL)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+
+    memset(*jobs, 0, size);
+    for (size_t lane = 0; lane < batch->lanes; lane++)
+    {
+        (*jobs)->idle[lane] = (unsigned char)(batch->lanes - 1 - lane);
+    }
+    (*jobs)->idle_count = batch->lanes;
+    (*jobs)->batch = batch;
+    (*jobs)->complete = options->complete;
+    (*jobs)->argument = options->argument;
+    (*jobs)->max_latency_ns = options->max_latency_ns;
+    return true;
+}
+
+void sha256_jobs_destroy(struct sha256_jobs *jobs)
+{
+    if (jobs != NULL)
+    {
+        sha256_jobs_flush(jobs);
+        free(jobs);
+    }
+}
+
+void sha256_jobs_submit(struct sha256_jobs *jobs, struct sha256_job *job)
+{
+    job->submitted_ns = jobs->max_latency_ns != 0 ? now_ns() : 0;
+    jobs->in_flight++;
+    push(&jobs->pending_head, &jobs->pending_tail, job);
+
+    /* Inside a callback the call that is delivering picks it up */
+    if (!jobs->delivering)
+    {
+        run(jobs, false);
+    }
+}
+
+void sha256_jobs_poll(struct sha256_jobs *jobs)
+{
+    if (!jobs->delivering)
+    {
+        run(jobs, false);
+    }
+}
+
+void sha256_jobs_flush(struct sha256_jobs *jobs)
+{
+    if (!jobs->delivering)
+    {
+        run(jobs, true);
+    }
+}
+
+struct sha256_job *sha256_jobs_completed(struct sha256_jobs *jobs)
+{
+    return pop(&jobs->completed_head, &jobs->completed_tail);
+}
+
+size_t sha256_jobs_in_flight(const struct sha256_jobs *jobs)
+{
+    return jobs->in_flight;
+}
+
+size_t sha256_jobs_lanes(const struct sha256_jobs *jobs)
+{
+    return jobs->batch->lanes;
+}
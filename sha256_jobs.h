@@ -0,0 +1,72 @@
+#ifndef SHA256_JOBS_H
+#define SHA256_JOBS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sha256.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Multi-buffer hashing for messages that arrive one at a time. Submitted jobs are spread over the lanes
+ * of the batch kernel, which runs whenever every lane has work; a lane whose message is done takes the
+ * next job at once. A manager belongs to one thread. */
+
+struct sha256_jobs;
+
+struct sha256_job
+{
+    /* Set up by the caller with sha256_init, or holding a message hashed so far with sha256_update or by
+     * a completed job with more */
+    struct SHA256 context;
+    /* Bytes to add, which must stay valid until the job completes */
+    const unsigned char *data;
+    size_t length;
+    /* More data follows: the job ends like sha256_update, with context ready for the next job, and
+     * digest is not written */
+    bool more;
+    unsigned char digest[32];
+    void *user;
+
+    /* Owned by the manager from submit until completion */
+    struct sha256_job *next;
+    unsigned long long submitted_ns;
+};
+
+struct sha256_jobs_options
+{
+    /* Called for every finished job in completion order; NULL queues them for sha256_jobs_completed.
+     * It may submit more jobs, which the running call then hashes; poll and flush do nothing there. */
+    void (*complete)(struct sha256_job *job, void *argument);
+    void *argument;
+    /* Longest a job waits for the lanes to fill before submit or poll hash with lanes left empty;
+     * 0 waits for flush */
+    unsigned long long max_latency_ns;
+    /* One of sha256_supported_batch_backend, NULL for the one sha256_hash_many uses */
+    const char *backend;
+};
+
+/* Returns false with errno set, ENOENT for an unknown backend */
+bool sha256_jobs_create(struct sha256_jobs **jobs, const struct sha256_jobs_options *options);
+/* Flushes, so every job still in flight completes first */
+void sha256_jobs_destroy(struct sha256_jobs *jobs);
+
+void sha256_jobs_submit(struct sha256_jobs *jobs, struct sha256_job *job);
+/* Enforces max_latency_ns; an event loop calls this when it has nothing to submit */
+void sha256_jobs_poll(struct sha256_jobs *jobs);
+/* Completes every job in flight, with lanes left empty as needed */
+void sha256_jobs_flush(struct sha256_jobs *jobs);
+/* The next queued completed job, NULL when there is none */
+struct sha256_job *sha256_jobs_completed(struct sha256_jobs *jobs);
+
+/* Jobs submitted and not yet completed, and the lanes they share */
+size_t sha256_jobs_in_flight(const struct sha256_jobs *jobs);
+size_t sha256_jobs_lanes(const struct sha256_jobs *jobs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,769 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sha256_internal.h"
+#include "sha256_simd.h"
+
+/* Multi-lane kernels run the 64 rounds of 8 (AVX2) or 16 (AVX-512) independent messages at once.
+ * Each vector holds the same state or schedule word of every lane, so the message blocks are
+ * transposed from one-row-per-lane into one-row-per-word before the rounds. */
+
+/* Loads 32 bytes at offset from every lane and transposes them into schedule words w[0..7] */
+static TARGET_AVX2 inline void load_words_x8(__m256i w[8], const unsigned char *const *data, size_t offset)
+{
+    const __m256i _mask = _mm256_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL, 0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m256i r[8], t[8];
+
+    for (int i = 0; i < 8; i++)
+    {
+        r[i] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(data[i] + offset)), _mask);
+    }
+
+    for (int i = 0; i < 8; i += 2)
+    {
+        t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+        t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+    }
+
+    for (int i = 0; i < 8; i += 4)
+    {
+        r[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+        r[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+        r[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+        r[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        w[i] = _mm256_permute2x128_si256(r[i], r[i + 4], 0x20);
+        w[i + 4] = _mm256_permute2x128_si256(r[i], r[i + 4], 0x31);
+    }
+}
+
+#define ROUND_X8(a, b, c, d, e, f, g, h, i)                                                                            \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        __m256i _t1 = add3_x8(h, SIG1_x8(e), ch_x8(e, f, g));                                                          \
+        _t1 = add3_x8(_t1, _mm256_set1_epi32(CONSTANTS[i]), w[(i) & 15]);                                             \
+        d = _mm256_add_epi32(d, _t1);                                                                                  \
+        h = add3_x8(_t1, SIG0_x8(a), maj_x8(a, b, c));                                                                 \
+    } while (0)
+
+#define EXPAND_X8(i)                                                                                                   \
+    (w[(i) & 15] = add3_x8(w[(i) & 15], sig0_x8(w[((i) + 1) & 15]),                                                    \
+                           _mm256_add_epi32(w[((i) + 9) & 15], sig1_x8(w[((i) + 14) & 15]))))
+
+static TARGET_AVX2 void process_blocks_avx2_x8(struct sha256_lanes *lanes, const unsigned char *const *data, size_t count)
+{
+    __m256i a = _mm256_load_si256((const __m256i *)lanes->state[0]);
+    __m256i b = _mm256_load_si256((const __m256i *)lanes->state[1]);
+    __m256i c = _mm256_load_si256((const __m256i *)lanes->state[2]);
+    __m256i d = _mm256_load_si256((const __m256i *)lanes->state[3]);
+    __m256i e = _mm256_load_si256((const __m256i *)lanes->state[4]);
+    __m256i f = _mm256_load_si256((const __m256i *)lanes->state[5]);
+    __m256i g = _mm256_load_si256((const __m256i *)lanes->state[6]);
+    __m256i h = _mm256_load_si256((const __m256i *)lanes->state[7]);
+    __m256i w[16];
+
+    for (size_t offset = 0; offset < count * 64; offset += 64)
+    {
+        __m256i a_save = a, b_save = b, c_save = c, d_save = d;
+        __m256i e_save = e, f_save = f, g_save = g, h_save = h;
+
+        load_words_x8(&w[0], data, offset);
+        load_words_x8(&w[8], data, offset + 32);
+
+        for (int i = 0; i < 16; i += 8)
+        {
+            ROUND_X8(a, b, c, d, e, f, g, h, i + 0);
+            ROUND_X8(h, a, b, c, d, e, f, g, i + 1);
+            ROUND_X8(g, h, a, b, c, d, e, f, i + 2);
+            ROUND_X8(f, g, h, a, b, c, d, e, i + 3);
+            ROUND_X8(e, f, g, h, a, b, c, d, i + 4);
+            ROUND_X8(d, e, f, g, h, a, b, c, i + 5);
+            ROUND_X8(c, d, e, f, g, h, a, b, i + 6);
+            ROUND_X8(b, c, d, e, f, g, h, a, i + 7);
+        }
+
+        for (int i = 16; i < 64; i += 8)
+        {
+            EXPAND_X8(i + 0);
+            ROUND_X8(a, b, c, d, e, f, g, h, i + 0);
+            EXPAND_X8(i + 1);
+            ROUND_X8(h, a, b, c, d, e, f, g, i + 1);
+            EXPAND_X8(i + 2);
+            ROUND_X8(g, h, a, b, c, d, e, f, i + 2);
+            EXPAND_X8(i + 3);
+            ROUND_X8(f, g, h, a, b, c, d, e, i + 3);
+            EXPAND_X8(i + 4);
+            ROUND_X8(e, f, g, h, a, b, c, d, i + 4);
+            EXPAND_X8(i + 5);
+            ROUND_X8(d, e, f, g, h, a, b, c, i + 5);
+            EXPAND_X8(i + 6);
+            ROUND_X8(c, d, e, f, g, h, a, b, i + 6);
+            EXPAND_X8(i + 7);
+            ROUND_X8(b, c, d, e, f, g, h, a, i + 7);
+        }
+
+        a = _mm256_add_epi32(a, a_save);
+        b = _mm256_add_epi32(b, b_save);
+        c = _mm256_add_epi32(c, c_save);
+        d = _mm256_add_epi32(d, d_save);
+        e = _mm256_add_epi32(e, e_save);
+        f = _mm256_add_epi32(f, f_save);
+        g = _mm256_add_epi32(g, g_save);
+        h = _mm256_add_epi32(h, h_save);
+    }
+
+    _mm256_store_si256((__m256i *)lanes->state[0], a);
+    _mm256_store_si256((__m256i *)lanes->state[1], b);
+    _mm256_store_si256((__m256i *)lanes->state[2], c);
+    _mm256_store_si256((__m256i *)lanes->state[3], d);
+    _mm256_store_si256((__m256i *)lanes->state[4], e);
+    _mm256_store_si256((__m256i *)lanes->state[5], f);
+    _mm256_store_si256((__m256i *)lanes->state[6], g);
+    _mm256_store_si256((__m256i *)lanes->state[7], h);
+}
+
+/* Loads a whole 64-byte block from every lane and transposes it into schedule words w[0..15] */
+static TARGET_AVX512 inline void load_words_x16(__m512i w[16], const unsigned char *const *data, size_t offset)
+{
+    const __m512i _mask = _mm512_set4_epi32(0x0c0d0e0f, 0x08090a0b, 0x04050607, 0x00010203);
+    __m512i t[16];
+
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = _mm512_shuffle_epi8(_mm512_loadu_si512((const void *)(data[i] + offset)), _mask);
+    }
+
+    for (int i = 0; i < 16; i += 2)
+    {
+        t[i] = _mm512_unpacklo_epi32(w[i], w[i + 1]);
+        t[i + 1] = _mm512_unpackhi_epi32(w[i], w[i + 1]);
+    }
+
+    for (int i = 0; i < 16; i += 4)
+    {
+        w[i] = _mm512_unpacklo_epi64(t[i], t[i + 2]);
+        w[i + 1] = _mm512_unpackhi_epi64(t[i], t[i + 2]);
+        w[i + 2] = _mm512_unpacklo_epi64(t[i + 1], t[i + 3]);
+        w[i + 3] = _mm512_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+
+    for (int i = 0; i < 16; i += 8)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            t[i + j] = _mm512_shuffle_i32x4(w[i + j], w[i + j + 4], 0x88);
+            t[i + j + 4] = _mm512_shuffle_i32x4(w[i + j], w[i + j + 4], 0xDD);
+        }
+    }
+
+    for (int i = 0; i < 8; i++)
+    {
+        w[i] = _mm512_shuffle_i32x4(t[i], t[i + 8], 0x88);
+        w[i + 8] = _mm512_shuffle_i32x4(t[i], t[i + 8], 0xDD);
+    }
+}
+
+#define ROUND_X16(a, b, c, d, e, f, g, h, i)                                                                           \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        __m512i _t1 = add3_x16(h, SIG1_x16(e), ch_x16(e, f, g));                                                       \
+        _t1 = add3_x16(_t1, _mm512_set1_epi32(CONSTANTS[i]), w[(i) & 15]);                                            \
+        d = _mm512_add_epi32(d, _t1);                                                                                  \
+        h = add3_x16(_t1, SIG0_x16(a), maj_x16(a, b, c));                                                              \
+    } while (0)
+
+#define EXPAND_X16(i)                                                                                                  \
+    (w[(i) & 15] = add3_x16(w[(i) & 15], sig0_x16(w[((i) + 1) & 15]),                                                  \
+                            _mm512_add_epi32(w[((i) + 9) & 15], sig1_x16(w[((i) + 14) & 15]))))
+
+static TARGET_AVX512 void process_blocks_avx512_x16(struct sha256_lanes *lanes, const unsigned char *const *data, size_t count)
+{
+    __m512i a = _mm512_load_si512((const void *)lanes->state[0]);
+    __m512i b = _mm512_load_si512((const void *)lanes->state[1]);
+    __m512i c = _mm512_load_si512((const void *)lanes->state[2]);
+    __m512i d = _mm512_load_si512((const void *)lanes->state[3]);
+    __m512i e = _mm512_load_si512((const void *)lanes->state[4]);
+    __m512i f = _mm512_load_si512((const void *)lanes->state[5]);
+    __m512i g = _mm512_load_si512((const void *)lanes->state[6]);
+    __m512i h = _mm512_load_si512((const void *)lanes->state[7]);
+    __m512i w[16];
+
+    for (size_t offset = 0; offset < count * 64; offset += 64)
+    {
+        __m512i a_save = a, b_save = b, c_save = c, d_save = d;
+        __m512i e_save = e, f_save = f, g_save = g, h_save = h;
+
+        load_words_x16(w, data, offset);
+
+        for (int i = 0; i < 16; i += 8)
+        {
+            ROUND_X16(a, b, c, d, e, f, g, h, i + 0);
+            ROUND_X16(h, a, b, c, d, e, f, g, i + 1);
+            ROUND_X16(g, h, a, b, c, d, e, f, i + 2);
+            ROUND_X16(f, g, h, a, b, c, d, e, i + 3);
+            ROUND_X16(e, f, g, h, a, b, c, d, i + 4);
+            ROUND_X16(d, e, f, g, h, a, b, c, i + 5);
+            ROUND_X16(c, d, e, f, g, h, a, b, i + 6);
+            ROUND_X16(b, c, d, e, f, g, h, a, i + 7);
+        }
+
+        for (int i = 16; i < 64; i += 8)
+        {
+            EXPAND_X16(i + 0);
+            ROUND_X16(a, b, c, d, e, f, g, h, i + 0);
+            EXPAND_X16(i + 1);
+            ROUND_X16(h, a, b, c, d, e, f, g, i + 1);
+            EXPAND_X16(i + 2);
+            ROUND_X16(g, h, a, b, c, d, e, f, i + 2);
+            EXPAND_X16(i + 3);
+            ROUND_X16(f, g, h, a, b, c, d, e, i + 3);
+            EXPAND_X16(i + 4);
+            ROUND_X16(e, f, g, h, a, b, c, d, i + 4);
+            EXPAND_X16(i + 5);
+            ROUND_X16(d, e, f, g, h, a, b, c, i + 5);
+            EXPAND_X16(i + 6);
+            ROUND_X16(c, d, e, f, g, h, a, b, i + 6);
+            EXPAND_X16(i + 7);
+            ROUND_X16(b, c, d, e, f, g, h, a, i + 7);
+        }
+
+        a = _mm512_add_epi32(a, a_save);
+        b = _mm512_add_epi32(b, b_save);
+        c = _mm512_add_epi32(c, c_save);
+        d = _mm512_add_epi32(d, d_save);
+        e = _mm512_add_epi32(e, e_save);
+        f = _mm512_add_epi32(f, f_save);
+        g = _mm512_add_epi32(g, g_save);
+        h = _mm512_add_epi32(h, h_save);
+    }
+
+    _mm512_store_si512((void *)lanes->state[0], a);
+    _mm512_store_si512((void *)lanes->state[1], b);
+    _mm512_store_si512((void *)lanes->state[2], c);
+    _mm512_store_si512((void *)lanes->state[3], d);
+    _mm512_store_si512((void *)lanes->state[4], e);
+    _mm512_store_si512((void *)lanes->state[5], f);
+    _mm512_store_si512((void *)lanes->state[6], g);
+    _mm512_store_si512((void *)lanes->state[7], h);
+}
+
+/* SHA-NI processes one message per instruction stream and each sha256rnds2 waits for the previous one,
+ * so 2 or 4 independent messages are advanced in lockstep to fill the latency of the SHA unit.
+ * The loops over lanes have a constant trip count and are fully unrolled into interleaved code. */
+static TARGET_SHA ALWAYS_INLINE void process_blocks_shani_xn(struct sha256_lanes *lanes, const unsigned char *const *data, size_t count, int n)
+{
+    __m128i _state0[4], _state1[4];
+    __m128i _abef_save[4], _cdgh_save[4];
+    __m128i _msg[4][4], _wk[4], _tmp;
+    const __m128i _mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+#pragma GCC unroll 4
+
+    for (int l = 0; l < n; l++)
+    {
+        _state0[l] = _mm_set_epi32(lanes->state[0][l], lanes->state[1][l], lanes->state[4][l], lanes->state[5][l]); /* ABEF */
+        _state1[l] = _mm_set_epi32(lanes->state[2][l], lanes->state[3][l], lanes->state[6][l], lanes->state[7][l]); /* CDGH */
+    }
+
+    for (size_t offset = 0; offset < count * 64; offset += 64)
+    {
+#pragma GCC unroll 4
+        for (int l = 0; l < n; l++)
+        {
+            _abef_save[l] = _state0[l];
+            _cdgh_save[l] = _state1[l];
+        }
+
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; i++)
+        {
+            const __m128i _k = _mm_loadu_si128((const __m128i *)&CONSTANTS[4 * i]);
+#pragma GCC unroll 4
+
+            for (int l = 0; l < n; l++)
+            {
+                if (i < 4)
+                {
+                    _msg[l][i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data[l] + offset + 16 * i)), _mask);
+                }
+
+                _wk[l] = _mm_add_epi32(_msg[l][i & 3], _k);
+                _state1[l] = _mm_sha256rnds2_epu32(_state1[l], _state0[l], _wk[l]);
+
+                if (i >= 3 && i < 15)
+                {
+                    _tmp = _mm_alignr_epi8(_msg[l][i & 3], _msg[l][(i - 1) & 3], 4);
+                    _msg[l][(i + 1) & 3] = _mm_add_epi32(_msg[l][(i + 1) & 3], _tmp);
+                    _msg[l][(i + 1) & 3] = _mm_sha256msg2_epu32(_msg[l][(i + 1) & 3], _msg[l][i & 3]);
+                }
+
+                _wk[l] = _mm_shuffle_epi32(_wk[l], 0x0E);
+                _state0[l] = _mm_sha256rnds2_epu32(_state0[l], _state1[l], _wk[l]);
+
+                if (i >= 1 && i < 13)
+                {
+                    _msg[l][(i - 1) & 3] = _mm_sha256msg1_epu32(_msg[l][(i - 1) & 3], _msg[l][i & 3]);
+                }
+            }
+        }
+#pragma GCC unroll 4
+
+        for (int l = 0; l < n; l++)
+        {
+            _state0[l] = _mm_add_epi32(_state0[l], _abef_save[l]);
+            _state1[l] = _mm_add_epi32(_state1[l], _cdgh_save[l]);
+        }
+    }
+#pragma GCC unroll 4
+
+    for (int l = 0; l < n; l++)
+    {
+        lanes->state[0][l] = _mm_extract_epi32(_state0[l], 3);
+        lanes->state[1][l] = _mm_extract_epi32(_state0[l], 2);
+        lanes->state[4][l] = _mm_extract_epi32(_state0[l], 1);
+        lanes->state[5][l] = _mm_extract_epi32(_state0[l], 0);
+        lanes->state[2][l] = _mm_extract_epi32(_state1[l], 3);
+        lanes->state[3][l] = _mm_extract_epi32(_state1[l], 2);
+        lanes->state[6][l] = _mm_extract_epi32(_state1[l], 1);
+        lanes->state[7][l] = _mm_extract_epi32(_state1[l], 0);
+    }
+}
+
+static TARGET_SHA void process_blocks_shani_x2(struct sha256_lanes *lanes, const unsigned char *const *data, size_t count)
+{
+    process_blocks_shani_xn(lanes, data, count, 2);
+}
+
+static TARGET_SHA void process_blocks_shani_x4(struct sha256_lanes *lanes, const unsigned char *const *data, size_t count)
+{
+    process_blocks_shani_xn(lanes, data, count, 4);
+}
+
+/* One lane through the single-stream backend, for cpus without wide vectors */
+static void process_blocks_serial(struct sha256_lanes *lanes, const unsigned char *const *data, size_t count)
+{
+    unsigned int state[8];
+
+    for (int i = 0; i < 8; i++)
+    {
+        state[i] = lanes->state[i][0];
+    }
+
+    sha256_process_blocks(state, data[0], count);
+
+    for (int i = 0; i < 8; i++)
+    {
+        lanes->state[i][0] = state[i];
+    }
+}
+
+/* Ordered by preference: the first supported entry wins unless SHA256_BATCH_BACKEND names another one. */
+static const struct sha256_batch_backend BATCH_BACKENDS[] = {
+#if USE_CPU_EXTENSIONS
+    {"avx512", cpu_supports_avx512, 16, process_blocks_avx512_x16},
+    {"shani_x4", cpu_supports_sha256_extensions, 4, process_blocks_shani_x4},
+    {"shani_x2", cpu_supports_sha256_extensions, 2, process_blocks_shani_x2},
+    {"avx2", cpu_supports_avx2, 8, process_blocks_avx2_x8},
+#endif
+    {"serial", cpu_supports_scalar, 1, process_blocks_serial},
+};
+
+#define BATCH_BACKENDS_COUNT (sizeof(BATCH_BACKENDS) / sizeof(BATCH_BACKENDS[0]))
+
+/* NULL until the first batch; atomic because that may come on several threads at once */
+static _Atomic(const struct sha256_batch_backend *) batch_backend = NULL;
+
+const struct sha256_batch_backend *sha256_find_batch_backend(const char *name)
+{
+    for (size_t i = 0; i < BATCH_BACKENDS_COUNT; i++)
+    {
+        if (strcmp(BATCH_BACKENDS[i].name, name) == 0 && BATCH_BACKENDS[i].supported())
+        {
+            return &BATCH_BACKENDS[i];
+        }
+    }
+    return NULL;
+}
+
+#define CALIBRATION_BLOCKS 8
+#define CALIBRATION_RUNS 4
+
+/* Best observed cycles per lane and block, scaled by SHA256_MAX_LANES to stay integral */
+static unsigned long long calibrate_batch_backend(const struct sha256_batch_backend *candidate)
+{
+    static const unsigned char block[CALIBRATION_BLOCKS * 64] = {0};
+    const unsigned char *data[SHA256_MAX_LANES];
+    struct sha256_lanes lanes;
+    unsigned long long best = 0;
+
+    memset(&lanes, 0, sizeof(lanes));
+    for (size_t lane = 0; lane < SHA256_MAX_LANES; lane++)
+    {
+        data[lane] = block;
+    }
+
+    /* The first run only warms up caches and the vector unit */
+    for (int run = 0; run <= CALIBRATION_RUNS; run++)
+    {
+        unsigned long long start = __rdtsc();
+        candidate->process_blocks_many(&lanes, data, CALIBRATION_BLOCKS);
+        unsigned long long cycles = (__rdtsc() - start) * SHA256_MAX_LANES / candidate->lanes;
+
+        if (run > 0 && (best == 0 || cycles < best))
+        {
+            best = cycles;
+        }
+    }
+    return best;
+}
+
+static const struct sha256_batch_backend *select_batch_backend()
+{
+    const char *name = getenv("SHA256_BATCH_BACKEND");
+
+    if (name != NULL && name[0] != '\0')
+    {
+        const struct sha256_batch_backend *forced = sha256_find_batch_backend(name);
+        if (forced != NULL)
+        {
+            return forced;
+        }
+        fprintf(stderr, "sha256: batch backend \"%s\" is unknown or not supported by this cpu, ignoring SHA256_BATCH_BACKEND\n", name);
+    }
+
+    /* Whether interleaved SHA-NI beats wide vectors depends on the sha256rnds2 throughput of the core,
+     * so the supported kernels are timed once and the cheapest per block wins; table order breaks ties. */
+    const struct sha256_batch_backend *best = NULL;
+    unsigned long long best_cycles = 0;
+
+    for (size_t i = 0; i < BATCH_BACKENDS_COUNT; i++)
+    {
+        if (BATCH_BACKENDS[i].supported())
+        {
+            unsigned long long cycles = calibrate_batch_backend(&BATCH_BACKENDS[i]);
+            if (best == NULL || cycles < best_cycles)
+            {
+                best = &BATCH_BACKENDS[i];
+                best_cycles = cycles;
+            }
+        }
+    }
+    return best;
+}
+
+/* Threads racing on the first batch may each calibrate and time the kernels differently; the first
+ * choice installed wins and the others adopt it, as does one that lost to sha256_set_batch_backend. */
+const struct sha256_batch_backend *sha256_batch_dispatch()
+{
+    const struct sha256_batch_backend *current = atomic_load_explicit(&batch_backend, memory_order_acquire);
+    if (current == NULL)
+    {
+        const struct sha256_batch_backend *selected = select_batch_backend();
+        if (atomic_compare_exchange_strong_explicit(&batch_backend, &current, selected, memory_order_acq_rel, memory_order_acquire))
+        {
+            current = selected;
+        }
+    }
+    return current;
+}
+
+const char *sha256_batch_backend()
+{
+    return sha256_batch_dispatch()->name;
+}
+
+const char *sha256_supported_batch_backend(size_t index)
+{
+    for (size_t i = 0; i < BATCH_BACKENDS_COUNT; i++)
+    {
+        if (BATCH_BACKENDS[i].supported() && index-- == 0)
+        {
+            return BATCH_BACKENDS[i].name;
+        }
+    }
+    return NULL;
+}
+
+bool sha256_set_batch_backend(const char *name)
+{
+    const struct sha256_batch_backend *forced = sha256_find_batch_backend(name);
+    if (forced == NULL)
+    {
+        return false;
+    }
+    atomic_store_explicit(&batch_backend, forced, memory_order_release);
+    return true;
+}
+
+/* Builds the padded final block(s) of a message in tail and returns how many there are */
+size_t sha256_pad_tail(unsigned char tail[128], const unsigned char *input, size_t tail_length, size_t length)
+{
+    size_t blocks = tail_length < 56 ? 1 : 2;
+    unsigned long long bits_count = _byteswap_uint64((unsigned long long)length * 8);
+
+    memcpy(tail, input, tail_length);
+    tail[tail_length] = 0x80;
+    memset(tail + tail_length + 1, 0, blocks * 64 - 8 - tail_length - 1);
+    memcpy(tail + blocks * 64 - 8, &bits_count, 8);
+    return blocks;
+}
+
+void sha256_hash_many(const unsigned char *const *messages, size_t length, size_t count, unsigned char (*digests)[32])
+{
+    const struct sha256_batch_backend *batch = sha256_batch_dispatch();
+    size_t full_blocks = length / 64;
+    size_t tail_length = length % 64;
+    ALIGNED(64) unsigned char tails[SHA256_MAX_LANES][128];
+    const unsigned char *data[SHA256_MAX_LANES];
+    struct sha256_lanes lanes;
+    size_t tail_blocks = 0;
+
+    for (size_t first = 0; first < count; first += batch->lanes)
+    {
+        size_t used = count - first < batch->lanes ? count - first : batch->lanes;
+
+        /* A mostly empty vector costs more than hashing the last few messages one by one */
+        if (used * 2 < batch->lanes)
+        {
+            for (size_t i = first; i < count; i++)
+            {
+                struct SHA256 context;
+                sha256_init(&context);
+                sha256_update(&context, messages[i], length);
+                sha256_complete(digests[i], &context);
+            }
+            break;
+        }
+
+        /* Idle lanes repeat the last message so every lane reads valid memory; their results are dropped */
+        for (size_t lane = 0; lane < batch->lanes; lane++)
+        {
+            data[lane] = messages[first + (lane < used ? lane : used - 1)];
+            for (int i = 0; i < 8; i++)
+            {
+                lanes.state[i][lane] = INITIAL_STATE[i];
+            }
+        }
+
+        if (full_blocks > 0)
+        {
+            batch->process_blocks_many(&lanes, data, full_blocks);
+        }
+
+        for (size_t lane = 0; lane < batch->lanes; lane++)
+        {
+            if (lane < used)
+            {
+                tail_blocks = sha256_pad_tail(tails[lane], data[lane] + full_blocks * 64, tail_length, length);
+            }
+            data[lane] = tails[lane < used ? lane : used - 1];
+        }
+
+        batch->process_blocks_many(&lanes, data, tail_blocks);
+
+        for (size_t lane = 0; lane < used; lane++)
+        {
+            unsigned int state[8];
+            for (int i = 0; i < 8; i++)
+            {
+                state[i] = lanes.state[i][lane];
+            }
+            store_digest(digests[first + lane], state);
+        }
+    }
+}
+
+/* Runs a lane's message to the end through the single-stream path */
+static void finish_lane(unsigned char digest[32], const struct sha256_lanes *lanes, size_t lane, const unsigned char *data,
+                        size_t blocks, const unsigned char *message, size_t length, bool tail_next)
+{
+    ALIGNED(64) unsigned char tail[128];
+    unsigned int state[8];
+
+    for (int i = 0; i < 8; i++)
+    {
+        state[i] = lanes->state[i][lane];
+    }
+    if (blocks > 0)
+    {
+        sha256_process_blocks(state, data, blocks);
+    }
+    if (tail_next)
+    {
+        sha256_process_blocks(state, tail, sha256_pad_tail(tail, message + length / 64 * 64, length % 64, length));
+    }
+    store_digest(digest, state);
+}
+
+void sha256_hash_many_lengths(const unsigned char *const *messages, const size_t *lengths, size_t count, unsigned char (*digests)[32])
+{
+    const struct sha256_batch_backend *batch = sha256_batch_dispatch();
+    ALIGNED(64) unsigned char tails[SHA256_MAX_LANES][128];
+    const unsigned char *data[SHA256_MAX_LANES];
+    /* Per lane: the message it hashes (count when idle), blocks left in the current run of contiguous
+     * blocks, and whether the padded tail still follows that run */
+    size_t message[SHA256_MAX_LANES];
+    size_t blocks[SHA256_MAX_LANES];
+    bool tail_next[SHA256_MAX_LANES];
+    struct sha256_lanes lanes;
+    size_t next = 0;
+    size_t active = 0;
+
+    for (size_t lane = 0; lane < batch->lanes; lane++)
+    {
+        message[lane] = count;
+        blocks[lane] = 0;
+        tail_next[lane] = false;
+    }
+
+    for (;;)
+    {
+        /* A lane moves from its full blocks to its tail, and once that is done takes the next message */
+        for (size_t lane = 0; lane < batch->lanes; lane++)
+        {
+            while (blocks[lane] == 0)
+            {
+                size_t m = message[lane];
+
+                if (m < count && tail_next[lane])
+                {
+                    blocks[lane] = sha256_pad_tail(tails[lane], messages[m] + lengths[m] / 64 * 64, lengths[m] % 64, lengths[m]);
+                    data[lane] = tails[lane];
+                    tail_next[lane] = false;
+                    continue;
+                }
+                if (m < count)
+                {
+                    unsigned int state[8];
+                    for (int i = 0; i < 8; i++)
+                    {
+                        state[i] = lanes.state[i][lane];
+                    }
+                    store_digest(digests[m], state);
+                    message[lane] = count;
+                    active--;
+                }
+                if (next == count)
+                {
+                    break;
+                }
+
+                message[lane] = next++;
+                active++;
+                for (int i = 0; i < 8; i++)
+                {
+                    lanes.state[i][lane] = INITIAL_STATE[i];
+                }
+                data[lane] = messages[message[lane]];
+                blocks[lane] = lengths[message[lane]] / 64;
+                tail_next[lane] = true;
+            }
+        }
+
+        if (active == 0)
+        {
+            break;
+        }
+
+        /* Once the queue is drained a mostly empty vector costs more than finishing lanes one by one */
+        if (active * 2 < batch->lanes)
+        {
+            for (size_t lane = 0; lane < batch->lanes; lane++)
+            {
+                size_t m = message[lane];
+                if (m < count)
+                {
+                    finish_lane(digests[m], &lanes, lane, data[lane], blocks[lane], messages[m], lengths[m], tail_next[lane]);
+                }
+            }
+            break;
+        }
+
+        /* Every lane advances by the shortest remaining run; idle lanes shadow a busy one */
+        size_t step = 0;
+        size_t busy = 0;
+        for (size_t lane = 0; lane < batch->lanes; lane++)
+        {
+            if (message[lane] < count && (step == 0 || blocks[lane] < step))
+            {
+                step = blocks[lane];
+                busy = lane;
+            }
+        }
+        for (size_t lane = 0; lane < batch->lanes; lane++)
+        {
+            if (message[lane] == count)
+            {
+                data[lane] = data[busy];
+            }
+        }
+
+        batch->process_blocks_many(&lanes, data, step);
+
+        for (size_t lane = 0; lane < batch->lanes; lane++)
+        {
+            if (message[lane] < count)
+            {
+                data[lane] += step * 64;
+                blocks[lane] -= step;
+            }
+        }
+    }
+}
+
+/* Second block of every 64-byte message: 0x80, zeros, 512 bits */
+static const unsigned char PADDING_64_BLOCK[64] = {0x80, [62] = 0x02};
+
+void sha256_64_many(unsigned char (*digests)[32], const unsigned char (*inputs)[64], size_t count)
+{
+    const struct sha256_batch_backend *batch = sha256_batch_dispatch();
+    const unsigned char *data[SHA256_MAX_LANES];
+    struct sha256_lanes lanes;
+
+    for (size_t first = 0; first < count; first += batch->lanes)
+    {
+        size_t used = count - first < batch->lanes ? count - first : batch->lanes;
+
+        if (used * 2 < batch->lanes)
+        {
+            for (size_t i = first; i < count; i++)
+            {
+                sha256_64(digests[i], inputs[i]);
+            }
+            break;
+        }
+
+        for (size_t lane = 0; lane < batch->lanes; lane++)
+        {
+            data[lane] = inputs[first + (lane < used ? lane : used - 1)];
+            for (int i = 0; i < 8; i++)
+            {
+                lanes.state[i][lane] = INITIAL_STATE[i];
+            }
+        }
+
+        batch->process_blocks_many(&lanes, data, 1);
+
+        /* Every lane shares the same constant padding block */
+        for (size_t lane = 0; lane < batch->lanes; lane++)
+        {
+            data[lane] = PADDING_64_BLOCK;
+        }
+
+        batch->process_blocks_many(&lanes, data, 1);
+
+        for (size_t lane = 0; lane < used; lane++)
+        {
+            unsigned int state[8];
+            for (int i = 0; i < 8; i++)
+            {
+                state[i] = lanes.state[i][lane];
+            }
+            store_digest(digests[first + lane], state);
+        }
+    }
+}
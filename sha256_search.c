@@ -0,0 +1,695 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sha256_internal.h"
+#include "sha256_search.h"
+#include "sha256_simd.h"
+
+/* Nonces a thread claims at once: small enough to stop soon after a solution, large enough to keep
+ * the claim counter off the profile */
+#define CHUNK_NONCES (64 * 1024)
+#define MAX_THREADS 256
+/* 8 nonce bytes at an odd offset touch three schedule words */
+#define MAX_NONCE_WORDS 3
+
+#define TERM_W16 1
+#define TERM_W15 2
+#define TERM_W7 4
+#define TERM_W2 8
+#define NONCE_WORD 16
+
+/* Everything about the final block that is the same for every nonce */
+struct search_plan
+{
+    unsigned int midstate[8];
+    /* midstate advanced through the rounds before the first nonce word */
+    unsigned int start[8];
+    unsigned int first_round;
+    /* First digest word of the target; a lane at or below it is checked in full */
+    unsigned int target;
+
+    /* Per schedule word: 0 when constant, otherwise NONCE_WORD or the TERM_ bits of the expansion terms
+     * that depend on the nonce */
+    unsigned char varies[64];
+    /* W+K of the constant words, and for the others the constant part of their expansion */
+    unsigned int wk[64];
+    unsigned int partial[64];
+
+    /* The block words holding the nonce with its bytes zeroed, and where each nonce byte goes */
+    unsigned int nonce_base[MAX_NONCE_WORDS];
+    unsigned int nonce_words;
+    size_t nonce_size;
+    size_t nonce_offset;
+    unsigned char nonce_word[8];
+    unsigned char nonce_shift[8];
+
+    /* The padded final block with zero nonce, for kernels that hash whole blocks */
+    unsigned char block[64];
+    const struct sha256_batch_backend *shani;
+};
+
+/* Returns a bit per lane whose first digest word is at most the target, for nonces nonce .. nonce + lanes - 1 */
+typedef unsigned int (*search_function)(const struct search_plan *plan, unsigned long long nonce);
+
+struct search_backend
+{
+    const char *name;
+    bool (*supported)();
+    unsigned int lanes;
+    search_function search;
+};
+
+static unsigned int read_be32(const unsigned char *p)
+{
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+static bool valid_job(const struct sha256_search_job *job)
+{
+    return job->tail_length <= 55 && (job->tail != NULL || job->tail_length == 0) && job->nonce_size >= 4 && job->nonce_size <= 8 &&
+           job->nonce_offset <= job->tail_length && job->tail_length - job->nonce_offset >= job->nonce_size && job->prefix_length % 64 == 0;
+}
+
+static void make_plan(struct search_plan *plan, const struct sha256_search_job *job)
+{
+    unsigned long long bits = (job->prefix_length + job->tail_length) * 8;
+    unsigned int w[64];
+
+    memset(plan, 0, sizeof(*plan));
+    memcpy(plan->midstate, job->midstate, sizeof(plan->midstate));
+    plan->target = read_be32(job->target);
+    plan->nonce_size = job->nonce_size;
+    plan->nonce_offset = job->nonce_offset;
+
+    if (job->tail_length > 0)
+    {
+        memcpy(plan->block, job->tail, job->tail_length);
+    }
+    memset(plan->block + job->nonce_offset, 0, job->nonce_size);
+    plan->block[job->tail_length] = 0x80;
+    for (int i = 0; i < 8; i++)
+    {
+        plan->block[56 + i] = (unsigned char)(bits >> (56 - 8 * i));
+    }
+
+    unsigned int first_word = (unsigned int)(job->nonce_offset / 4);
+    unsigned int last_word = (unsigned int)((job->nonce_offset + job->nonce_size - 1) / 4);
+    plan->first_round = first_word;
+    plan->nonce_words = last_word - first_word + 1;
+    for (size_t k = 0; k < job->nonce_size; k++)
+    {
+        size_t position = job->nonce_offset + k;
+        plan->nonce_word[k] = (unsigned char)(position / 4 - first_word);
+        plan->nonce_shift[k] = (unsigned char)(24 - 8 * (position % 4));
+    }
+
+    for (unsigned int t = 0; t < 16; t++)
+    {
+        w[t] = read_be32(plan->block + 4 * t);
+        plan->varies[t] = t >= first_word && t <= last_word ? NONCE_WORD : 0;
+    }
+    for (unsigned int j = 0; j < plan->nonce_words; j++)
+    {
+        plan->nonce_base[j] = w[first_word + j];
+    }
+
+    /* A word whose terms are all constant is constant; otherwise its constant terms are summed ahead */
+    for (unsigned int t = 16; t < 64; t++)
+    {
+        unsigned char varies = (plan->varies[t - 16] ? TERM_W16 : 0) | (plan->varies[t - 15] ? TERM_W15 : 0) |
+                               (plan->varies[t - 7] ? TERM_W7 : 0) | (plan->varies[t - 2] ? TERM_W2 : 0);
+        unsigned int partial = 0;
+
+        partial += varies & TERM_W16 ? 0 : w[t - 16];
+        partial += varies & TERM_W15 ? 0 : sig0(w[t - 15]);
+        partial += varies & TERM_W7 ? 0 : w[t - 7];
+        partial += varies & TERM_W2 ? 0 : sig1(w[t - 2]);
+        plan->varies[t] = varies;
+        plan->partial[t] = partial;
+        w[t] = partial;
+    }
+    for (unsigned int t = 0; t < 64; t++)
+    {
+        plan->wk[t] = plan->varies[t] ? 0 : w[t] + CONSTANTS[t];
+    }
+
+    unsigned int a = job->midstate[0], b = job->midstate[1], c = job->midstate[2], d = job->midstate[3];
+    unsigned int e = job->midstate[4], f = job->midstate[5], g = job->midstate[6], h = job->midstate[7];
+    for (unsigned int t = 0; t < plan->first_round; t++)
+    {
+        unsigned int t1 = h + SIG1(e) + CH(e, f, g) + plan->wk[t];
+        unsigned int t2 = SIG0(a) + MAJ(a, b, c);
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    plan->start[0] = a;
+    plan->start[1] = b;
+    plan->start[2] = c;
+    plan->start[3] = d;
+    plan->start[4] = e;
+    plan->start[5] = f;
+    plan->start[6] = g;
+    plan->start[7] = h;
+}
+
+static void nonce_words(const struct search_plan *plan, unsigned long long nonce, unsigned int words[MAX_NONCE_WORDS])
+{
+    for (unsigned int j = 0; j < plan->nonce_words; j++)
+    {
+        words[j] = plan->nonce_base[j];
+    }
+    for (size_t k = 0; k < plan->nonce_size; k++)
+    {
+        words[plan->nonce_word[k]] |= (unsigned int)(nonce >> (8 * k) & 0xff) << plan->nonce_shift[k];
+    }
+}
+
+/* Nonce words of consecutive lanes, one row per word. While the low byte does not wrap within the
+ * batch, lanes differ only in that byte. */
+static void lane_words(const struct search_plan *plan, unsigned long long nonce, unsigned int lanes,
+                       unsigned int words[MAX_NONCE_WORDS][SHA256_MAX_LANES])
+{
+    unsigned int base[MAX_NONCE_WORDS];
+
+    if ((nonce & 0xff) + lanes <= 256)
+    {
+        nonce_words(plan, nonce, base);
+        for (unsigned int j = 0; j < plan->nonce_words; j++)
+        {
+            unsigned int shift = j == plan->nonce_word[0] ? plan->nonce_shift[0] : 32;
+            for (unsigned int lane = 0; lane < lanes; lane++)
+            {
+                words[j][lane] = base[j] + (shift < 32 ? lane << shift : 0);
+            }
+        }
+        return;
+    }
+
+    for (unsigned int lane = 0; lane < lanes; lane++)
+    {
+        nonce_words(plan, nonce + lane, base);
+        for (unsigned int j = 0; j < plan->nonce_words; j++)
+        {
+            words[j][lane] = base[j];
+        }
+    }
+}
+
+static unsigned int search_scalar(const struct search_plan *plan, unsigned long long nonce)
+{
+    unsigned int w[64];
+    unsigned int words[MAX_NONCE_WORDS];
+
+    nonce_words(plan, nonce, words);
+    for (unsigned int j = 0; j < plan->nonce_words; j++)
+    {
+        w[plan->first_round + j] = words[j];
+    }
+
+    unsigned int a = plan->start[0], b = plan->start[1], c = plan->start[2], d = plan->start[3];
+    unsigned int e = plan->start[4], f = plan->start[5], g = plan->start[6], h = plan->start[7];
+    for (unsigned int t = plan->first_round; t < 64; t++)
+    {
+        unsigned int varies = plan->varies[t];
+        unsigned int wk = plan->wk[t];
+
+        if (varies != 0)
+        {
+            if (t >= 16)
+            {
+                unsigned int x = plan->partial[t];
+                x += varies & TERM_W16 ? w[t - 16] : 0;
+                x += varies & TERM_W15 ? sig0(w[t - 15]) : 0;
+                x += varies & TERM_W7 ? w[t - 7] : 0;
+                x += varies & TERM_W2 ? sig1(w[t - 2]) : 0;
+                w[t] = x;
+            }
+            wk = w[t] + CONSTANTS[t];
+        }
+
+        unsigned int t1 = h + SIG1(e) + CH(e, f, g) + wk;
+        unsigned int t2 = SIG0(a) + MAJ(a, b, c);
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    return a + plan->midstate[0] <= plan->target;
+}
+
+#if USE_CPU_EXTENSIONS
+/* The vector kernels follow search_scalar line by line; constant words are broadcasts, and the branches
+ * on varies take the same way for every nonce of a search */
+static TARGET_AVX2 unsigned int search_avx2_x8(const struct search_plan *plan, unsigned long long nonce)
+{
+    ALIGNED(64) unsigned int words[MAX_NONCE_WORDS][SHA256_MAX_LANES];
+    __m256i w[64];
+
+    lane_words(plan, nonce, 8, words);
+    for (unsigned int j = 0; j < plan->nonce_words; j++)
+    {
+        w[plan->first_round + j] = _mm256_load_si256((const __m256i *)words[j]);
+    }
+
+    __m256i a = _mm256_set1_epi32(plan->start[0]), b = _mm256_set1_epi32(plan->start[1]);
+    __m256i c = _mm256_set1_epi32(plan->start[2]), d = _mm256_set1_epi32(plan->start[3]);
+    __m256i e = _mm256_set1_epi32(plan->start[4]), f = _mm256_set1_epi32(plan->start[5]);
+    __m256i g = _mm256_set1_epi32(plan->start[6]), h = _mm256_set1_epi32(plan->start[7]);
+    for (unsigned int t = plan->first_round; t < 64; t++)
+    {
+        unsigned int varies = plan->varies[t];
+        __m256i wk;
+
+        if (varies == 0)
+        {
+            wk = _mm256_set1_epi32(plan->wk[t]);
+        }
+        else
+        {
+            if (t >= 16)
+            {
+                __m256i x = _mm256_set1_epi32(plan->partial[t]);
+                x = varies & TERM_W16 ? _mm256_add_epi32(x, w[t - 16]) : x;
+                x = varies & TERM_W15 ? _mm256_add_epi32(x, sig0_x8(w[t - 15])) : x;
+                x = varies & TERM_W7 ? _mm256_add_epi32(x, w[t - 7]) : x;
+                x = varies & TERM_W2 ? _mm256_add_epi32(x, sig1_x8(w[t - 2])) : x;
+                w[t] = x;
+            }
+            wk = _mm256_add_epi32(w[t], _mm256_set1_epi32(CONSTANTS[t]));
+        }
+
+        __m256i t1 = add3_x8(h, SIG1_x8(e), _mm256_add_epi32(ch_x8(e, f, g), wk));
+        __m256i t2 = _mm256_add_epi32(SIG0_x8(a), maj_x8(a, b, c));
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi32(t1, t2);
+    }
+
+    /* AVX2 only compares signed, so both sides are shifted by 2^31 */
+    const __m256i sign = _mm256_set1_epi32((int)0x80000000);
+    __m256i top = _mm256_xor_si256(_mm256_add_epi32(a, _mm256_set1_epi32(plan->midstate[0])), sign);
+    __m256i above = _mm256_cmpgt_epi32(top, _mm256_xor_si256(_mm256_set1_epi32(plan->target), sign));
+    return ~(unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(above)) & 0xff;
+}
+
+static TARGET_AVX512 unsigned int search_avx512_x16(const struct search_plan *plan, unsigned long long nonce)
+{
+    ALIGNED(64) unsigned int words[MAX_NONCE_WORDS][SHA256_MAX_LANES];
+    __m512i w[64];
+
+    lane_words(plan, nonce, 16, words);
+    for (unsigned int j = 0; j < plan->nonce_words; j++)
+    {
+        w[plan->first_round + j] = _mm512_load_si512((const void *)words[j]);
+    }
+
+    __m512i a = _mm512_set1_epi32(plan->start[0]), b = _mm512_set1_epi32(plan->start[1]);
+    __m512i c = _mm512_set1_epi32(plan->start[2]), d = _mm512_set1_epi32(plan->start[3]);
+    __m512i e = _mm512_set1_epi32(plan->start[4]), f = _mm512_set1_epi32(plan->start[5]);
+    __m512i g = _mm512_set1_epi32(plan->start[6]), h = _mm512_set1_epi32(plan->start[7]);
+    for (unsigned int t = plan->first_round; t < 64; t++)
+    {
+        unsigned int varies = plan->varies[t];
+        __m512i wk;
+
+        if (varies == 0)
+        {
+            wk = _mm512_set1_epi32(plan->wk[t]);
+        }
+        else
+        {
+            if (t >= 16)
+            {
+                __m512i x = _mm512_set1_epi32(plan->partial[t]);
+                x = varies & TERM_W16 ? _mm512_add_epi32(x, w[t - 16]) : x;
+                x = varies & TERM_W15 ? _mm512_add_epi32(x, sig0_x16(w[t - 15])) : x;
+                x = varies & TERM_W7 ? _mm512_add_epi32(x, w[t - 7]) : x;
+                x = varies & TERM_W2 ? _mm512_add_epi32(x, sig1_x16(w[t - 2])) : x;
+                w[t] = x;
+            }
+            wk = _mm512_add_epi32(w[t], _mm512_set1_epi32(CONSTANTS[t]));
+        }
+
+        __m512i t1 = add3_x16(h, SIG1_x16(e), _mm512_add_epi32(ch_x16(e, f, g), wk));
+        __m512i t2 = _mm512_add_epi32(SIG0_x16(a), maj_x16(a, b, c));
+        h = g;
+        g = f;
+        f = e;
+        e = _mm512_add_epi32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm512_add_epi32(t1, t2);
+    }
+
+    __m512i top = _mm512_add_epi32(a, _mm512_set1_epi32(plan->midstate[0]));
+    return _mm512_cmple_epu32_mask(top, _mm512_set1_epi32(plan->target));
+}
+
+/* SHA-NI cannot skip the constant rounds or reuse schedule words, but four interleaved streams keep the
+ * SHA unit busy, which on some cores beats the wide vector kernels */
+static unsigned int search_shani_x4(const struct search_plan *plan, unsigned long long nonce)
+{
+    ALIGNED(64) unsigned char blocks[4][64];
+    const unsigned char *data[SHA256_MAX_LANES] = {NULL};
+    struct sha256_lanes lanes;
+    unsigned int candidates = 0;
+
+    for (unsigned int lane = 0; lane < 4; lane++)
+    {
+        memcpy(blocks[lane], plan->block, 64);
+        for (size_t k = 0; k < plan->nonce_size; k++)
+        {
+            blocks[lane][plan->nonce_offset + k] = (unsigned char)((nonce + lane) >> (8 * k));
+        }
+        data[lane] = blocks[lane];
+        for (int i = 0; i < 8; i++)
+        {
+            lanes.state[i][lane] = plan->midstate[i];
+        }
+    }
+
+    plan->shani->process_blocks_many(&lanes, data, 1);
+    for (unsigned int lane = 0; lane < 4; lane++)
+    {
+        candidates |= (unsigned int)(lanes.state[0][lane] <= plan->target) << lane;
+    }
+    return candidates;
+}
+
+static bool cpu_supports_shani_x4()
+{
+    return sha256_find_batch_backend("shani_x4") != NULL;
+}
+#endif
+
+/* Ordered by preference; the fastest supported one on a calibration run is used unless one is named */
+static const struct search_backend SEARCH_BACKENDS[] = {
+#if USE_CPU_EXTENSIONS
+    {"avx512", cpu_supports_avx512, 16, search_avx512_x16},
+    {"shani_x4", cpu_supports_shani_x4, 4, search_shani_x4},
+    {"avx2", cpu_supports_avx2, 8, search_avx2_x8},
+#endif
+    {"scalar", cpu_supports_scalar, 1, search_scalar},
+};
+
+#define SEARCH_BACKENDS_COUNT (sizeof(SEARCH_BACKENDS) / sizeof(SEARCH_BACKENDS[0]))
+#define CALIBRATION_NONCES 4096
+
+/* Chosen once, under search_backend_once, so concurrent first searches neither calibrate twice nor race
+ * on the pointer */
+static const struct search_backend *search_backend = NULL;
+static pthread_once_t search_backend_once = PTHREAD_ONCE_INIT;
+/* Keeps calibration runs from being optimized away */
+static volatile unsigned int calibration_sink;
+
+static const struct search_backend *find_search_backend(const char *name)
+{
+    for (size_t i = 0; i < SEARCH_BACKENDS_COUNT; i++)
+    {
+        if (strcmp(SEARCH_BACKENDS[i].name, name) == 0 && SEARCH_BACKENDS[i].supported())
+        {
+            return &SEARCH_BACKENDS[i];
+        }
+    }
+    return NULL;
+}
+
+/* Timed on a plan with the nonce in the first word, where no kernel gets to skip rounds */
+static const struct search_backend *select_search_backend(const struct search_plan *plan)
+{
+    const struct search_backend *best = NULL;
+    unsigned long long best_cycles = 0;
+
+    for (size_t i = 0; i < SEARCH_BACKENDS_COUNT; i++)
+    {
+        const struct search_backend *candidate = &SEARCH_BACKENDS[i];
+        unsigned long long fastest = 0;
+
+        if (!candidate->supported())
+        {
+            continue;
+        }
+        for (int run = 0; run <= 2; run++)
+        {
+            unsigned int candidates = 0;
+            unsigned long long start = __rdtsc();
+            for (unsigned long long nonce = 0; nonce < CALIBRATION_NONCES; nonce += candidate->lanes)
+            {
+                candidates |= candidate->search(plan, nonce);
+            }
+            unsigned long long cycles = __rdtsc() - start;
+            calibration_sink = candidates;
+            if (run > 0 && (fastest == 0 || cycles < fastest))
+            {
+                fastest = cycles;
+            }
+        }
+        if (best == NULL || fastest < best_cycles)
+        {
+            best = candidate;
+            best_cycles = fastest;
+        }
+    }
+    return best;
+}
+
+static void resolve_search_backend()
+{
+    static const unsigned char tail[8] = {0};
+    struct sha256_search_job job = {{0}, 0, tail, sizeof(tail), 0, 8, {0}};
+    struct search_plan plan;
+
+    memcpy(job.midstate, INITIAL_STATE, sizeof(job.midstate));
+    make_plan(&plan, &job);
+    plan.shani = sha256_find_batch_backend("shani_x4");
+    search_backend = select_search_backend(&plan);
+}
+
+static const struct search_backend *search_dispatch()
+{
+    pthread_once(&search_backend_once, resolve_search_backend);
+    return search_backend;
+}
+
+const char *sha256_supported_search_backend(size_t index)
+{
+    for (size_t i = 0; i < SEARCH_BACKENDS_COUNT; i++)
+    {
+        if (SEARCH_BACKENDS[i].supported() && index-- == 0)
+        {
+            return SEARCH_BACKENDS[i].name;
+        }
+    }
+    return NULL;
+}
+
+bool sha256_search_check(const struct sha256_search_job *job, unsigned long long nonce, unsigned char digest[32])
+{
+    unsigned char tail[55];
+    struct SHA256 context;
+
+    if (!valid_job(job))
+    {
+        memset(digest, 0, 32);
+        errno = EINVAL;
+        return false;
+    }
+
+    if (job->tail_length > 0)
+    {
+        memcpy(tail, job->tail, job->tail_length);
+    }
+    for (size_t k = 0; k < job->nonce_size; k++)
+    {
+        tail[job->nonce_offset + k] = (unsigned char)(nonce >> (8 * k));
+    }
+
+    context.length = job->prefix_length;
+    context.buffer_length = 0;
+    memcpy(context.state, job->midstate, sizeof(context.state));
+    sha256_update(&context, tail, job->tail_length);
+    sha256_complete(digest, &context);
+    return memcmp(digest, job->target, 32) < 0;
+}
+
+struct search_state
+{
+    const struct sha256_search_job *job;
+    const struct search_plan *plan;
+    const struct search_backend *backend;
+    unsigned long long end;
+
+    atomic_ullong next;
+    /* Lowest solution so far, end while there is none; chunks starting above it are not searched */
+    atomic_ullong best;
+    atomic_ullong hashes;
+    pthread_mutex_t mutex;
+    unsigned char digest[32];
+};
+
+static void record_solution(struct search_state *state, unsigned long long nonce, const unsigned char digest[32])
+{
+    pthread_mutex_lock(&state->mutex);
+    if (nonce < atomic_load(&state->best))
+    {
+        atomic_store(&state->best, nonce);
+        memcpy(state->digest, digest, 32);
+    }
+    pthread_mutex_unlock(&state->mutex);
+}
+
+/* Searches one chunk in lane-sized steps; returns at its first solution, the lowest in the chunk */
+static unsigned long long search_chunk(struct search_state *state, unsigned long long start, unsigned long long stop)
+{
+    unsigned int lanes = state->backend->lanes;
+    unsigned long long hashes = 0;
+
+    for (unsigned long long nonce = start; nonce < stop; nonce += lanes)
+    {
+        unsigned int candidates = state->backend->search(state->plan, nonce);
+        unsigned int valid = stop - nonce < lanes ? (unsigned int)(stop - nonce) : lanes;
+
+        hashes += valid;
+        for (unsigned int lane = 0; candidates != 0 && lane < valid; lane++)
+        {
+            unsigned char digest[32];
+            if ((candidates >> lane & 1) && sha256_search_check(state->job, nonce + lane, digest))
+            {
+                record_solution(state, nonce + lane, digest);
+                return hashes;
+            }
+        }
+    }
+    return hashes;
+}
+
+static void *search_worker(void *argument)
+{
+    struct search_state *state = argument;
+    unsigned long long hashes = 0;
+    unsigned long long start = atomic_load(&state->next);
+
+    while (start < state->end && start < atomic_load(&state->best))
+    {
+        unsigned long long stop = state->end - start < CHUNK_NONCES ? state->end : start + CHUNK_NONCES;
+        if (!atomic_compare_exchange_weak(&state->next, &start, stop))
+        {
+            continue;
+        }
+        hashes += search_chunk(state, start, stop);
+        start = atomic_load(&state->next);
+    }
+
+    atomic_fetch_add(&state->hashes, hashes);
+    return NULL;
+}
+
+bool sha256_search(const struct sha256_search_job *job, unsigned long long first_nonce, unsigned long long count,
+                   const struct sha256_search_options *options, struct sha256_search_result *result)
+{
+    struct sha256_search_options defaults = {0, NULL};
+    struct search_plan plan;
+    struct search_state state;
+    struct timespec started, finished;
+
+    if (options == NULL)
+    {
+        options = &defaults;
+    }
+    unsigned long long limit = job->nonce_size >= 8 ? ~0ULL : (1ULL << (8 * job->nonce_size)) - 1;
+    if (!valid_job(job) || first_nonce > limit || (count > 0 && count - 1 > limit - first_nonce) || count > ~0ULL - first_nonce)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    const struct search_backend *backend = options->backend != NULL ? find_search_backend(options->backend) : search_dispatch();
+    if (backend == NULL)
+    {
+        errno = ENOENT;
+        return false;
+    }
+
+    make_plan(&plan, job);
+    plan.shani = sha256_find_batch_backend("shani_x4");
+
+    unsigned int threads = options->threads;
+    if (threads == 0)
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (unsigned int)online : 1;
+    }
+    unsigned long long chunks = count / CHUNK_NONCES + 1;
+    threads = threads > MAX_THREADS ? MAX_THREADS : threads;
+    threads = threads > chunks ? (unsigned int)chunks : threads;
+
+    memset(&state, 0, sizeof(state));
+    state.job = job;
+    state.plan = &plan;
+    state.backend = backend;
+    state.end = first_nonce + count;
+    atomic_init(&state.next, first_nonce);
+    atomic_init(&state.best, state.end);
+    atomic_init(&state.hashes, 0);
+    pthread_mutex_init(&state.mutex, NULL);
+
+    /* The calling thread is one of the searchers; a thread that fails to start only costs speed */
+    pthread_t workers[MAX_THREADS];
+    bool started_workers[MAX_THREADS] = {false};
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    for (unsigned int i = 1; i < threads; i++)
+    {
+        started_workers[i] = pthread_create(&workers[i], NULL, search_worker, &state) == 0;
+    }
+    search_worker(&state);
+    for (unsigned int i = 1; i < threads; i++)
+    {
+        if (started_workers[i])
+        {
+            pthread_join(workers[i], NULL);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    pthread_mutex_destroy(&state.mutex);
+
+    memset(result, 0, sizeof(*result));
+    result->found = atomic_load(&state.best) < state.end;
+    result->nonce = result->found ? atomic_load(&state.best) : 0;
+    memcpy(result->digest, state.digest, 32);
+    result->hashes = atomic_load(&state.hashes);
+    result->seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) * 1e-9;
+    result->threads = threads;
+    result->backend = backend->name;
+    if (result->seconds > 0)
+    {
+        result->hashes_per_second = result->hashes / result->seconds;
+        result->hashes_per_second_per_core = result->hashes_per_second / threads;
+    }
+    return true;
+}
@@ -0,0 +1,72 @@
+#ifndef SHA256_SEARCH_H
+#define SHA256_SEARCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Proof-of-work search: find a nonce that makes sha256(message) fall below a target, where the message
+ * is some constant whole blocks, already folded into a midstate, followed by a short tail that holds the
+ * nonce. Only the final block is hashed per try, with its constant schedule words and the rounds before
+ * the nonce precomputed once. */
+
+struct sha256_search_job
+{
+    /* State after the leading whole blocks, e.g. from sha256_midstate; the initial state if there are none */
+    unsigned int midstate[8];
+    /* Bytes those blocks held, a multiple of 64 */
+    unsigned long long prefix_length;
+    /* The rest of the message, at most 55 bytes so that it and its padding fit one block. The nonce
+     * bytes in it are ignored. */
+    const unsigned char *tail;
+    size_t tail_length;
+    size_t nonce_offset;
+    /* 4 to 8 bytes, stored little-endian at nonce_offset */
+    size_t nonce_size;
+    /* A digest is a solution when, read as a big-endian number, it is below target */
+    unsigned char target[32];
+};
+
+struct sha256_search_options
+{
+    /* 0 uses every online cpu */
+    unsigned int threads;
+    /* One of sha256_supported_search_backend, NULL picks the fastest on this cpu */
+    const char *backend;
+};
+
+struct sha256_search_result
+{
+    bool found;
+    /* The lowest solution in the range, whatever the number of threads */
+    unsigned long long nonce;
+    unsigned char digest[32];
+    unsigned long long hashes;
+    double seconds;
+    unsigned int threads;
+    const char *backend;
+    double hashes_per_second;
+    /* Threads run one per core, so this is the rate of one core */
+    double hashes_per_second_per_core;
+};
+
+/* Tries nonces first_nonce .. first_nonce + count - 1. Returns false with errno EINVAL for a job that does
+ * not fit the rules above or a range beyond what nonce_size bytes hold, ENOENT for an unknown backend. */
+bool sha256_search(const struct sha256_search_job *job, unsigned long long first_nonce, unsigned long long count,
+                   const struct sha256_search_options *options, struct sha256_search_result *result);
+
+/* The admission side: the digest for one nonce, and whether it is a solution. A job that sha256_search
+ * would reject is never satisfied (errno EINVAL, zero digest). */
+bool sha256_search_check(const struct sha256_search_job *job, unsigned long long nonce, unsigned char digest[32]);
+
+/* Names of the search kernels this cpu supports, NULL past the last one */
+const char *sha256_supported_search_backend(size_t index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef SHA256_SIMD_H
+#define SHA256_SIMD_H
+
+#include "sha256_internal.h"
+
+/* The SHA-256 functions on 8 (AVX2) or 16 (AVX-512) lanes of 32-bit words, shared by the multi-lane
+ * kernels of sha256_mb.c and the nonce search of sha256_search.c */
+
+static TARGET_AVX2 inline __m256i rotr_x8(__m256i x, int n)
+{
+    return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+static TARGET_AVX2 inline __m256i add3_x8(__m256i x, __m256i y, __m256i z)
+{
+    return _mm256_add_epi32(_mm256_add_epi32(x, y), z);
+}
+
+static TARGET_AVX2 inline __m256i ch_x8(__m256i x, __m256i y, __m256i z)
+{
+    return _mm256_xor_si256(z, _mm256_and_si256(x, _mm256_xor_si256(y, z)));
+}
+
+static TARGET_AVX2 inline __m256i maj_x8(__m256i x, __m256i y, __m256i z)
+{
+    return _mm256_or_si256(_mm256_and_si256(x, y), _mm256_and_si256(z, _mm256_or_si256(x, y)));
+}
+
+static TARGET_AVX2 inline __m256i SIG0_x8(__m256i x)
+{
+    return _mm256_xor_si256(_mm256_xor_si256(rotr_x8(x, 2), rotr_x8(x, 13)), rotr_x8(x, 22));
+}
+
+static TARGET_AVX2 inline __m256i SIG1_x8(__m256i x)
+{
+    return _mm256_xor_si256(_mm256_xor_si256(rotr_x8(x, 6), rotr_x8(x, 11)), rotr_x8(x, 25));
+}
+
+static TARGET_AVX2 inline __m256i sig0_x8(__m256i x)
+{
+    return _mm256_xor_si256(_mm256_xor_si256(rotr_x8(x, 7), rotr_x8(x, 18)), _mm256_srli_epi32(x, 3));
+}
+
+static TARGET_AVX2 inline __m256i sig1_x8(__m256i x)
+{
+    return _mm256_xor_si256(_mm256_xor_si256(rotr_x8(x, 17), rotr_x8(x, 19)), _mm256_srli_epi32(x, 10));
+}
+
+static TARGET_AVX512 inline __m512i add3_x16(__m512i x, __m512i y, __m512i z)
+{
+    return _mm512_add_epi32(_mm512_add_epi32(x, y), z);
+}
+
+static TARGET_AVX512 inline __m512i xor3_x16(__m512i x, __m512i y, __m512i z)
+{
+    return _mm512_ternarylogic_epi32(x, y, z, 0x96);
+}
+
+static TARGET_AVX512 inline __m512i ch_x16(__m512i x, __m512i y, __m512i z)
+{
+    return _mm512_ternarylogic_epi32(x, y, z, 0xCA);
+}
+
+static TARGET_AVX512 inline __m512i maj_x16(__m512i x, __m512i y, __m512i z)
+{
+    return _mm512_ternarylogic_epi32(x, y, z, 0xE8);
+}
+
+static TARGET_AVX512 inline __m512i SIG0_x16(__m512i x)
+{
+    return xor3_x16(_mm512_ror_epi32(x, 2), _mm512_ror_epi32(x, 13), _mm512_ror_epi32(x, 22));
+}
+
+static TARGET_AVX512 inline __m512i SIG1_x16(__m512i x)
+{
+    return xor3_x16(_mm512_ror_epi32(x, 6), _mm512_ror_epi32(x, 11), _mm512_ror_epi32(x, 25));
+}
+
+static TARGET_AVX512 inline __m512i sig0_x16(__m512i x)
+{
+    return xor3_x16(_mm512_ror_epi32(x, 7), _mm512_ror_epi32(x, 18), _mm512_srli_epi32(x, 3));
+}
+
+static TARGET_AVX512 inline __m512i sig1_x16(__m512i x)
+{
+    return xor3_x16(_mm512_ror_epi32(x, 17), _mm512_ror_epi32(x, 19), _mm512_srli_epi32(x, 10));
+}
+
+#endif
@@ -0,0 +1,705 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sha256_tree.h"
+
+#define DEFAULT_SMALL_FILE_LIMIT (64 * 1024)
+/* A batch is closed at this many files or bytes, enough to keep 16 lanes busy several times over */
+#define BATCH_FILES 64
+#define BATCH_BYTES (1024 * 1024)
+#define MAX_WORKERS 256
+
+enum task_kind
+{
+    TASK_ROOT,
+    TASK_DIRECTORY,
+    TASK_FILE,
+    TASK_BATCH,
+};
+
+struct small_batch
+{
+    size_t count;
+    unsigned long long bytes;
+    char *paths[BATCH_FILES];
+    unsigned long long sizes[BATCH_FILES];
+    /* Only filled in with a cache: the stat of each file when it was listed, and whether it was a hit
+     * picked for verification */
+    struct sha256_cache_key keys[BATCH_FILES];
+    bool verify[BATCH_FILES];
+};
+
+struct tree_task
+{
+    enum task_kind kind;
+    char *path;
+    struct small_batch *batch;
+};
+
+/* The owner pushes and pops at the bottom, thieves take the oldest task from the top */
+struct task_deque
+{
+    pthread_mutex_t mutex;
+    struct tree_task *tasks;
+    size_t capacity;
+    size_t top;
+    size_t bottom;
+};
+
+struct tree_worker
+{
+    struct tree_pool *pool;
+    unsigned int index;
+    pthread_t thread;
+    bool started;
+    struct task_deque deque;
+    struct sha256_tree_entry *entries;
+    size_t entry_count;
+    size_t entry_capacity;
+    bool out_of_memory;
+    unsigned long long random;
+};
+
+struct tree_pool
+{
+    const struct sha256_tree_options *options;
+    size_t small_file_limit;
+    struct tree_worker *workers;
+    unsigned int worker_count;
+
+    /* Tasks pushed and not finished yet; the walk is over when it drops to zero */
+    atomic_size_t pending;
+    /* Bumped by every push, so an idle worker can tell new work from a spurious wakeup */
+    atomic_ulong version;
+    atomic_uint sleepers;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+};
+
+static bool deque_push(struct task_deque *deque, const struct tree_task *task)
+{
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->bottom - deque->top == deque->capacity)
+    {
+        size_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+        struct tree_task *tasks = malloc(capacity * sizeof(*tasks));
+        if (tasks == NULL)
+        {
+            pthread_mutex_unlock(&deque->mutex);
+            return false;
+        }
+        for (size_t i = deque->top; i < deque->bottom; i++)
+        {
+            tasks[i - deque->top] = deque->tasks[i % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->bottom -= deque->top;
+        deque->top = 0;
+        deque->capacity = capacity;
+    }
+    deque->tasks[deque->bottom++ % deque->capacity] = *task;
+    pthread_mutex_unlock(&deque->mutex);
+    return true;
+}
+
+static bool deque_pop(struct task_deque *deque, struct tree_task *task)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->bottom != deque->top)
+    {
+        *task = deque->tasks[--deque->bottom % deque->capacity];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->mutex);
+    return found;
+}
+
+static bool deque_steal(struct task_deque *deque, struct tree_task *task)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->bottom != deque->top)
+    {
+        *task = deque->tasks[deque->top++ % deque->capacity];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->mutex);
+    return found;
+}
+
+static void push_task(struct tree_worker *worker, enum task_kind kind, char *path, struct small_batch *batch)
+{
+    struct tree_pool *pool = worker->pool;
+    struct tree_task task = {kind, path, batch};
+
+    /* Counted before it becomes visible, so a thief finishing it early cannot end the walk */
+    atomic_fetch_add(&pool->pending, 1);
+    if (!deque_push(&worker->deque, &task))
+    {
+        atomic_fetch_sub(&pool->pending, 1);
+        worker->out_of_memory = true;
+        free(path);
+        free(batch);
+        return;
+    }
+
+    atomic_fetch_add(&pool->version, 1);
+    if (atomic_load(&pool->sleepers) > 0)
+    {
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cond_signal(&pool->wake);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+static void add_entry(struct tree_worker *worker, char *path, unsigned long long size, const unsigned char digest[32], int error,
+                      enum sha256_cache_status cache)
+{
+    if (worker->entry_count == worker->entry_capacity)
+    {
+        size_t capacity = worker->entry_capacity ? worker->entry_capacity * 2 : 256;
+        struct sha256_tree_entry *entries = realloc(worker->entries, capacity * sizeof(*entries));
+        if (entries == NULL)
+        {
+            worker->out_of_memory = true;
+            free(path);
+            return;
+        }
+        worker->entries = entries;
+        worker->entry_capacity = capacity;
+    }
+
+    struct sha256_tree_entry *entry = &worker->entries[worker->entry_count++];
+    entry->path = path;
+    entry->size = size;
+    entry->error = error;
+    entry->cache = cache;
+    if (digest != NULL)
+    {
+        memcpy(entry->digest, digest, 32);
+    }
+    else
+    {
+        memset(entry->digest, 0, 32);
+    }
+}
+
+static char *join_path(const char *directory, const char *name)
+{
+    size_t length = strlen(directory);
+    bool slash = length > 0 && directory[length - 1] != '/';
+    char *path = malloc(length + slash + strlen(name) + 1);
+
+    if (path != NULL)
+    {
+        memcpy(path, directory, length);
+        path[length] = '/';
+        strcpy(path + length + slash, name);
+    }
+    return path;
+}
+
+/* xorshift64, seeded per worker; only decides which cache hits get verified */
+static bool pick_for_verification(struct tree_worker *worker)
+{
+    unsigned int one_in = worker->pool->options->verify_one_in;
+
+    worker->random ^= worker->random << 13;
+    worker->random ^= worker->random >> 7;
+    worker->random ^= worker->random << 17;
+    return one_in > 0 && worker->random % one_in == 0;
+}
+
+static void hash_large_file(struct tree_worker *worker, char *path)
+{
+    const struct sha256_tree_options *options = worker->pool->options;
+    enum sha256_cache_status cache = SHA256_CACHE_OFF;
+    struct sha256_file_stats stats;
+    unsigned char digest[32];
+
+    if (sha256_cache_file(options->cache, digest, path, options->cache != NULL && pick_for_verification(worker), &options->file, &stats,
+                          &cache))
+    {
+        add_entry(worker, path, stats.bytes, digest, 0, cache);
+    }
+    else
+    {
+        add_entry(worker, path, 0, NULL, errno, SHA256_CACHE_OFF);
+    }
+}
+
+/* A small file that could not be batched, hashed on its own but recorded in the cache under the key it
+ * was listed with and verified if it was picked for that, as the batch would have */
+static void hash_listed_file(struct tree_worker *worker, char *path, const struct sha256_cache_key *key, bool verify)
+{
+    const struct sha256_tree_options *options = worker->pool->options;
+    enum sha256_cache_status cache = SHA256_CACHE_OFF;
+    struct sha256_file_stats stats;
+    unsigned char digest[32];
+
+    if (!sha256_file(digest, path, &options->file, &stats))
+    {
+        add_entry(worker, path, 0, NULL, errno, SHA256_CACHE_OFF);
+        return;
+    }
+    if (options->cache != NULL)
+    {
+        cache = sha256_cache_record(options->cache, path, key, digest, verify);
+    }
+    add_entry(worker, path, stats.bytes, digest, 0, cache);
+}
+
+/* Reads exactly size bytes and checks that the file ends there */
+static int read_small_file(const char *path, unsigned char *data, unsigned long long size, bool drop_cache)
+{
+    int fd = open(path, O_RDONLY);
+    unsigned long long done = 0;
+    unsigned char extra;
+    int error = 0;
+
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    while (done < size)
+    {
+        ssize_t n = read(fd, data + done, size - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            error = n < 0 ? errno : EAGAIN;
+            break;
+        }
+        done += n;
+    }
+
+    /* A file that changed size since it was listed is streamed instead */
+    if (error == 0 && read(fd, &extra, 1) != 0)
+    {
+        error = EAGAIN;
+    }
+    if (drop_cache)
+    {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    close(fd);
+    return error;
+}
+
+static void hash_small_batch(struct tree_worker *worker, struct small_batch *batch)
+{
+    const unsigned char *messages[BATCH_FILES];
+    size_t lengths[BATCH_FILES];
+    size_t slots[BATCH_FILES];
+    unsigned char digests[BATCH_FILES][32];
+    unsigned char *arena = malloc(batch->bytes ? batch->bytes : 1);
+    size_t ready = 0;
+    size_t offset = 0;
+
+    if (arena == NULL)
+    {
+        /* Without the arena every file still gets hashed, just one at a time */
+        for (size_t i = 0; i < batch->count; i++)
+        {
+            hash_listed_file(worker, batch->paths[i], &batch->keys[i], batch->verify[i]);
+        }
+        free(batch);
+        return;
+    }
+
+    for (size_t i = 0; i < batch->count; i++)
+    {
+        int error = read_small_file(batch->paths[i], arena + offset, batch->sizes[i], worker->pool->options->file.drop_cache);
+
+        if (error == EAGAIN)
+        {
+            /* Changed since it was listed, so the listed key no longer matches and nothing is recorded */
+            hash_listed_file(worker, batch->paths[i], &batch->keys[i], batch->verify[i]);
+            batch->paths[i] = NULL;
+        }
+        else if (error != 0)
+        {
+            add_entry(worker, batch->paths[i], 0, NULL, error, SHA256_CACHE_OFF);
+            batch->paths[i] = NULL;
+        }
+        else
+        {
+            messages[ready] = arena + offset;
+            lengths[ready] = batch->sizes[i];
+            slots[ready++] = i;
+        }
+        offset += batch->sizes[i];
+    }
+
+    if (ready > 0)
+    {
+        sha256_hash_many_lengths(messages, lengths, ready, digests);
+    }
+    for (size_t i = 0; i < ready; i++)
+    {
+        size_t slot = slots[i];
+        enum sha256_cache_status cache = SHA256_CACHE_OFF;
+        if (worker->pool->options->cache != NULL)
+        {
+            cache = sha256_cache_record(worker->pool->options->cache, batch->paths[slot], &batch->keys[slot], digests[i], batch->verify[slot]);
+        }
+        add_entry(worker, batch->paths[slot], lengths[i], digests[i], 0, cache);
+    }
+
+    free(arena);
+    free(batch);
+}
+
+static void queue_small_file(struct tree_worker *worker, struct small_batch **batch, char *path, const struct stat *status, bool verify)
+{
+    if (*batch == NULL)
+    {
+        *batch = calloc(1, sizeof(**batch));
+        if (*batch == NULL)
+        {
+            struct sha256_cache_key key;
+            sha256_cache_key(&key, status);
+            hash_listed_file(worker, path, &key, verify);
+            return;
+        }
+    }
+
+    size_t index = (*batch)->count++;
+    (*batch)->paths[index] = path;
+    (*batch)->sizes[index] = status->st_size;
+    (*batch)->bytes += status->st_size;
+    if (worker->pool->options->cache != NULL)
+    {
+        sha256_cache_key(&(*batch)->keys[index], status);
+        (*batch)->verify[index] = verify;
+    }
+
+    if ((*batch)->count == BATCH_FILES || (*batch)->bytes >= BATCH_BYTES)
+    {
+        push_task(worker, TASK_BATCH, NULL, *batch);
+        *batch = NULL;
+    }
+}
+
+/* Subdirectories and large files are pushed as soon as they are seen, so idle workers steal them
+ * while this listing is still running */
+static void list_directory(struct tree_worker *worker, char *path)
+{
+    struct small_batch *batch = NULL;
+    struct dirent *entry;
+    DIR *directory = opendir(path);
+
+    if (directory == NULL)
+    {
+        add_entry(worker, path, 0, NULL, errno, SHA256_CACHE_OFF);
+        return;
+    }
+
+    while ((entry = readdir(directory)) != NULL)
+    {
+        struct stat status;
+
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        /* Symlinks are resolved for files only, a link to a directory could make the walk loop */
+        if (fstatat(dirfd(directory), entry->d_name, &status, AT_SYMLINK_NOFOLLOW) != 0)
+        {
+            continue;
+        }
+        bool link = S_ISLNK(status.st_mode);
+        if (link && fstatat(dirfd(directory), entry->d_name, &status, 0) != 0)
+        {
+            continue;
+        }
+        if (!S_ISREG(status.st_mode) && !(S_ISDIR(status.st_mode) && !link))
+        {
+            continue;
+        }
+
+        char *child = join_path(path, entry->d_name);
+        if (child == NULL)
+        {
+            worker->out_of_memory = true;
+            continue;
+        }
+
+        if (S_ISDIR(status.st_mode))
+        {
+            push_task(worker, TASK_DIRECTORY, child, NULL);
+        }
+        else if ((unsigned long long)status.st_size <= worker->pool->small_file_limit)
+        {
+            struct sha256_cache *cache = worker->pool->options->cache;
+            bool verify = cache != NULL && pick_for_verification(worker);
+            bool hit = false;
+            unsigned char digest[32];
+
+            /* On a warm cache this stat is all a small file costs */
+            if (cache != NULL && !verify)
+            {
+                struct sha256_cache_key key;
+                sha256_cache_key(&key, &status);
+                hit = sha256_cache_lookup(cache, &key, digest);
+            }
+            if (hit)
+            {
+                add_entry(worker, child, status.st_size, digest, 0, SHA256_CACHE_HIT);
+            }
+            else
+            {
+                queue_small_file(worker, &batch, child, &status, verify);
+            }
+        }
+        else
+        {
+            push_task(worker, TASK_FILE, child, NULL);
+        }
+    }
+    closedir(directory);
+
+    if (batch != NULL)
+    {
+        push_task(worker, TASK_BATCH, NULL, batch);
+    }
+    free(path);
+}
+
+static void run_task(struct tree_worker *worker, struct tree_task *task)
+{
+    struct stat status;
+
+    switch (task->kind)
+    {
+    case TASK_ROOT:
+        /* A root may also be a pipe or "-"; anything that is not a directory is streamed */
+        if (strcmp(task->path, "-") != 0 && stat(task->path, &status) != 0)
+        {
+            add_entry(worker, task->path, 0, NULL, errno, SHA256_CACHE_OFF);
+        }
+        else if (strcmp(task->path, "-") != 0 && S_ISDIR(status.st_mode))
+        {
+            list_directory(worker, task->path);
+        }
+        else
+        {
+            hash_large_file(worker, task->path);
+        }
+        break;
+    case TASK_DIRECTORY:
+        list_directory(worker, task->path);
+        break;
+    case TASK_FILE:
+        hash_large_file(worker, task->path);
+        break;
+    case TASK_BATCH:
+        hash_small_batch(worker, task->batch);
+        break;
+    }
+}
+
+static bool take_task(struct tree_worker *worker, struct tree_task *task)
+{
+    struct tree_pool *pool = worker->pool;
+
+    if (deque_pop(&worker->deque, task))
+    {
+        return true;
+    }
+    for (unsigned int i = 1; i < pool->worker_count; i++)
+    {
+        struct tree_worker *victim = &pool->workers[(worker->index + i) % pool->worker_count];
+        if (deque_steal(&victim->deque, task))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *worker_main(void *argument)
+{
+    struct tree_worker *worker = argument;
+    struct tree_pool *pool = worker->pool;
+    struct tree_task task;
+
+    for (;;)
+    {
+        unsigned long seen = atomic_load(&pool->version);
+
+        if (take_task(worker, &task))
+        {
+            run_task(worker, &task);
+            if (atomic_fetch_sub(&pool->pending, 1) == 1)
+            {
+                pthread_mutex_lock(&pool->mutex);
+                pthread_cond_broadcast(&pool->wake);
+                pthread_mutex_unlock(&pool->mutex);
+            }
+            continue;
+        }
+
+        /* Either a push after the version was read wakes this worker, or this worker sees the new version */
+        pthread_mutex_lock(&pool->mutex);
+        atomic_fetch_add(&pool->sleepers, 1);
+        while (atomic_load(&pool->pending) > 0 && atomic_load(&pool->version) == seen)
+        {
+            pthread_cond_wait(&pool->wake, &pool->mutex);
+        }
+        atomic_fetch_sub(&pool->sleepers, 1);
+        bool done = atomic_load(&pool->pending) == 0;
+        pthread_mutex_unlock(&pool->mutex);
+
+        if (done)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    return strcmp(((const struct sha256_tree_entry *)a)->path, ((const struct sha256_tree_entry *)b)->path);
+}
+
+bool sha256_tree(const char *const *roots, size_t root_count, const struct sha256_tree_options *options,
+                 struct sha256_tree_entry **entries, size_t *entry_count)
+{
+    struct sha256_tree_options defaults = {0, 0, {SHA256_FILE_BUFFERED, 0, 0, false, 0, NULL, NULL}, NULL, 0};
+    struct tree_pool pool;
+    bool out_of_memory = false;
+    size_t total = 0;
+
+    if (options == NULL)
+    {
+        options = &defaults;
+    }
+
+    memset(&pool, 0, sizeof(pool));
+    pool.options = options;
+    pool.small_file_limit = options->small_file_limit ? options->small_file_limit : DEFAULT_SMALL_FILE_LIMIT;
+    pool.worker_count = options->threads;
+    if (pool.worker_count == 0)
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        pool.worker_count = online > 0 ? (unsigned int)online : 1;
+    }
+    if (pool.worker_count > MAX_WORKERS)
+    {
+        pool.worker_count = MAX_WORKERS;
+    }
+
+    pool.workers = calloc(pool.worker_count, sizeof(*pool.workers));
+    if (pool.workers == NULL)
+    {
+        return false;
+    }
+    atomic_init(&pool.pending, 0);
+    atomic_init(&pool.version, 0);
+    atomic_init(&pool.sleepers, 0);
+    pthread_mutex_init(&pool.mutex, NULL);
+    pthread_cond_init(&pool.wake, NULL);
+
+    for (unsigned int i = 0; i < pool.worker_count; i++)
+    {
+        pool.workers[i].pool = &pool;
+        pool.workers[i].index = i;
+        pool.workers[i].random = 0x9e3779b97f4a7c15ULL * (i + 1) ^ (unsigned long long)time(NULL);
+        pthread_mutex_init(&pool.workers[i].deque.mutex, NULL);
+    }
+
+    for (size_t i = 0; i < root_count; i++)
+    {
+        char *path = strdup(roots[i]);
+        if (path == NULL)
+        {
+            pool.workers[0].out_of_memory = true;
+            continue;
+        }
+        push_task(&pool.workers[0], TASK_ROOT, path, NULL);
+    }
+
+    /* The calling thread is worker 0; a worker that fails to start only costs parallelism */
+    for (unsigned int i = 1; i < pool.worker_count; i++)
+    {
+        pool.workers[i].started = pthread_create(&pool.workers[i].thread, NULL, worker_main, &pool.workers[i]) == 0;
+    }
+    worker_main(&pool.workers[0]);
+
+    for (unsigned int i = 0; i < pool.worker_count; i++)
+    {
+        if (pool.workers[i].started)
+        {
+            pthread_join(pool.workers[i].thread, NULL);
+        }
+        out_of_memory |= pool.workers[i].out_of_memory;
+        total += pool.workers[i].entry_count;
+    }
+
+    struct sha256_tree_entry *merged = out_of_memory ? NULL : malloc((total ? total : 1) * sizeof(*merged));
+    size_t count = 0;
+    for (unsigned int i = 0; i < pool.worker_count; i++)
+    {
+        struct tree_worker *worker = &pool.workers[i];
+        if (merged == NULL)
+        {
+            sha256_tree_free(worker->entries, worker->entry_count);
+            worker->entries = NULL;
+        }
+        /* An idle worker's entries are NULL, which memcpy may not be given even for zero bytes */
+        else if (worker->entry_count > 0)
+        {
+            memcpy(merged + count, worker->entries, worker->entry_count * sizeof(*merged));
+            count += worker->entry_count;
+        }
+        free(worker->entries);
+        free(worker->deque.tasks);
+        pthread_mutex_destroy(&worker->deque.mutex);
+    }
+    pthread_cond_destroy(&pool.wake);
+    pthread_mutex_destroy(&pool.mutex);
+    free(pool.workers);
+
+    if (merged == NULL)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+
+    qsort(merged, count, sizeof(*merged), compare_entries);
+    *entries = merged;
+    *entry_count = count;
+    return true;
+}
+
+void sha256_tree_free(struct sha256_tree_entry *entries, size_t entry_count)
+{
+    for (size_t i = 0; i < entry_count; i++)
+    {
+        free(entries[i].path);
+    }
+    free(entries);
+}
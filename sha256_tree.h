@@ -0,0 +1,49 @@
+#ifndef SHA256_TREE_H
+#define SHA256_TREE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sha256_cache.h"
+#include "sha256_file.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sha256_tree_entry
+{
+    char *path;
+    unsigned long long size;
+    unsigned char digest[32];
+    /* 0, or the errno of the open, read or directory listing that failed for this path */
+    int error;
+    enum sha256_cache_status cache;
+};
+
+struct sha256_tree_options
+{
+    /* 0 uses every online cpu */
+    unsigned int threads;
+    /* Files up to this size are read whole and hashed in batches across SIMD lanes; 0 picks 64 KiB */
+    size_t small_file_limit;
+    /* How the worker that picks up a larger file streams it */
+    struct sha256_file_options file;
+    /* Unchanged files found here are not read at all; NULL hashes everything */
+    struct sha256_cache *cache;
+    /* 0, or hash one cache hit in this many anyway and check it against the recorded digest */
+    unsigned int verify_one_in;
+};
+
+/* Hashes every regular file under the roots (files or directories) on a work-stealing pool. Symlinks to
+ * files are hashed, symlinks to directories are not followed. Entries come back sorted by path, so the
+ * output does not depend on scheduling. Returns false with errno set only when out of memory. */
+bool sha256_tree(const char *const *roots, size_t root_count, const struct sha256_tree_options *options,
+                 struct sha256_tree_entry **entries, size_t *entry_count);
+void sha256_tree_free(struct sha256_tree_entry *entries, size_t entry_count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif